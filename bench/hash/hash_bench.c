@@ -0,0 +1,89 @@
+/*
+ * hash_bench.c - String hash throughput: SipHash-1-3 vs FNV-1a
+ *
+ * Short identifiers are what the compiler and globals hash most; long
+ * payloads are what read() and external data produce. Run from the repo
+ * root:  make CFLAGS="-std=c99 -O2" bench-hash
+ */
+
+#include "hash.h"
+#include <time.h>
+
+#define PAYLOAD_MAX 65536
+
+static const char* identifiers[] = {
+    "x", "i", "self", "init", "print", "count", "value", "result",
+    "tostring", "elements", "__luapp_class", "initialize_everything",
+};
+#define IDENTIFIER_COUNT ((int)(sizeof(identifiers) / sizeof(identifiers[0])))
+
+static char payload[PAYLOAD_MAX];
+static volatile uint32_t sink;  // Keeps the hashing from being optimized away
+
+static double seconds(void) {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static void benchIdentifiers(const HashSeed* seed) {
+    int lengths[IDENTIFIER_COUNT];
+    for (int i = 0; i < IDENTIFIER_COUNT; i++) lengths[i] = (int)strlen(identifiers[i]);
+    const int rounds = 2000000;
+    
+    double start = seconds();
+    uint32_t acc = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+            acc += hashSipHash13(seed, identifiers[i], lengths[i]);
+        }
+    }
+    double sip = seconds() - start;
+    
+    start = seconds();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+            acc += hashFnv1a(identifiers[i], lengths[i]);
+        }
+    }
+    double fnv = seconds() - start;
+    sink = acc;
+    
+    double count = (double)rounds * IDENTIFIER_COUNT;
+    printf("identifiers (1-21 bytes): siphash13 %6.2f ns/hash   fnv1a %6.2f ns/hash\n",
+           sip / count * 1e9, fnv / count * 1e9);
+}
+
+static void benchPayload(const HashSeed* seed, int length) {
+    int rounds = (int)(200000000LL / length);
+    
+    double start = seconds();
+    uint32_t acc = 0;
+    for (int r = 0; r < rounds; r++) {
+        payload[r % length]++;  // Defeat hoisting the call out of the loop
+        acc += hashSipHash13(seed, payload, length);
+    }
+    double sip = seconds() - start;
+    
+    start = seconds();
+    for (int r = 0; r < rounds; r++) {
+        payload[r % length]++;
+        acc += hashFnv1a(payload, length);
+    }
+    double fnv = seconds() - start;
+    sink = acc;
+    
+    double bytes = (double)rounds * length;
+    printf("payload %6d bytes:       siphash13 %6.2f GB/s       fnv1a %6.2f GB/s\n",
+           length, bytes / sip / 1e9, bytes / fnv / 1e9);
+}
+
+int main(void) {
+    HashSeed seed;
+    initHashSeed(&seed);
+    for (int i = 0; i < PAYLOAD_MAX; i++) payload[i] = (char)(i * 131 + 7);
+    
+    benchIdentifiers(&seed);
+    benchPayload(&seed, 64);
+    benchPayload(&seed, 1024);
+    benchPayload(&seed, PAYLOAD_MAX);
+    return 0;
+}
@@ -0,0 +1,18 @@
+-- Host->script call overhead: 1M calls from Lua into a Lua++ closure.
+-- Every call goes through luappClosureWrapper -> callClosure -> run().
+-- Run from the repo root after `make lib`:  make bench-interop
+package.cpath = "./?.so;" .. package.cpath
+local luapp = require("luapp")
+
+local step = luapp.load("bench/interop/host_calls.luapp").step
+local N = 1000000
+
+local start = os.clock()
+local acc = 0
+for i = 1, N do
+    acc = step(acc, i)
+end
+local elapsed = os.clock() - start
+
+print(string.format("host_calls: %d calls, acc = %d", N, acc))
+print(string.format("elapsed: %gs (%.0f ns/call)", elapsed, elapsed / N * 1e9))
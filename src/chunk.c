@@ -5,6 +5,7 @@
 #include "chunk.h"
 #include "memory.h"
 #include "object.h"
+#include "vm.h"
 
 void initChunk(Chunk* chunk) {
     chunk->count = 0;
@@ -12,12 +13,15 @@ void initChunk(Chunk* chunk) {
     chunk->code = NULL;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    chunk->caches = NULL;
+    chunk->cacheCount = 0;
 }
 
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     FREE_ARRAY(int, chunk->lines, chunk->capacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCount);
     initChunk(chunk);
 }
 
@@ -35,10 +39,26 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
 }
 
 int addConstant(Chunk* chunk, Value value) {
+    push(value);  // Growing the pool may collect; keep the value rooted
     writeValueArray(&chunk->constants, value);
+    pop();
     return chunk->constants.count - 1;
 }
 
+void initInlineCaches(Chunk* chunk) {
+    int count = chunk->constants.count;
+    chunk->caches = ALLOCATE(InlineCache, count);
+    chunk->cacheCount = count;
+    for (int i = 0; i < count; i++) {
+        for (int way = 0; way < IC_WAYS; way++) {
+            chunk->caches[i].klass[way] = NULL;
+            chunk->caches[i].method[way] = NIL_VAL;
+            chunk->caches[i].shape[way] = NULL;
+            chunk->caches[i].slot[way] = -1;
+        }
+    }
+}
+
 void markArray(ValueArray* array) {
     for (int i = 0; i < array->count; i++) {
         markValue(array->values[i]);
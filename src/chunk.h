@@ -41,6 +41,7 @@ typedef enum {
     OP_MODULO,
     OP_NEGATE,
     OP_CONCAT,          // String concatenation (..)
+    OP_CONCAT_N,        // a .. b .. c: join the top N values at once
     OP_LENGTH,          // # operator (table/string length)
     
     // Comparison & logic
@@ -53,11 +54,20 @@ typedef enum {
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,            // Jump backwards
+    OP_FOR_PREP,        // Numeric for entry: check, skip if empty
+    OP_FOR_LOOP,        // Numeric for step: add, test, jump back
+    OP_FOR_PAIRS,       // Generic for step over array + hash part
+    OP_FOR_IPAIRS,      // Generic for step over array part up to nil
     
     // Functions
-    OP_CALL,
+    OP_CALL,            // argCount, results
+    OP_CALL_MULTI,      // Last argument expands to all values of a call/...
+    OP_TAIL_CALL,       // return f(...): reuse the frame (argCount, results)
     OP_CLOSURE,
-    OP_RETURN,
+    OP_RETURN,          // Return one value
+    OP_RETURN_N,        // Return N values
+    OP_RETURN_MULTI,    // Return N values plus all values of a call/...
+    OP_VARARG,          // Push the frame's extra arguments (...)
     
     // OOP
     OP_CLASS,           // Define a class
@@ -71,17 +81,44 @@ typedef enum {
     OP_NEW,             // Instantiate class
     
     // Tables
-    OP_TABLE,           // Create empty table
+    OP_TABLE,           // Create table sized for [array:u16][hash:u16] entries
     OP_TABLE_GET,       // table[key]
     OP_TABLE_SET,       // table[key] = value
-    OP_TABLE_ADD,       // Add value to array part during literal construction
+    OP_TABLE_SET_LIST,  // Store [count] stack values at positions [start:u16].. (literals)
+    OP_TABLE_SET_LIST_MULTI, // Same, plus all values of a trailing call/...
     OP_TABLE_SET_FIELD, // Set named field during literal construction
+    OP_TABLE_SET_KEY,   // Set [key] = value during literal construction
     
     // Traits
     OP_TRAIT,           // Define a trait
     OP_IMPLEMENT,       // Class implements trait
 } OpCode;
 
+/*
+ * Result-count operand of OP_CALL, OP_CALL_MULTI, OP_TAIL_CALL, OP_INVOKE,
+ * OP_SUPER_INVOKE and OP_VARARG: keep every value and push their count on
+ * top, for the *_MULTI instruction that consumes them right after.
+ */
+#define MULTI_RESULTS UINT8_MAX
+
+/*
+ * InlineCache - per-site cache for property gets/sets and method calls.
+ *
+ * Every property or invoke site gets its own name constant (addConstant
+ * never deduplicates), so a site's cache lives at the same index as its
+ * name constant. Each side remembers up to IC_WAYS receivers (polymorphic):
+ * methods are keyed by class, fields by instance shape, where a slot of -1
+ * records that the shape has no such field.
+ */
+#define IC_WAYS 2
+
+typedef struct {
+    struct ObjClass* klass[IC_WAYS];  // Receiver classes seen here (NULL = empty)
+    Value method[IC_WAYS];            // Method each class resolved to
+    struct ObjShape* shape[IC_WAYS];  // Receiver shapes seen here (NULL = empty)
+    int slot[IC_WAYS];                // Field slot in that shape, -1 if absent
+} InlineCache;
+
 /*
  * Chunk - bytecode storage for a single function/script.
  */
@@ -91,6 +128,8 @@ typedef struct {
     uint8_t* code;      // Bytecode array
     int* lines;         // Line numbers for error reporting
     ValueArray constants; // Constant pool
+    InlineCache* caches;  // Parallel to constants, NULL if no property sites
+    int cacheCount;
 } Chunk;
 
 void initChunk(Chunk* chunk);
@@ -98,6 +137,9 @@ void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 int addConstant(Chunk* chunk, Value value);
 
+/* Allocate empty inline caches, one per constant (call once the chunk is done) */
+void initInlineCaches(Chunk* chunk);
+
 /* GC helper - mark constants in chunk */
 void markArray(ValueArray* array);
 
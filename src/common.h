@@ -11,6 +11,24 @@
 // Compile-time debug flags (for development builds)
 #define DEBUG_STRESS_GC 0
 
+// Threaded (computed-goto) dispatch in the interpreter loop. Needs the GNU
+// labels-as-values extension; build with -DLUAPP_NO_COMPUTED_GOTO to force
+// the portable switch loop.
+#if defined(__GNUC__) && !defined(LUAPP_NO_COMPUTED_GOTO)
+#define LUAPP_COMPUTED_GOTO 1
+#else
+#define LUAPP_COMPUTED_GOTO 0
+#endif
+
+// NaN-boxed 8-byte Values (see value.h). Needs 64-bit pointers that fit in
+// the 48-bit NaN payload; build with -DLUAPP_NO_NAN_BOXING for the 16-byte
+// tagged union instead.
+#if UINTPTR_MAX == UINT64_MAX && !defined(LUAPP_NO_NAN_BOXING)
+#define LUAPP_NAN_BOXING 1
+#else
+#define LUAPP_NAN_BOXING 0
+#endif
+
 // Runtime debug flags (controlled via --verbose)
 typedef struct {
     bool printCode;       // Dump bytecode after compilation
@@ -15,6 +15,8 @@
 #include "diagnostic.h"
 #include "lexer.h"
 #include "memory.h"
+#include "number.h"
+#include "vm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -91,6 +93,8 @@ typedef struct Loop {
     int scopeDepth;         // Scope depth when loop started
     int breakJumps[256];    // Jump locations to patch for break
     int breakCount;
+    int continueJumps[256]; // Forward continues (continueTarget < 0)
+    int continueCount;
 } Loop;
 
 /* Compiler state - one per function being compiled */
@@ -105,6 +109,20 @@ typedef struct Compiler {
     int scopeDepth;
     
     Loop* currentLoop;      // Innermost loop for break
+    
+    // Offsets of recent OP_CONSTANTs that constant folding may still rewrite.
+    // Operand bytes can look like opcodes, so the folder must not infer this
+    // from the bytecode itself.
+    int foldable[16];
+    int foldableCount;
+    
+    // Result-count operand of the last call or '...' emitted (-1 = none).
+    // While it is still the last byte of the chunk, the expression ends in
+    // that call and a list context may widen it to several values.
+    int multiSite;
+    int callSite;           // multiSite of the last plain OP_CALL (tail call candidate)
+    
+    bool hasCacheSites;     // Emitted a property/invoke op (needs InlineCaches)
 } Compiler;
 
 /* Class compiler - tracks current class for self/super */
@@ -123,6 +141,7 @@ static void statement(void);
 static void declaration(void);
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
+static void parseInfix(Precedence precedence, bool canAssign);
 
 /* ========== Error Handling ========== */
 
@@ -242,6 +261,11 @@ static int emitJump(uint8_t instruction) {
 static void patchJump(int offset) {
     int jump = currentChunk()->count - offset - 2;
     
+    // A jump now lands here, so earlier constants are no longer straight-line
+    // and a call before it is not the whole expression (a and f())
+    current->foldableCount = 0;
+    current->multiSite = -1;
+    
     if (jump > UINT16_MAX) {
         error("Too much code to jump over.");
     }
@@ -253,10 +277,10 @@ static void patchJump(int offset) {
 static void emitReturn(void) {
     if (current->type == TYPE_INITIALIZER) {
         emitBytes(OP_GET_LOCAL, 0);  // Return self
+        emitByte(OP_RETURN);
     } else {
-        emitByte(OP_NIL);
+        emitBytes(OP_RETURN_N, 0);  // No values; a caller wanting one gets nil
     }
-    emitByte(OP_RETURN);
 }
 
 static uint8_t makeConstant(Value value) {
@@ -268,12 +292,48 @@ static uint8_t makeConstant(Value value) {
     return (uint8_t)constant;
 }
 
+/* Property/invoke sites: their inline cache sits at the name constant's index */
+static void emitCachedOp(OpCode op, uint8_t name) {
+    current->hasCacheSites = true;
+    emitBytes(op, name);
+}
+
+/* Result-count operand for a call or '...'; the caller emits the opcode */
+static void emitResults(void) {
+    emitByte(1);
+    current->multiSite = currentChunk()->count - 1;
+}
+
+/* Does the expression just compiled end in a call or '...'? */
+static bool endsInMultiSite(void) {
+    return current->multiSite >= 0 &&
+           current->multiSite == currentChunk()->count - 1;
+}
+
+/* Widen (or narrow) the trailing call or '...' to 'results' values */
+static void setMultiResults(int results) {
+    currentChunk()->code[current->multiSite] = (uint8_t)results;
+    current->multiSite = -1;
+}
+
 static void emitConstant(Value value) {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    uint8_t constant = makeConstant(value);
+    if (current->foldableCount == 16) {
+        memmove(current->foldable, current->foldable + 1, sizeof(int) * 15);
+        current->foldableCount--;
+    }
+    current->foldable[current->foldableCount++] = currentChunk()->count;
+    emitBytes(OP_CONSTANT, constant);
 }
 
 /* ========== Constant Folding Helpers ========== */
 
+/* Is there a tracked OP_CONSTANT at 'offset', 'depth' entries from the top? */
+static bool foldableAt(int depth, int offset) {
+    if (current->foldableCount <= depth) return false;
+    return current->foldable[current->foldableCount - 1 - depth] == offset;
+}
+
 /*
  * Check if the last emitted instruction was OP_CONSTANT.
  * Returns true and sets *value if so.
@@ -281,7 +341,7 @@ static void emitConstant(Value value) {
 static bool lastWasConstant(Value* value) {
     Chunk* chunk = currentChunk();
     if (chunk->count < 2) return false;
-    if (chunk->code[chunk->count - 2] != OP_CONSTANT) return false;
+    if (!foldableAt(0, chunk->count - 2)) return false;
     
     uint8_t constantIdx = chunk->code[chunk->count - 1];
     *value = chunk->constants.values[constantIdx];
@@ -293,6 +353,7 @@ static bool lastWasConstant(Value* value) {
  */
 static void removeLastConstant(void) {
     currentChunk()->count -= 2;
+    current->foldableCount--;
 }
 
 /*
@@ -302,8 +363,8 @@ static void removeLastConstant(void) {
 static bool lastTwoWereConstants(Value* a, Value* b) {
     Chunk* chunk = currentChunk();
     if (chunk->count < 4) return false;
-    if (chunk->code[chunk->count - 2] != OP_CONSTANT) return false;
-    if (chunk->code[chunk->count - 4] != OP_CONSTANT) return false;
+    if (!foldableAt(0, chunk->count - 2)) return false;
+    if (!foldableAt(1, chunk->count - 4)) return false;
     
     uint8_t idxB = chunk->code[chunk->count - 1];
     uint8_t idxA = chunk->code[chunk->count - 3];
@@ -317,6 +378,7 @@ static bool lastTwoWereConstants(Value* a, Value* b) {
  */
 static void removeLastTwoConstants(void) {
     currentChunk()->count -= 4;
+    current->foldableCount -= 2;
 }
 
 /* ========== Compiler Init/End ========== */
@@ -328,6 +390,10 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
     compiler->currentLoop = NULL;
+    compiler->foldableCount = 0;
+    compiler->multiSite = -1;
+    compiler->callSite = -1;
+    compiler->hasCacheSites = false;
     compiler->function = newFunction();
     current = compiler;
     
@@ -365,6 +431,8 @@ static ObjFunction* endCompiler(void) {
         }
     }
     
+    if (current->hasCacheSites) initInlineCaches(currentChunk());
+    
     // Runtime debug: dump bytecode if verbose
     if (debugFlags.printCode && !parser.hadError) {
         disassembleChunk(currentChunk(), 
@@ -408,9 +476,10 @@ static bool isSideEffectFree(int start, int end) {
             case OP_GREATER:
             case OP_LESS:
             case OP_CONCAT:
+            case OP_CONCAT_N:
             case OP_LENGTH:
             case OP_TABLE:
-            case OP_TABLE_ADD:
+            case OP_TABLE_SET_LIST:
             case OP_TABLE_SET_FIELD:
                 /* These are side-effect free */
                 break;
@@ -436,16 +505,21 @@ static bool isSideEffectFree(int start, int end) {
             case OP_SET_LOCAL:
             case OP_GET_UPVALUE:
             case OP_SET_UPVALUE:
+            case OP_TABLE_SET_FIELD:
+            case OP_CONCAT_N:
+                i += 2; break;
+            case OP_CALL:
             case OP_GET_GLOBAL:
             case OP_SET_GLOBAL:
             case OP_DEFINE_GLOBAL:
-            case OP_CALL:
-            case OP_TABLE_SET_FIELD:
-                i += 2; break;
             case OP_JUMP:
             case OP_JUMP_IF_FALSE:
             case OP_LOOP:
                 i += 3; break;
+            case OP_TABLE_SET_LIST:
+                i += 4; break;
+            case OP_TABLE:
+                i += 5; break;
             default:
                 i += 1; break;
         }
@@ -603,13 +677,27 @@ static void declareVariable(void) {
     addLocal(*name);
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
+/* Globals are addressed by VM slot, resolved here once at compile time */
+static int globalSlotFor(Token* name) {
+    return globalSlot(copyString(name->start, name->length));
+}
+
+static void emitGlobalOp(OpCode op, int slot) {
+    if (slot > UINT16_MAX) {
+        error("Too many global variables.");
+        return;
+    }
+    emitByte(op);
+    emitBytes((slot >> 8) & 0xff, slot & 0xff);
+}
+
+static int parseVariable(const char* errorMessage) {
     consume(TOKEN_IDENTIFIER, errorMessage);
     
     declareVariable();
-    if (current->scopeDepth > 0) return 0;  // Local - no constant needed
+    if (current->scopeDepth > 0) return 0;  // Local - no slot needed
     
-    return identifierConstant(&parser.previous);
+    return globalSlotFor(&parser.previous);
 }
 
 static void markInitialized(void) {
@@ -617,12 +705,12 @@ static void markInitialized(void) {
     current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(int global) {
     if (current->scopeDepth > 0) {
         markInitialized();
         return;
     }
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitGlobalOp(OP_DEFINE_GLOBAL, global);
 }
 
 /* ========== Expression Parsing (Pratt) ========== */
@@ -638,16 +726,19 @@ static void namedVariable(Token name, bool canAssign) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
-        arg = identifierConstant(&name);
+        arg = globalSlotFor(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
     }
     
+    bool isGlobal = getOp == OP_GET_GLOBAL;
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(setOp, (uint8_t)arg);
+        if (isGlobal) emitGlobalOp(setOp, arg);
+        else emitBytes(setOp, (uint8_t)arg);
     } else {
-        emitBytes(getOp, (uint8_t)arg);
+        if (isGlobal) emitGlobalOp(getOp, arg);
+        else emitBytes(getOp, (uint8_t)arg);
     }
 }
 
@@ -657,7 +748,11 @@ static void variable(bool canAssign) {
 
 static void number(bool canAssign) {
     (void)canAssign;
-    double value = strtod(parser.previous.start, NULL);
+    double value;
+    if (!parseNumber(parser.previous.start, parser.previous.length, &value)) {
+        error("Malformed number.");
+        return;
+    }
     emitConstant(NUMBER_VAL(value));
 }
 
@@ -681,6 +776,7 @@ static void grouping(bool canAssign) {
     (void)canAssign;
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    current->multiSite = -1;  // (f()) is always one value
 }
 
 static bool isFalseyValue(Value value) {
@@ -790,21 +886,6 @@ static void binary(bool canAssign) {
             }
         }
         
-        // String concatenation folding
-        if (IS_STRING(a) && IS_STRING(b) && operatorType == TOKEN_DOT_DOT) {
-            ObjString* strA = AS_STRING(a);
-            ObjString* strB = AS_STRING(b);
-            int length = strA->length + strB->length;
-            char* chars = ALLOCATE(char, length + 1);
-            memcpy(chars, strA->chars, strA->length);
-            memcpy(chars + strA->length, strB->chars, strB->length);
-            chars[length] = '\0';
-            
-            removeLastTwoConstants();
-            emitConstant(OBJ_VAL(takeString(chars, length)));
-            return;
-        }
-        
         // Boolean/nil equality folding
         if (operatorType == TOKEN_EQUAL_EQUAL || operatorType == TOKEN_TILDE_EQUAL) {
             bool equal = valuesEqual(a, b);
@@ -820,7 +901,6 @@ static void binary(bool canAssign) {
         case TOKEN_STAR:          emitByte(OP_MULTIPLY); break;
         case TOKEN_SLASH:         emitByte(OP_DIVIDE); break;
         case TOKEN_PERCENT:       emitByte(OP_MODULO); break;
-        case TOKEN_DOT_DOT:       emitByte(OP_CONCAT); break;
         case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
         case TOKEN_TILDE_EQUAL:   emitByte(OP_EQUAL); emitByte(OP_NOT); break;
         case TOKEN_GREATER:       emitByte(OP_GREATER); break;
@@ -831,7 +911,67 @@ static void binary(bool canAssign) {
     }
 }
 
-static uint8_t argumentList(void) {
+/* Characters of a string or number constant, for folding '..' */
+static bool concatConstant(Value value, char* number, const char** chars, int* length) {
+    if (IS_STRING(value)) {
+        *chars = AS_STRING(value)->chars;
+        *length = AS_STRING(value)->length;
+        return true;
+    }
+    if (IS_NUMBER(value)) {
+        *length = formatNumber(AS_NUMBER(value), number);
+        *chars = number;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * a .. b .. c. '..' is right associative, so a chain is one expression:
+ * all its operands are pushed and joined by a single OP_CONCAT_N, which
+ * sizes the result once instead of building every intermediate string.
+ * Neighbouring constant operands are folded as they are parsed.
+ */
+static void concat(bool canAssign) {
+    (void)canAssign;
+    int count = 1;      // The left operand is already compiled
+    do {
+        parsePrecedence(PREC_CONCAT + 1);
+        count++;
+        
+        Value a, b;
+        char numberA[NUMBER_BUFFER_SIZE], numberB[NUMBER_BUFFER_SIZE];
+        const char* charsA;
+        const char* charsB;
+        int lengthA, lengthB;
+        if (lastTwoWereConstants(&a, &b) &&
+            concatConstant(a, numberA, &charsA, &lengthA) &&
+            concatConstant(b, numberB, &charsB, &lengthB)) {
+            // Both constants stay in the chunk (reachable) while this allocates
+            ObjString* result = concatChars(charsA, lengthA, charsB, lengthB);
+            removeLastTwoConstants();
+            emitConstant(OBJ_VAL(result));
+            count--;
+        } else if (count == UINT8_MAX) {
+            // Operand limit: the joined prefix becomes the next first operand
+            emitBytes(OP_CONCAT_N, (uint8_t)count);
+            count = 1;
+        }
+    } while (match(TOKEN_DOT_DOT));
+    
+    if (count == 2) {
+        emitByte(OP_CONCAT);
+    } else if (count > 2) {
+        emitBytes(OP_CONCAT_N, (uint8_t)count);
+    }
+}
+
+/*
+ * Parse call arguments. With 'multi' set, a last argument that is a call
+ * or '...' passes all of its values: it is left out of the returned count
+ * and *multi becomes true.
+ */
+static uint8_t argumentList(bool* multi) {
     uint8_t argCount = 0;
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
@@ -843,13 +983,24 @@ static uint8_t argumentList(void) {
         } while (match(TOKEN_COMMA));
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    
+    if (multi != NULL) {
+        *multi = argCount > 0 && endsInMultiSite();
+        if (*multi) {
+            setMultiResults(MULTI_RESULTS);
+            argCount--;
+        }
+    }
     return argCount;
 }
 
 static void call(bool canAssign) {
     (void)canAssign;
-    uint8_t argCount = argumentList();
-    emitBytes(OP_CALL, argCount);
+    bool multi;
+    uint8_t argCount = argumentList(&multi);
+    emitBytes(multi ? OP_CALL_MULTI : OP_CALL, argCount);
+    emitResults();
+    if (!multi) current->callSite = current->multiSite;
 }
 
 static void dot(bool canAssign) {
@@ -858,14 +1009,15 @@ static void dot(bool canAssign) {
     
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(OP_SET_PROPERTY, name);
+        emitCachedOp(OP_SET_PROPERTY, name);
     } else if (match(TOKEN_LEFT_PAREN)) {
         // Method call: obj.method(args) -> invoke optimization
-        uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);
+        uint8_t argCount = argumentList(NULL);
+        emitCachedOp(OP_INVOKE, name);
         emitByte(argCount);
+        emitResults();
     } else {
-        emitBytes(OP_GET_PROPERTY, name);
+        emitCachedOp(OP_GET_PROPERTY, name);
     }
 }
 
@@ -875,11 +1027,12 @@ static void colon(bool canAssign) {
     uint8_t name = identifierConstant(&parser.previous);
     
     consume(TOKEN_LEFT_PAREN, "Expect '(' after method name.");
-    uint8_t argCount = argumentList();
+    uint8_t argCount = argumentList(NULL);
     
     // obj:method(args) is sugar for obj.method(obj, args)
-    emitBytes(OP_INVOKE, name);
+    emitCachedOp(OP_INVOKE, name);
     emitByte(argCount);
+    emitResults();
 }
 
 static void self_(bool canAssign) {
@@ -913,28 +1066,37 @@ static void super_(bool canAssign) {
     namedVariable((Token){.start = "self", .length = 4}, false);
     
     if (match(TOKEN_LEFT_PAREN)) {
-        uint8_t argCount = argumentList();
+        uint8_t argCount = argumentList(NULL);
         namedVariable((Token){.start = "super", .length = 5}, false);
-        emitBytes(OP_SUPER_INVOKE, name);
+        emitCachedOp(OP_SUPER_INVOKE, name);
         emitByte(argCount);
+        emitResults();
     } else {
         namedVariable((Token){.start = "super", .length = 5}, false);
-        emitBytes(OP_GET_SUPER, name);
+        emitCachedOp(OP_GET_SUPER, name);
     }
 }
 
 static void new_(bool canAssign) {
     (void)canAssign;
     consume(TOKEN_IDENTIFIER, "Expect class name after 'new'.");
-    uint8_t name = identifierConstant(&parser.previous);
-    emitBytes(OP_GET_GLOBAL, name);
+    emitGlobalOp(OP_GET_GLOBAL, globalSlotFor(&parser.previous));
     
     consume(TOKEN_LEFT_PAREN, "Expect '(' after class name.");
-    uint8_t argCount = argumentList();
+    uint8_t argCount = argumentList(NULL);
     
     emitBytes(OP_NEW, argCount);
 }
 
+static void vararg(bool canAssign) {
+    (void)canAssign;
+    if (!current->function->isVararg) {
+        error("Cannot use '...' outside a vararg function.");
+    }
+    emitByte(OP_VARARG);
+    emitResults();
+}
+
 static void and_(bool canAssign) {
     (void)canAssign;
     int endJump = emitJump(OP_JUMP_IF_FALSE);
@@ -957,10 +1119,68 @@ static void or_(bool canAssign) {
     patchJump(endJump);
 }
 
-/* Table literal: {1, 2, 3} or {name = "foo", age = 25} */
+/* Array items left on the stack before an OP_TABLE_SET_LIST stores them */
+#define TABLE_FLUSH_ITEMS 50
+
+typedef struct {
+    int arrayItems;     // Positional items so far
+    int hashItems;      // name = v and [k] = v entries so far
+    int pending;        // Items compiled but not yet stored
+} TableLiteral;
+
+/* Store the pending items at their positions */
+static void flushTableItems(TableLiteral* literal) {
+    if (literal->pending == 0) return;
+    int start = literal->arrayItems - literal->pending + 1;
+    emitBytes(OP_TABLE_SET_LIST, (uint8_t)literal->pending);
+    emitBytes((start >> 8) & 0xff, start & 0xff);
+    literal->pending = 0;
+}
+
+/*
+ * Count the array element just compiled. A call or '...' as the last
+ * element stores all of its values.
+ */
+static void tableItem(TableLiteral* literal) {
+    literal->arrayItems++;
+    literal->pending++;
+    if (literal->arrayItems > UINT16_MAX) {
+        error("Too many items in table literal.");
+        literal->arrayItems = 0;
+        literal->pending = 0;
+        return;
+    }
+    if (check(TOKEN_RIGHT_BRACE) && endsInMultiSite()) {
+        setMultiResults(MULTI_RESULTS);
+        int start = literal->arrayItems - literal->pending + 1;
+        emitBytes(OP_TABLE_SET_LIST_MULTI, (uint8_t)(literal->pending - 1));
+        emitBytes((start >> 8) & 0xff, start & 0xff);
+        literal->pending = 0;
+    } else if (literal->pending == TABLE_FLUSH_ITEMS) {
+        flushTableItems(literal);
+    }
+}
+
+/* Record a size hint in the OP_TABLE at offset */
+static void patchTableHint(int offset, int count) {
+    if (count > UINT16_MAX) count = UINT16_MAX;
+    currentChunk()->code[offset] = (count >> 8) & 0xff;
+    currentChunk()->code[offset + 1] = count & 0xff;
+}
+
+/*
+ * Table literal: {1, 2, 3} or {name = "foo", age = 25}. OP_TABLE is
+ * patched with the number of positional and keyed entries so the table
+ * is allocated at its final size; positional items are stored in runs
+ * of up to TABLE_FLUSH_ITEMS at their explicit positions.
+ */
 static void table_(bool canAssign) {
     (void)canAssign;
-    emitByte(OP_TABLE);  // Create empty table
+    emitByte(OP_TABLE);
+    int hints = currentChunk()->count;
+    emitBytes(0, 0);    // Array size, patched below
+    emitBytes(0, 0);    // Hash size
+    TableLiteral literal = {0, 0, 0};
     
     if (!check(TOKEN_RIGHT_BRACE)) {
         do {
@@ -971,41 +1191,49 @@ static void table_(bool canAssign) {
                 Token name = parser.current;
                 advance();
                 if (match(TOKEN_EQUAL)) {
-                    // Key = value pair: {name = "foo"}
+                    // Key = value pair: {name = "foo"}. The table has to be
+                    // just below the value, so pending items go first
+                    flushTableItems(&literal);
                     uint8_t nameConstant = identifierConstant(&name);
                     expression();
                     // Stack: table, value
                     emitBytes(OP_TABLE_SET_FIELD, nameConstant);
+                    literal.hashItems++;
                     continue;
                 } else {
                     // Not key=value, it's just an expression starting with identifier
-                    // We already consumed the identifier, so emit it as variable
+                    // We already consumed the identifier: compile it as the
+                    // prefix operand and parse the rest of the expression
                     namedVariable(name, false);
-                    emitByte(OP_TABLE_ADD);
+                    parseInfix(PREC_ASSIGNMENT, false);
+                    tableItem(&literal);
                     continue;
                 }
             }
             
             // Check for [expr] = value syntax
             if (match(TOKEN_LEFT_BRACKET)) {
+                flushTableItems(&literal);
                 expression();  // key
                 consume(TOKEN_RIGHT_BRACKET, "Expect ']' after table key.");
                 consume(TOKEN_EQUAL, "Expect '=' after table key.");
                 expression();  // value
-                // Stack: table, key, value - need to rearrange
-                // For now, use a simpler approach - just use array syntax
-                // TODO: implement proper [key] = value
-                emitByte(OP_TABLE_SET);
+                // Stack: table, key, value
+                emitByte(OP_TABLE_SET_KEY);
+                literal.hashItems++;
                 continue;
             }
             
             // Array element
             expression();
-            emitByte(OP_TABLE_ADD);
+            tableItem(&literal);
         } while (match(TOKEN_COMMA));
     }
     
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after table elements.");
+    flushTableItems(&literal);
+    patchTableHint(hints, literal.arrayItems);
+    patchTableHint(hints + 2, literal.hashItems);
 }
 
 /* Subscript operator: table[key] */
@@ -1055,8 +1283,8 @@ static ParseRule rules[] = {
     [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
     [TOKEN_GREATER]       = {NULL,     binary, PREC_COMPARISON},
     [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
-    [TOKEN_DOT_DOT]       = {NULL,     binary, PREC_CONCAT},
-    [TOKEN_DOT_DOT_DOT]   = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_DOT_DOT]       = {NULL,     concat, PREC_CONCAT},
+    [TOKEN_DOT_DOT_DOT]   = {vararg,   NULL,   PREC_NONE},
     [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
     [TOKEN_STRING]        = {string,   NULL,   PREC_NONE},
     [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
@@ -1098,6 +1326,19 @@ static ParseRule* getRule(TokenType type) {
     return &rules[type];
 }
 
+/* Continue an expression whose prefix operand has already been compiled */
+static void parseInfix(Precedence precedence, bool canAssign) {
+    while (precedence <= getRule(parser.current.type)->precedence) {
+        advance();
+        ParseFn infixRule = getRule(parser.previous.type)->infix;
+        infixRule(canAssign);
+    }
+    
+    if (canAssign && match(TOKEN_EQUAL)) {
+        error("Invalid assignment target.");
+    }
+}
+
 static void parsePrecedence(Precedence precedence) {
     advance();
     ParseFn prefixRule = getRule(parser.previous.type)->prefix;
@@ -1108,16 +1349,7 @@ static void parsePrecedence(Precedence precedence) {
     
     bool canAssign = precedence <= PREC_ASSIGNMENT;
     prefixRule(canAssign);
-    
-    while (precedence <= getRule(parser.current.type)->precedence) {
-        advance();
-        ParseFn infixRule = getRule(parser.previous.type)->infix;
-        infixRule(canAssign);
-    }
-    
-    if (canAssign && match(TOKEN_EQUAL)) {
-        error("Invalid assignment target.");
-    }
+    parseInfix(precedence, canAssign);
 }
 
 static void expression(void) {
@@ -1141,11 +1373,16 @@ static void function(FunctionType type) {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
+            if (match(TOKEN_DOT_DOT_DOT)) {
+                // Extra arguments, reached through '...'; must come last
+                current->function->isVararg = true;
+                break;
+            }
             current->function->arity++;
             if (current->function->arity > 255) {
                 errorAtCurrent("Can't have more than 255 parameters.");
             }
-            uint8_t constant = parseVariable("Expect parameter name.");
+            int constant = parseVariable("Expect parameter name.");
             defineVariable(constant);
         } while (match(TOKEN_COMMA));
     }
@@ -1193,7 +1430,7 @@ static void classDeclaration(void) {
     declareVariable();
     
     emitBytes(OP_CLASS, nameConstant);
-    defineVariable(nameConstant);
+    defineVariable(current->scopeDepth > 0 ? 0 : globalSlotFor(&className));
     
     ClassCompiler classCompiler;
     classCompiler.enclosing = currentClass;
@@ -1256,7 +1493,7 @@ static void traitDeclaration(void) {
     declareVariable();
     
     emitBytes(OP_TRAIT, nameConstant);
-    defineVariable(nameConstant);
+    defineVariable(current->scopeDepth > 0 ? 0 : globalSlotFor(&traitName));
     
     // Use class compiler for self reference in trait methods
     ClassCompiler classCompiler;
@@ -1278,7 +1515,7 @@ static void traitDeclaration(void) {
 }
 
 static void funDeclaration(void) {
-    uint8_t global = parseVariable("Expect function name.");
+    int global = parseVariable("Expect function name.");
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global);
@@ -1306,37 +1543,58 @@ static void localStatement(void) {
         // local function name() ... end
         consume(TOKEN_IDENTIFIER, "Expect function name.");
         declareLocalVariable();
-        markInitialized();
+        /* markInitialized() is a no-op at script level, so mark directly */
+        current->locals[current->localCount - 1].depth = current->scopeDepth;
         function(TYPE_FUNCTION);
         /* Value is already on stack from function(), just mark initialized */
     } else {
-        // local var = expr
-        consume(TOKEN_IDENTIFIER, "Expect variable name.");
-        Token varName = parser.previous;
-        declareLocalVariable();
+        // local a, b = expr, expr
+        int nameCount = 0;
+        do {
+            consume(TOKEN_IDENTIFIER, "Expect variable name.");
+            declareLocalVariable();
+            nameCount++;
+        } while (match(TOKEN_COMMA));
         
         /* Track bytecode position for potential dead code elimination */
-        Local* local = &current->locals[current->localCount - 1];
-        local->initBytecodeStart = currentChunk()->count;
+        int initStart = currentChunk()->count;
         
+        int exprCount = 0;
         if (match(TOKEN_EQUAL)) {
-            expression();
-        } else {
-            emitByte(OP_NIL);
+            do {
+                expression();
+                exprCount++;
+            } while (match(TOKEN_COMMA));
         }
         
-        local->initBytecodeEnd = currentChunk()->count;
-        local->isAssigned = true;
+        if (exprCount > 0 && exprCount < nameCount && endsInMultiSite()) {
+            // local a, b = f() takes the missing values from the call
+            setMultiResults(nameCount - exprCount + 1);
+        } else {
+            for (; exprCount < nameCount; exprCount++) emitByte(OP_NIL);
+            for (; exprCount > nameCount; exprCount--) emitByte(OP_POP);
+        }
         
-        /* Mark as initialized - value is on stack */
-        local->depth = current->scopeDepth;
-        (void)varName;  // Used for error messages if needed
+        /* Mark as initialized - values are on stack */
+        for (int i = current->localCount - nameCount; i < current->localCount; i++) {
+            Local* local = &current->locals[i];
+            if (nameCount == 1) {
+                local->initBytecodeStart = initStart;
+                local->initBytecodeEnd = currentChunk()->count;
+            }
+            local->isAssigned = true;
+            local->depth = current->scopeDepth;
+        }
     }
 }
 
 static void expressionStatement(void) {
     expression();
-    emitByte(OP_POP);
+    if (endsInMultiSite()) {
+        setMultiResults(0);  // A call statement keeps none of its results
+    } else {
+        emitByte(OP_POP);
+    }
 }
 
 static void ifStatement(void) {
@@ -1389,6 +1647,7 @@ static void whileStatement(void) {
     loop.enclosing = current->currentLoop;
     loop.scopeDepth = current->scopeDepth;
     loop.breakCount = 0;
+    loop.continueCount = 0;
     
     int loopStart = currentChunk()->count;
     loop.start = loopStart;
@@ -1424,6 +1683,7 @@ static void repeatStatement(void) {
     loop.enclosing = current->currentLoop;
     loop.scopeDepth = current->scopeDepth;
     loop.breakCount = 0;
+    loop.continueCount = 0;
     
     int loopStart = currentChunk()->count;
     loop.start = loopStart;
@@ -1454,20 +1714,22 @@ static void repeatStatement(void) {
 
 /*
  * Numeric for loop: for i = start, end, step do ... end
- * Note: The loop variable has already been added as a local by forStatement
+ *
+ * Start, limit and step live in three hidden locals. OP_FOR_PREP checks
+ * their types once and either skips the loop or pushes the first value of
+ * 'i'; OP_FOR_LOOP at the bottom adds the step, tests the limit in the
+ * direction of the step and jumps back. 'i' is a fresh body local each
+ * iteration, so assigning to it does not affect the loop and closures
+ * capture the value of that iteration.
  */
-static void forNumericStatement(void) {
+static void forNumericStatement(Token name) {
     expression();  // Start value
-    markInitialized();  // Mark the loop variable as initialized
-    
-    // Add hidden locals for limit and step
-    addLocal((Token){.start = "", .length = 0});  // limit
+    addLocal((Token){.start = "", .length = 0});
     markInitialized();
     
     consume(TOKEN_COMMA, "Expect ',' after start value.");
     expression();  // End value (limit)
-    
-    addLocal((Token){.start = "", .length = 0});  // step
+    addLocal((Token){.start = "", .length = 0});
     markInitialized();
     
     // Optional step
@@ -1476,57 +1738,44 @@ static void forNumericStatement(void) {
     } else {
         emitConstant(NUMBER_VAL(1));  // Default step = 1
     }
+    addLocal((Token){.start = "", .length = 0});
+    markInitialized();
     
     consume(TOKEN_DO, "Expect 'do' after for clause.");
     
-    /*
-     * IMPORTANT: Save slot indices NOW, before block() which may add/remove locals.
-     * The for loop variables are at fixed positions:
-     * - varSlot: the loop counter (i)
-     * - limitSlot: the end value
-     * - stepSlot: the increment
-     */
-    int varSlot = current->localCount - 3;
-    int limitSlot = current->localCount - 2;
-    int stepSlot = current->localCount - 1;
+    uint8_t baseSlot = (uint8_t)(current->localCount - 3);
+    emitBytes(OP_FOR_PREP, baseSlot);
+    emitBytes(0xff, 0xff);  // Exit jump, patched below
+    int prepJump = currentChunk()->count - 2;
     
     Loop loop;
     loop.enclosing = current->currentLoop;
     loop.scopeDepth = current->scopeDepth;
     loop.breakCount = 0;
+    loop.continueCount = 0;
     
-    int loopStart = currentChunk()->count;
-    loop.start = loopStart;
-    
-    // Check: var <= limit (simplified, doesn't handle negative step)
-    emitBytes(OP_GET_LOCAL, (uint8_t)varSlot);
-    emitBytes(OP_GET_LOCAL, (uint8_t)limitSlot);
-    emitByte(OP_GREATER);
-    emitByte(OP_NOT);
-    
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
-    
+    int bodyStart = currentChunk()->count;
+    loop.start = bodyStart;
+    loop.continueTarget = -1;  // OP_FOR_LOOP is emitted after the body
     current->currentLoop = &loop;
     
     beginScope();
+    addLocal(name);  // Pushed by OP_FOR_PREP / OP_FOR_LOOP
+    markInitialized();
     block();
     endScope();
     
-    // Continue target is the increment section
-    loop.continueTarget = currentChunk()->count;
-    
-    // Increment: var = var + step
-    emitBytes(OP_GET_LOCAL, (uint8_t)varSlot);
-    emitBytes(OP_GET_LOCAL, (uint8_t)stepSlot);
-    emitByte(OP_ADD);
-    emitBytes(OP_SET_LOCAL, (uint8_t)varSlot);
-    emitByte(OP_POP);
+    for (int i = 0; i < loop.continueCount; i++) {
+        patchJump(loop.continueJumps[i]);
+    }
     
-    emitLoop(loopStart);
+    emitBytes(OP_FOR_LOOP, baseSlot);
+    int offset = currentChunk()->count - bodyStart + 2;
+    if (offset > UINT16_MAX) error("Loop body too large.");
+    emitByte((offset >> 8) & 0xff);
+    emitByte(offset & 0xff);
     
-    patchJump(exitJump);
-    emitByte(OP_POP);
+    patchJump(prepJump);
     
     // Patch all break jumps
     for (int i = 0; i < loop.breakCount; i++) {
@@ -1541,119 +1790,70 @@ static void forNumericStatement(void) {
  * Generic for loop: for k, v in pairs(t) do ... end
  * or: for i, v in ipairs(t) do ... end
  * 
- * Compiles to:
- *   local _iter = pairs(t)  -- iterator state (the table)
- *   local _idx = 0          -- current index (for ipairs) or nil (for pairs)
- *   while true do
- *     local _result = next(_iter, _idx)
- *     if _result == nil then break end
- *     local k = _result[1]
- *     local v = _result[2]
- *     _idx = k
- *     ... body ...
- *   end
+ * pairs() and ipairs() hand back the table itself. It sits in a hidden
+ * local next to an internal position; OP_FOR_PAIRS walks the array part
+ * and then the hash entries by that position, pushing the key and value
+ * straight into the body's loop variables, so no step allocates. A loop
+ * over the global ipairs(...) compiles to OP_FOR_IPAIRS instead, which
+ * stops at the first nil of the array part.
  */
 static void forInStatement(Token firstName) {
-    // First variable already parsed, declare it
-    addLocal(firstName);
-    markInitialized();
-    emitByte(OP_NIL);  // Placeholder, will be set in loop
-    int keySlot = current->localCount - 1;
-    
-    // Check for second variable (value)
-    int valueSlot = -1;
+    Token valueName = (Token){.start = "", .length = 0};
     if (match(TOKEN_COMMA)) {
         consume(TOKEN_IDENTIFIER, "Expect variable name after ','.");
-        addLocal(parser.previous);
-        markInitialized();
-        emitByte(OP_NIL);  // Placeholder
-        valueSlot = current->localCount - 1;
+        valueName = parser.previous;
     }
     
     consume(TOKEN_IN, "Expect 'in' after for variables.");
     
-    // Parse the iterator expression (e.g., pairs(t) or ipairs(t))
-    // This should return a table to iterate over
-    expression();
+    // Only the global builtin: a local or upvalue named ipairs is any function
+    Token ipairsName = (Token){.start = "ipairs", .length = 6};
+    bool arrayOnly = check(TOKEN_IDENTIFIER) &&
+                     identifiersEqual(&parser.current, &ipairsName) &&
+                     resolveLocal(current, &ipairsName) == -1 &&
+                     resolveUpvalue(current, &ipairsName) == -1;
     
-    // Store iterator state in hidden local
-    addLocal((Token){.start = "_iter", .length = 5});
+    // The table to iterate over
+    expression();
+    addLocal((Token){.start = "", .length = 0});
     markInitialized();
-    int iterSlot = current->localCount - 1;
     
-    // Index tracker (starts at 0 for array iteration)
-    addLocal((Token){.start = "_idx", .length = 4});
-    markInitialized();
+    // Internal position: array index, then hash slot past the array
     emitConstant(NUMBER_VAL(0));
-    int idxSlot = current->localCount - 1;
+    addLocal((Token){.start = "", .length = 0});
+    markInitialized();
     
     consume(TOKEN_DO, "Expect 'do' after for clause.");
     
+    uint8_t baseSlot = (uint8_t)(current->localCount - 2);
+    
     Loop loop;
     loop.enclosing = current->currentLoop;
     loop.scopeDepth = current->scopeDepth;
     loop.breakCount = 0;
+    loop.continueCount = 0;
     
     int loopStart = currentChunk()->count;
     loop.start = loopStart;
     loop.continueTarget = loopStart;
     current->currentLoop = &loop;
     
-    /*
-     * Loop body:
-     * 1. Get iterator table
-     * 2. Get current index
-     * 3. Check if index < #table (for array iteration)
-     * 4. If not, exit loop
-     * 5. Increment index
-     * 6. Get key and value
-     * 7. Execute body
-     * 8. Loop back
-     */
-    
-    // Get table length
-    emitBytes(OP_GET_LOCAL, (uint8_t)iterSlot);
-    emitByte(OP_LENGTH);
-    
-    // Get current index
-    emitBytes(OP_GET_LOCAL, (uint8_t)idxSlot);
+    emitBytes(arrayOnly ? OP_FOR_IPAIRS : OP_FOR_PAIRS, baseSlot);
+    emitBytes(0xff, 0xff);  // Exit jump, patched below
+    int exitJump = currentChunk()->count - 2;
     
-    // Check: idx < length
-    emitByte(OP_LESS);
-    
-    int exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP);
-    
-    // Increment index: idx = idx + 1
-    emitBytes(OP_GET_LOCAL, (uint8_t)idxSlot);
-    emitConstant(NUMBER_VAL(1));
-    emitByte(OP_ADD);
-    emitBytes(OP_SET_LOCAL, (uint8_t)idxSlot);
-    emitByte(OP_POP);
-    
-    // Set key = current index (1-based for Lua)
-    emitBytes(OP_GET_LOCAL, (uint8_t)idxSlot);
-    emitBytes(OP_SET_LOCAL, (uint8_t)keySlot);
-    emitByte(OP_POP);
-    
-    // Set value = table[idx]
-    if (valueSlot >= 0) {
-        emitBytes(OP_GET_LOCAL, (uint8_t)iterSlot);
-        emitBytes(OP_GET_LOCAL, (uint8_t)idxSlot);
-        emitByte(OP_TABLE_GET);
-        emitBytes(OP_SET_LOCAL, (uint8_t)valueSlot);
-        emitByte(OP_POP);
-    }
-    
-    // Execute loop body
+    // Key and value are pushed by the iteration opcode
     beginScope();
+    addLocal(firstName);
+    markInitialized();
+    addLocal(valueName);
+    markInitialized();
     block();
     endScope();
     
     emitLoop(loopStart);
     
     patchJump(exitJump);
-    emitByte(OP_POP);
     
     // Patch all break jumps
     for (int i = 0; i < loop.breakCount; i++) {
@@ -1674,9 +1874,7 @@ static void forStatement(void) {
     // Check if this is numeric for (=) or generic for (in or ,)
     if (match(TOKEN_EQUAL)) {
         // Numeric for: for i = start, end, step do
-        // Declare the loop variable with the saved name
-        addLocal(firstName);
-        forNumericStatement();
+        forNumericStatement(firstName);
     } else {
         // Generic for: for k, v in expr do
         // or: for k in expr do
@@ -1700,8 +1898,30 @@ static void returnStatement(void) {
         if (current->type == TYPE_INITIALIZER) {
             error("Can't return a value from an initializer.");
         }
-        expression();
-        emitByte(OP_RETURN);
+        int count = 0;
+        do {
+            expression();
+            if (count == 255) error("Can't return more than 255 values.");
+            count++;
+        } while (match(TOKEN_COMMA));
+        
+        if (count == 1 && endsInMultiSite() &&
+            current->callSite == current->multiSite) {
+            // return f(...) reuses this frame for f when f is a closure;
+            // any other callee is called normally and OP_RETURN_MULTI
+            // passes its values on
+            currentChunk()->code[current->callSite - 2] = OP_TAIL_CALL;
+            setMultiResults(MULTI_RESULTS);
+            emitBytes(OP_RETURN_MULTI, 0);
+        } else if (endsInMultiSite()) {
+            // return ..., f() passes on every value f returns
+            setMultiResults(MULTI_RESULTS);
+            emitBytes(OP_RETURN_MULTI, (uint8_t)(count - 1));
+        } else if (count == 1) {
+            emitByte(OP_RETURN);
+        } else {
+            emitBytes(OP_RETURN_N, (uint8_t)count);
+        }
     }
 }
 
@@ -1745,7 +1965,14 @@ static void continueStatement(void) {
     }
     
     // Jump to the continue target (loop increment/condition)
-    emitLoop(current->currentLoop->continueTarget);
+    Loop* loop = current->currentLoop;
+    if (loop->continueTarget >= 0) {
+        emitLoop(loop->continueTarget);
+    } else if (loop->continueCount < 256) {
+        loop->continueJumps[loop->continueCount++] = emitJump(OP_JUMP);
+    } else {
+        error("Too many continue statements in loop.");
+    }
 }
 
 static void synchronize(void) {
@@ -5,6 +5,7 @@
 #include "debug.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 #include <stdio.h>
 
 void disassembleChunk(Chunk* chunk, const char* name) {
@@ -33,6 +34,14 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset)
     return offset + 3;
 }
 
+static int forInstruction(const char* name, int sign, Chunk* chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+    printf("%-16s %4d %4d -> %d\n", name, slot, offset, offset + 4 + sign * jump);
+    return offset + 4;
+}
+
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
@@ -41,15 +50,62 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 2;
 }
 
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+    slot |= chunk->code[offset + 2];
+    printf("%-16s %4d '%s'\n", name, slot,
+           slot < vm.globalCount ? vm.globals[slot].name->chars : "?");
+    return offset + 3;
+}
+
+static void printResults(uint8_t results) {
+    if (results == MULTI_RESULTS) {
+        printf(" -> all");
+    } else {
+        printf(" -> %d", results);
+    }
+}
+
 static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
     uint8_t argCount = chunk->code[offset + 2];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
-    printf("'\n");
+    printf("'");
+    printResults(chunk->code[offset + 3]);
+    printf("\n");
+    return offset + 4;
+}
+
+static int callInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t argCount = chunk->code[offset + 1];
+    printf("%-16s %4d", name, argCount);
+    printResults(chunk->code[offset + 2]);
+    printf("\n");
     return offset + 3;
 }
 
+static int varargInstruction(Chunk* chunk, int offset) {
+    printf("%-16s", "OP_VARARG");
+    printResults(chunk->code[offset + 1]);
+    printf("\n");
+    return offset + 2;
+}
+
+static int tableInstruction(Chunk* chunk, int offset) {
+    int arraySize = chunk->code[offset + 1] << 8 | chunk->code[offset + 2];
+    int hashSize = chunk->code[offset + 3] << 8 | chunk->code[offset + 4];
+    printf("%-16s array %d, hash %d\n", "OP_TABLE", arraySize, hashSize);
+    return offset + 5;
+}
+
+static int setListInstruction(const char* name, Chunk* chunk, int offset) {
+    uint8_t count = chunk->code[offset + 1];
+    int start = chunk->code[offset + 2] << 8 | chunk->code[offset + 3];
+    printf("%-16s %4d at %d\n", name, count, start);
+    return offset + 4;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
     
@@ -69,9 +125,9 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_POPN:          return byteInstruction("OP_POPN", chunk, offset);
         case OP_GET_LOCAL:     return byteInstruction("OP_GET_LOCAL", chunk, offset);
         case OP_SET_LOCAL:     return byteInstruction("OP_SET_LOCAL", chunk, offset);
-        case OP_GET_GLOBAL:    return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-        case OP_DEFINE_GLOBAL: return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-        case OP_SET_GLOBAL:    return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+        case OP_GET_GLOBAL:    return globalInstruction("OP_GET_GLOBAL", chunk, offset);
+        case OP_DEFINE_GLOBAL: return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+        case OP_SET_GLOBAL:    return globalInstruction("OP_SET_GLOBAL", chunk, offset);
         case OP_GET_UPVALUE:   return byteInstruction("OP_GET_UPVALUE", chunk, offset);
         case OP_SET_UPVALUE:   return byteInstruction("OP_SET_UPVALUE", chunk, offset);
         case OP_CLOSE_UPVALUE: return simpleInstruction("OP_CLOSE_UPVALUE", offset);
@@ -87,13 +143,20 @@ int disassembleInstruction(Chunk* chunk, int offset) {
         case OP_DIVIDE:        return simpleInstruction("OP_DIVIDE", offset);
         case OP_MODULO:        return simpleInstruction("OP_MODULO", offset);
         case OP_CONCAT:        return simpleInstruction("OP_CONCAT", offset);
+        case OP_CONCAT_N:      return byteInstruction("OP_CONCAT_N", chunk, offset);
         case OP_LENGTH:        return simpleInstruction("OP_LENGTH", offset);
         case OP_NOT:           return simpleInstruction("OP_NOT", offset);
         case OP_NEGATE:        return simpleInstruction("OP_NEGATE", offset);
         case OP_JUMP:          return jumpInstruction("OP_JUMP", 1, chunk, offset);
         case OP_JUMP_IF_FALSE: return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_LOOP:          return jumpInstruction("OP_LOOP", -1, chunk, offset);
-        case OP_CALL:          return byteInstruction("OP_CALL", chunk, offset);
+        case OP_FOR_PREP:      return forInstruction("OP_FOR_PREP", 1, chunk, offset);
+        case OP_FOR_LOOP:      return forInstruction("OP_FOR_LOOP", -1, chunk, offset);
+        case OP_FOR_PAIRS:     return forInstruction("OP_FOR_PAIRS", 1, chunk, offset);
+        case OP_FOR_IPAIRS:    return forInstruction("OP_FOR_IPAIRS", 1, chunk, offset);
+        case OP_CALL:          return callInstruction("OP_CALL", chunk, offset);
+        case OP_CALL_MULTI:    return callInstruction("OP_CALL_MULTI", chunk, offset);
+        case OP_TAIL_CALL:     return callInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_INVOKE:        return invokeInstruction("OP_INVOKE", chunk, offset);
         case OP_SUPER_INVOKE:  return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
         case OP_CLOSURE: {
@@ -113,6 +176,9 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return offset;
         }
         case OP_RETURN:        return simpleInstruction("OP_RETURN", offset);
+        case OP_RETURN_N:      return byteInstruction("OP_RETURN_N", chunk, offset);
+        case OP_RETURN_MULTI:  return byteInstruction("OP_RETURN_MULTI", chunk, offset);
+        case OP_VARARG:        return varargInstruction(chunk, offset);
         case OP_CLASS:         return constantInstruction("OP_CLASS", chunk, offset);
         case OP_INHERIT:       return simpleInstruction("OP_INHERIT", offset);
         case OP_METHOD: {
@@ -124,11 +190,14 @@ int disassembleInstruction(Chunk* chunk, int offset) {
             return offset + 3;
         }
         case OP_NEW:           return byteInstruction("OP_NEW", chunk, offset);
-        case OP_TABLE:         return simpleInstruction("OP_TABLE", offset);
+        case OP_TABLE:         return tableInstruction(chunk, offset);
         case OP_TABLE_GET:     return simpleInstruction("OP_TABLE_GET", offset);
         case OP_TABLE_SET:     return simpleInstruction("OP_TABLE_SET", offset);
-        case OP_TABLE_ADD:     return simpleInstruction("OP_TABLE_ADD", offset);
+        case OP_TABLE_SET_LIST: return setListInstruction("OP_TABLE_SET_LIST", chunk, offset);
+        case OP_TABLE_SET_LIST_MULTI:
+            return setListInstruction("OP_TABLE_SET_LIST_MULTI", chunk, offset);
         case OP_TABLE_SET_FIELD: return constantInstruction("OP_TABLE_SET_FIELD", chunk, offset);
+        case OP_TABLE_SET_KEY: return simpleInstruction("OP_TABLE_SET_KEY", offset);
         case OP_TRAIT:         return constantInstruction("OP_TRAIT", chunk, offset);
         case OP_IMPLEMENT:     return simpleInstruction("OP_IMPLEMENT", offset);
         default:
@@ -0,0 +1,103 @@
+/*
+ * hash.c - String hashing (see hash.h)
+ */
+
+#include "hash.h"
+#include <time.h>
+
+/* ========== Seeding ========== */
+
+/* splitmix64: spreads weak entropy over all 64 bits */
+static uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+void initHashSeed(HashSeed* seed) {
+#ifdef LUAPP_HASH_SEED
+    seed->k0 = mix64((uint64_t)LUAPP_HASH_SEED);
+    seed->k1 = mix64(seed->k0);
+#else
+    uint64_t entropy[2] = {0, 0};
+    
+    // The OS generator where there is one; otherwise (or as well) mix in
+    // the clock and a few addresses, which ASLR varies per process
+    FILE* random = fopen("/dev/urandom", "rb");
+    if (random != NULL) {
+        if (fread(entropy, sizeof(entropy), 1, random) != 1) {
+            entropy[0] = entropy[1] = 0;
+        }
+        fclose(random);
+    }
+    entropy[0] ^= (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32);
+    entropy[1] ^= (uint64_t)(uintptr_t)seed ^ (uint64_t)(uintptr_t)&mix64;
+    
+    seed->k0 = mix64(entropy[0]);
+    seed->k1 = mix64(entropy[1] ^ seed->k0);
+#endif
+}
+
+/* ========== SipHash-1-3 ========== */
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIP_ROUND(v0, v1, v2, v3) \
+    do { \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+    } while (false)
+
+/*
+ * One compression round per 8-byte word and three finalization rounds
+ * (the variant Python and Rust use for their hash tables). Words are
+ * loaded in host byte order, so hashes differ across endianness; they
+ * are never stored, so that is harmless.
+ */
+uint32_t hashSipHash13(const HashSeed* seed, const char* key, int length) {
+    uint64_t v0 = 0x736f6d6570736575ULL ^ seed->k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ seed->k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ seed->k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ seed->k1;
+    
+    const uint8_t* in = (const uint8_t*)key;
+    const uint8_t* end = in + (length & ~7);
+    for (; in != end; in += 8) {
+        uint64_t word;
+        memcpy(&word, in, 8);
+        v3 ^= word;
+        SIP_ROUND(v0, v1, v2, v3);
+        v0 ^= word;
+    }
+    
+    // Last 0-7 bytes, with the length in the top byte
+    uint64_t last = (uint64_t)length << 56;
+    for (int i = 0; i < (length & 7); i++) {
+        last |= (uint64_t)in[i] << (8 * i);
+    }
+    v3 ^= last;
+    SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= last;
+    
+    v2 ^= 0xff;
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    SIP_ROUND(v0, v1, v2, v3);
+    
+    uint64_t hash = v0 ^ v1 ^ v2 ^ v3;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+/* ========== FNV-1a ========== */
+
+uint32_t hashFnv1a(const char* key, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)key[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
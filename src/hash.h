@@ -0,0 +1,36 @@
+/*
+ * hash.h - String hashing
+ *
+ * Every string hash is keyed by a per-VM random seed, so keys crafted
+ * offline cannot be made to collide in vm.strings or a Table. The
+ * algorithm is picked at build time:
+ *
+ *   (default)            SipHash-1-3, eight bytes per round
+ *   -DLUAPP_HASH_FNV1A   byte-at-a-time FNV-1a (unkeyed, the old hash)
+ *
+ * Build with -DLUAPP_HASH_SEED=<n> for a fixed seed (reproducible table
+ * iteration order).
+ */
+
+#ifndef luapp_hash_h
+#define luapp_hash_h
+
+#include "common.h"
+
+typedef struct {
+    uint64_t k0;
+    uint64_t k1;
+} HashSeed;
+
+void initHashSeed(HashSeed* seed);
+
+uint32_t hashSipHash13(const HashSeed* seed, const char* key, int length);
+uint32_t hashFnv1a(const char* key, int length);
+
+#ifdef LUAPP_HASH_FNV1A
+#define hashBytes(seed, key, length) ((void)(seed), hashFnv1a(key, length))
+#else
+#define hashBytes(seed, key, length) hashSipHash13(seed, key, length)
+#endif
+
+#endif
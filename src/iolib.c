@@ -0,0 +1,130 @@
+/*
+ * iolib.c - Buffered output and the 'io' library (see iolib.h)
+ *
+ * Output bypasses stdio: a flush is one write(2) of the whole buffer.
+ * Anything still in stdio's stdout buffer (the REPL prompt, --trace
+ * output) is flushed first so the two never come out of order.
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include "iolib.h"
+#include "number.h"
+#include "vm.h"
+#include <errno.h>
+#include <unistd.h>
+
+/* ========== Output Buffer ========== */
+
+void initOutput(OutputBuffer* output, int fd) {
+    output->fd = fd;
+    output->lineBuffered = isatty(fd) != 0;
+    output->length = 0;
+    output->data = NULL;
+}
+
+void freeOutput(OutputBuffer* output) {
+    flushOutput(output);
+    free(output->data);
+    output->data = NULL;
+}
+
+static bool writeAll(int fd, const char* chars, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, chars, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        chars += written;
+        length -= (size_t)written;
+    }
+    return true;
+}
+
+bool flushOutput(OutputBuffer* output) {
+    fflush(stdout);
+    if (output->length == 0) return true;
+    bool ok = writeAll(output->fd, output->data, output->length);
+    output->length = 0;
+    return ok;
+}
+
+void writeOutput(OutputBuffer* output, const char* chars, size_t length) {
+    if (length > OUTPUT_BUFFER_SIZE - output->length) {
+        flushOutput(output);
+        if (length >= OUTPUT_BUFFER_SIZE) {
+            // Too big to be worth copying: straight out
+            writeAll(output->fd, chars, length);
+            return;
+        }
+    }
+    if (output->data == NULL) {
+        output->data = (char*)malloc(OUTPUT_BUFFER_SIZE);
+        if (output->data == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(1);
+        }
+    }
+    memcpy(output->data + output->length, chars, length);
+    output->length += length;
+
+    // --trace interleaves its own printf output with the script's
+    if ((output->lineBuffered || debugFlags.traceExecution) &&
+        memchr(chars, '\n', length) != NULL) {
+        flushOutput(output);
+    }
+}
+
+void writeValueOutput(OutputBuffer* output, Value value) {
+    if (IS_STRING(value)) {
+        StringView string = stringView(value);
+        writeOutput(output, string.chars, (size_t)string.length);
+    } else if (IS_NUMBER(value)) {
+        char number[NUMBER_BUFFER_SIZE];
+        writeOutput(output, number, (size_t)formatNumber(AS_NUMBER(value), number));
+    } else if (IS_BOOL(value)) {
+        if (AS_BOOL(value)) {
+            writeOutput(output, "true", 4);
+        } else {
+            writeOutput(output, "false", 5);
+        }
+    } else if (IS_NIL(value)) {
+        writeOutput(output, "nil", 3);
+    } else {
+        // Functions, tables, instances: rare enough to go through stdio
+        flushOutput(output);
+        printValue(value);
+        fflush(stdout);
+    }
+}
+
+/* ========== Natives ========== */
+
+/* io.write(...) - strings and numbers, with no separators or newline */
+static Value writeNative(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_STRING(args[i]) && !IS_NUMBER(args[i])) {
+            runtimeError("Bad argument #%d to 'io.write' (string or number expected).", i + 1);
+            return NIL_VAL;
+        }
+        writeValueOutput(&vm.output, args[i]);
+    }
+    return NIL_VAL;
+}
+
+/* io.flush() - true, or nil if the output could not be written */
+static Value flushNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    return flushOutput(&vm.output) ? BOOL_VAL(true) : NIL_VAL;
+}
+
+static const LibFunction ioFunctions[] = {
+    {"write", writeNative},
+    {"flush", flushNative},
+    {NULL, NULL}
+};
+
+ObjTable* openIoLib(void) {
+    return openLib("io", ioFunctions);
+}
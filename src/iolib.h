@@ -0,0 +1,43 @@
+/*
+ * iolib.h - Buffered output and the 'io' library
+ *
+ * print and io.write append to a buffer owned by the VM, which goes to
+ * standard output in large blocks: when it fills, on io.flush(), before
+ * reading input or reporting an error, and when the script (or a host
+ * call into it) returns. If stdout is a terminal the buffer is also
+ * flushed at every newline, so interactive output still appears line by
+ * line.
+ */
+
+#ifndef luapp_iolib_h
+#define luapp_iolib_h
+
+#include "object.h"
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+typedef struct {
+    int fd;                 // Where flushes write to
+    bool lineBuffered;      // Flush after any write containing '\n'
+    size_t length;
+    char* data;             // OUTPUT_BUFFER_SIZE bytes, allocated on first write
+} OutputBuffer;
+
+/* Line buffered exactly when fd is a terminal */
+void initOutput(OutputBuffer* output, int fd);
+
+/* Flush, then release the buffer */
+void freeOutput(OutputBuffer* output);
+
+void writeOutput(OutputBuffer* output, const char* chars, size_t length);
+
+/* value as print shows it */
+void writeValueOutput(OutputBuffer* output, Value value);
+
+/* Write out everything buffered; false if the write failed (data is dropped) */
+bool flushOutput(OutputBuffer* output);
+
+/* Build the library, define the 'io' global and register the module */
+ObjTable* openIoLib(void);
+
+#endif
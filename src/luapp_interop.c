@@ -20,6 +20,7 @@
 #include "vm.h"
 #include "compiler.h"
 #include "memory.h"
+#include "objtable.h"
 #include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -90,22 +91,14 @@ void luappToLua(lua_State* L, Value val) {
 static void tableToLua(lua_State* L, ObjTable* table) {
     lua_newtable(L);
     
-    /* Array part (1-indexed) */
-    for (int i = 0; i < table->array.count; i++) {
-        lua_pushinteger(L, i + 1);
-        luappToLua(L, table->array.values[i]);
+    /* Array part in order, then the hash part */
+    int cursor = 0;
+    Value key, value;
+    while (objTableNext(table, &cursor, &key, &value)) {
+        luappToLua(L, key);
+        luappToLua(L, value);
         lua_settable(L, -3);
     }
-    
-    /* Hash part */
-    for (int i = 0; i < table->entries.capacity; i++) {
-        Entry* entry = &table->entries.entries[i];
-        if (entry->key != NULL) {
-            lua_pushlstring(L, entry->key->chars, entry->key->length);
-            luappToLua(L, entry->value);
-            lua_settable(L, -3);
-        }
-    }
 }
 
 /*
@@ -162,12 +155,13 @@ static void instanceToLua(lua_State* L, ObjInstance* instance) {
     lua_pushlightuserdata(L, instance);
     lua_settable(L, -3);
     
-    /* Copy fields */
-    for (int i = 0; i < instance->fields.capacity; i++) {
-        Entry* entry = &instance->fields.entries[i];
+    /* Copy fields (the shape maps each name to its slot) */
+    Table* slots = &instance->shape->slots;
+    for (int i = 0; i < slots->capacity; i++) {
+        Entry* entry = &slots->entries[i];
         if (entry->key != NULL) {
             lua_pushlstring(L, entry->key->chars, entry->key->length);
-            luappToLua(L, entry->value);
+            luappToLua(L, instance->fields[(int)AS_NUMBER(entry->value)]);
             lua_settable(L, -3);
         }
     }
@@ -408,28 +402,12 @@ static Value tableFromLua(lua_State* L, int idx) {
     
     lua_pushnil(L);  /* First key */
     while (lua_next(L, idx) != 0) {
-        /* Key at -2, value at -1 */
-        
-        if (lua_isinteger(L, -2)) {
-            /* Integer key → array part */
-            int key = (int)lua_tointeger(L, -2);
-            if (key >= 1) {
-                Value val = luaToLuapp(L, -1);
-                /* Grow array if needed */
-                while (table->array.count < key) {
-                    writeValueArray(&table->array, NIL_VAL);
-                }
-                table->array.values[key - 1] = val;
-            }
-        }
-        else if (lua_isstring(L, -2)) {
-            /* String key → hash part */
-            size_t len;
-            const char* key = lua_tolstring(L, -2, &len);
-            ObjString* keyStr = copyString(key, (int)len);
-            Value val = luaToLuapp(L, -1);
-            tableSet(&table->entries, keyStr, val);
-        }
+        /* Key at -2, value at -1; any key Lua allows, Lua++ does too */
+        push(luaToLuapp(L, -2));  /* GC protection while the value converts */
+        push(luaToLuapp(L, -1));
+        objTableSet(table, vm.stackTop[-2], vm.stackTop[-1]);
+        pop();
+        pop();
         
         lua_pop(L, 1);  /* Pop value, keep key for next iteration */
     }
@@ -514,11 +492,11 @@ static int l_load(lua_State* L) {
     lua_newtable(L);
     
     /* Iterate through Lua++ globals and convert to Lua */
-    for (int i = 0; i < vm.globals.capacity; i++) {
-        Entry* entry = &vm.globals.entries[i];
-        if (entry->key != NULL) {
+    for (int i = 0; i < vm.globalCount; i++) {
+        Global* global = &vm.globals[i];
+        if (global->defined) {
             /* Skip built-in functions */
-            const char* name = entry->key->chars;
+            const char* name = global->name->chars;
             if (strcmp(name, "print") == 0 ||
                 strcmp(name, "read") == 0 ||
                 strcmp(name, "type") == 0 ||
@@ -527,8 +505,8 @@ static int l_load(lua_State* L) {
                 continue;
             }
             
-            lua_pushlstring(L, entry->key->chars, entry->key->length);
-            luappToLua(L, entry->value);
+            lua_pushlstring(L, global->name->chars, global->name->length);
+            luappToLua(L, global->value);
             lua_settable(L, -3);
         }
     }
@@ -616,6 +594,9 @@ int luappNewInstance(lua_State* L) {
          * Stack layout: [instance] [arg1] [arg2] ...
          * The instance goes in slot 0 as 'self'.
          */
+        if (!reserveStack(argCount + 1)) {
+            return luaL_error(L, "Stack overflow");
+        }
         push(OBJ_VAL(instance));  /* This will be 'self' (slot 0) */
         
         /* Push arguments */
@@ -624,12 +605,12 @@ int luappNewInstance(lua_State* L) {
         }
         // no idea what's going on here, absolute gibberish. By the way its me, the user. dont edit this!
         /* Set up call frame */
-        if (vm.frameCount >= FRAMES_MAX) {
+        if (vm.frameCount >= FRAMES_MAX || !reserveStack(FRAME_SLOTS)) {
             vm.stackTop -= (argCount + 1);
             return luaL_error(L, "Stack overflow");
         }
         
-        CallFrame* frame = &vm.frames[vm.frameCount++];
+        CallFrame* frame = pushFrame();
         frame->closure = initClosure;
         frame->ip = initClosure->function->chunk.code;
         frame->slots = vm.stackTop - argCount - 1;  /* Points to instance */
@@ -683,7 +664,7 @@ int luappNewInstance(lua_State* L) {
                     ObjInstance* inst = AS_INSTANCE(receiver);
                     uint8_t nameIdx = *frame->ip++;
                     ObjString* name = AS_STRING(frame->closure->function->chunk.constants.values[nameIdx]);
-                    tableSet(&inst->fields, name, vm.stackTop[-1]);  /* peek(0) */
+                    instanceSetField(inst, name, vm.stackTop[-1]);  /* peek(0) */
                     Value value = pop();
                     pop();
                     push(value);
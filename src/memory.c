@@ -10,10 +10,13 @@ static void markRoots(void);
 static void traceReferences(void);
 static void sweep(void);
 
+// Tables compacted during a collection allocate: that must not start another
+static bool collecting = false;
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     vm.bytesAllocated += newSize - oldSize;
     
-    if (newSize > oldSize) {
+    if (newSize > oldSize && !collecting) {
 #if DEBUG_STRESS_GC
         collectGarbage();
 #endif
@@ -42,9 +45,13 @@ void collectGarbage(void) {
         printf("-- gc begin (allocated: %zu bytes)\n", before);
     }
 
+    collecting = true;
     markRoots();
     traceReferences();
+    tableRemoveWhite(&vm.strings);  // Interned strings are weak references
+    removeWhitePatterns(&vm.patternCache);
     sweep();
+    collecting = false;
     
     vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
 
@@ -71,7 +78,13 @@ static void markRoots(void) {
     }
     
     // Mark globals
-    markTable(&vm.globals);
+    for (int i = 0; i < vm.globalCount; i++) {
+        markObject((Obj*)vm.globals[i].name);
+        markValue(vm.globals[i].value);
+    }
+    markTable(&vm.globalSlots);
+    markTable(&vm.loadedModules);
+    markObject((Obj*)vm.stringLib);
     
     // Mark compiler roots (if compiling)
     markCompilerRoots();
@@ -0,0 +1,517 @@
+/*
+ * number.c - Number formatting and parsing (see number.h)
+ *
+ * Formatting is Grisu3 (Loitsch, "Printing Floating-Point Numbers Quickly
+ * and Accurately with Integers"): the double and the bounds of its
+ * rounding interval are scaled by a cached power of ten into 64-bit
+ * fixed point and digits are generated until they fall inside the
+ * interval. For the ~0.5% of doubles where 64 bits cannot prove the
+ * digits shortest, it falls back to trying increasing %.*e precisions.
+ *
+ * Parsing takes Clinger's fast path - a mantissa of at most 2^53 times a
+ * power of ten up to 10^22 is one correctly rounded multiply or divide -
+ * and leaves the rest (more than 19 digits, huge exponents, hex) to
+ * strtod.
+ */
+
+#include "number.h"
+#include <float.h>
+#include <math.h>
+
+/* ========== Formatting ========== */
+
+#define DIGIT_BUFFER_SIZE 20
+#define MIN_TARGET_EXPONENT (-60)   // Scaled values keep 4..32 integer bits
+#define CACHED_POWERS_OFFSET 348    // -(smallest exponent in cachedPowers)
+#define CACHED_POWERS_STEP 8        // Decimal exponent between entries
+
+/* A 64-bit significand and a binary exponent: f * 2^e */
+typedef struct {
+    uint64_t f;
+    int e;
+} DiyFp;
+
+typedef struct {
+    uint64_t f;
+    int16_t e;
+    int16_t decimalExponent;
+} CachedPower;
+
+/* 10^k for k = -348, -340 ... 340, rounded to 64 bits */
+static const CachedPower cachedPowers[] = {
+    {0xfa8fd5a0081c0288ULL, -1220, -348},
+    {0xbaaee17fa23ebf76ULL, -1193, -340},
+    {0x8b16fb203055ac76ULL, -1166, -332},
+    {0xcf42894a5dce35eaULL, -1140, -324},
+    {0x9a6bb0aa55653b2dULL, -1113, -316},
+    {0xe61acf033d1a45dfULL, -1087, -308},
+    {0xab70fe17c79ac6caULL, -1060, -300},
+    {0xff77b1fcbebcdc4fULL, -1034, -292},
+    {0xbe5691ef416bd60cULL, -1007, -284},
+    {0x8dd01fad907ffc3cULL, -980, -276},
+    {0xd3515c2831559a83ULL, -954, -268},
+    {0x9d71ac8fada6c9b5ULL, -927, -260},
+    {0xea9c227723ee8bcbULL, -901, -252},
+    {0xaecc49914078536dULL, -874, -244},
+    {0x823c12795db6ce57ULL, -847, -236},
+    {0xc21094364dfb5637ULL, -821, -228},
+    {0x9096ea6f3848984fULL, -794, -220},
+    {0xd77485cb25823ac7ULL, -768, -212},
+    {0xa086cfcd97bf97f4ULL, -741, -204},
+    {0xef340a98172aace5ULL, -715, -196},
+    {0xb23867fb2a35b28eULL, -688, -188},
+    {0x84c8d4dfd2c63f3bULL, -661, -180},
+    {0xc5dd44271ad3cdbaULL, -635, -172},
+    {0x936b9fcebb25c996ULL, -608, -164},
+    {0xdbac6c247d62a584ULL, -582, -156},
+    {0xa3ab66580d5fdaf6ULL, -555, -148},
+    {0xf3e2f893dec3f126ULL, -529, -140},
+    {0xb5b5ada8aaff80b8ULL, -502, -132},
+    {0x87625f056c7c4a8bULL, -475, -124},
+    {0xc9bcff6034c13053ULL, -449, -116},
+    {0x964e858c91ba2655ULL, -422, -108},
+    {0xdff9772470297ebdULL, -396, -100},
+    {0xa6dfbd9fb8e5b88fULL, -369, -92},
+    {0xf8a95fcf88747d94ULL, -343, -84},
+    {0xb94470938fa89bcfULL, -316, -76},
+    {0x8a08f0f8bf0f156bULL, -289, -68},
+    {0xcdb02555653131b6ULL, -263, -60},
+    {0x993fe2c6d07b7facULL, -236, -52},
+    {0xe45c10c42a2b3b06ULL, -210, -44},
+    {0xaa242499697392d3ULL, -183, -36},
+    {0xfd87b5f28300ca0eULL, -157, -28},
+    {0xbce5086492111aebULL, -130, -20},
+    {0x8cbccc096f5088ccULL, -103, -12},
+    {0xd1b71758e219652cULL, -77, -4},
+    {0x9c40000000000000ULL, -50, 4},
+    {0xe8d4a51000000000ULL, -24, 12},
+    {0xad78ebc5ac620000ULL, 3, 20},
+    {0x813f3978f8940984ULL, 30, 28},
+    {0xc097ce7bc90715b3ULL, 56, 36},
+    {0x8f7e32ce7bea5c70ULL, 83, 44},
+    {0xd5d238a4abe98068ULL, 109, 52},
+    {0x9f4f2726179a2245ULL, 136, 60},
+    {0xed63a231d4c4fb27ULL, 162, 68},
+    {0xb0de65388cc8ada8ULL, 189, 76},
+    {0x83c7088e1aab65dbULL, 216, 84},
+    {0xc45d1df942711d9aULL, 242, 92},
+    {0x924d692ca61be758ULL, 269, 100},
+    {0xda01ee641a708deaULL, 295, 108},
+    {0xa26da3999aef774aULL, 322, 116},
+    {0xf209787bb47d6b85ULL, 348, 124},
+    {0xb454e4a179dd1877ULL, 375, 132},
+    {0x865b86925b9bc5c2ULL, 402, 140},
+    {0xc83553c5c8965d3dULL, 428, 148},
+    {0x952ab45cfa97a0b3ULL, 455, 156},
+    {0xde469fbd99a05fe3ULL, 481, 164},
+    {0xa59bc234db398c25ULL, 508, 172},
+    {0xf6c69a72a3989f5cULL, 534, 180},
+    {0xb7dcbf5354e9beceULL, 561, 188},
+    {0x88fcf317f22241e2ULL, 588, 196},
+    {0xcc20ce9bd35c78a5ULL, 614, 204},
+    {0x98165af37b2153dfULL, 641, 212},
+    {0xe2a0b5dc971f303aULL, 667, 220},
+    {0xa8d9d1535ce3b396ULL, 694, 228},
+    {0xfb9b7cd9a4a7443cULL, 720, 236},
+    {0xbb764c4ca7a44410ULL, 747, 244},
+    {0x8bab8eefb6409c1aULL, 774, 252},
+    {0xd01fef10a657842cULL, 800, 260},
+    {0x9b10a4e5e9913129ULL, 827, 268},
+    {0xe7109bfba19c0c9dULL, 853, 276},
+    {0xac2820d9623bf429ULL, 880, 284},
+    {0x80444b5e7aa7cf85ULL, 907, 292},
+    {0xbf21e44003acdd2dULL, 933, 300},
+    {0x8e679c2f5e44ff8fULL, 960, 308},
+    {0xd433179d9c8cb841ULL, 986, 316},
+    {0x9e19db92b4e31ba9ULL, 1013, 324},
+    {0xeb96bf6ebadf77d9ULL, 1039, 332},
+    {0xaf87023b9bf0ee6bULL, 1066, 340},
+};
+
+static DiyFp multiplyDiyFp(DiyFp a, DiyFp b) {
+    // Upper 64 bits of the 128-bit product, rounded
+    const uint64_t mask = 0xFFFFFFFFu;
+    uint64_t aHigh = a.f >> 32, aLow = a.f & mask;
+    uint64_t bHigh = b.f >> 32, bLow = b.f & mask;
+    uint64_t highHigh = aHigh * bHigh;
+    uint64_t lowHigh = aLow * bHigh;
+    uint64_t highLow = aHigh * bLow;
+    uint64_t lowLow = aLow * bLow;
+    uint64_t middle = (lowLow >> 32) + (highLow & mask) + (lowHigh & mask);
+    middle += 1u << 31;
+    DiyFp product;
+    product.f = highHigh + (highLow >> 32) + (lowHigh >> 32) + (middle >> 32);
+    product.e = a.e + b.e + 64;
+    return product;
+}
+
+static DiyFp normalizeDiyFp(DiyFp x) {
+    while ((x.f & 0xFFC0000000000000ULL) == 0) {
+        x.f <<= 10;
+        x.e -= 10;
+    }
+    while ((x.f & 0x8000000000000000ULL) == 0) {
+        x.f <<= 1;
+        x.e--;
+    }
+    return x;
+}
+
+/*
+ * Round the last digit down towards w while that stays inside the safe
+ * interval, and report whether the result is provably the closest
+ * shortest representation.
+ */
+static bool roundWeed(char* digits, int length, uint64_t distanceTooHighW,
+                      uint64_t unsafeInterval, uint64_t rest,
+                      uint64_t tenKappa, uint64_t unit) {
+    uint64_t smallDistance = distanceTooHighW - unit;
+    uint64_t bigDistance = distanceTooHighW + unit;
+    while (rest < smallDistance && unsafeInterval - rest >= tenKappa &&
+           (rest + tenKappa < smallDistance ||
+            smallDistance - rest >= rest + tenKappa - smallDistance)) {
+        digits[length - 1]--;
+        rest += tenKappa;
+    }
+    if (rest < bigDistance && unsafeInterval - rest >= tenKappa &&
+        (rest + tenKappa < bigDistance ||
+         bigDistance - rest > rest + tenKappa - bigDistance)) {
+        return false;
+    }
+    return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+}
+
+/* Digits of w (scaled) between low and high; kappa is the exponent of the last */
+static bool generateDigits(DiyFp low, DiyFp w, DiyFp high,
+                           char* digits, int* length, int* kappa) {
+    static const uint32_t powersOfTen[] = {
+        1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+    };
+    uint64_t unit = 1;
+    DiyFp tooLow = {low.f - unit, low.e};
+    DiyFp tooHigh = {high.f + unit, high.e};
+    uint64_t unsafeInterval = tooHigh.f - tooLow.f;
+    int shift = -w.e;
+    uint64_t one = (uint64_t)1 << shift;
+    uint32_t integrals = (uint32_t)(tooHigh.f >> shift);
+    uint64_t fractionals = tooHigh.f & (one - 1);
+
+    int integralDigits = 0;
+    while (integralDigits < 10 && integrals >= powersOfTen[integralDigits]) {
+        integralDigits++;
+    }
+    uint32_t divisor = integralDigits > 0 ? powersOfTen[integralDigits - 1] : 0;
+
+    *kappa = integralDigits;
+    *length = 0;
+    while (*kappa > 0) {
+        digits[(*length)++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        (*kappa)--;
+        uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+        if (rest < unsafeInterval) {
+            return roundWeed(digits, *length, tooHigh.f - w.f, unsafeInterval,
+                             rest, (uint64_t)divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+    for (;;) {
+        fractionals *= 10;
+        unit *= 10;
+        unsafeInterval *= 10;
+        digits[(*length)++] = (char)('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        (*kappa)--;
+        if (fractionals < unsafeInterval) {
+            return roundWeed(digits, *length, (tooHigh.f - w.f) * unit,
+                             unsafeInterval, fractionals, one, unit);
+        }
+    }
+}
+
+/*
+ * Shortest digits of a positive finite value: value = digits * 10^exponent.
+ * Returns false when Grisu3 cannot decide.
+ */
+static bool grisu3(double value, char* digits, int* length, int* exponent) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t fraction = bits & 0x000FFFFFFFFFFFFFULL;
+    int biasedExponent = (int)((bits >> 52) & 0x7FF);
+
+    DiyFp v;
+    if (biasedExponent == 0) {
+        v.f = fraction;
+        v.e = 1 - 1075;
+    } else {
+        v.f = fraction | 0x0010000000000000ULL;
+        v.e = biasedExponent - 1075;
+    }
+
+    // The rounding interval: halfway to each neighbouring double. Below a
+    // power of two the lower neighbour is twice as close.
+    DiyFp plus = normalizeDiyFp((DiyFp){(v.f << 1) + 1, v.e - 1});
+    DiyFp minus;
+    if (fraction == 0 && biasedExponent > 1) {
+        minus = (DiyFp){(v.f << 2) - 1, v.e - 2};
+    } else {
+        minus = (DiyFp){(v.f << 1) - 1, v.e - 1};
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+    DiyFp w = normalizeDiyFp(v);
+
+    // A cached 10^-k that brings w's exponent into [-60, -32]
+    int minExponent = MIN_TARGET_EXPONENT - (w.e + 64);
+    double estimate = (minExponent + 63) * 0.30102999566398114;   // log10(2)
+    int k = (int)estimate;
+    if (k < estimate) k++;      // ceil() without libm
+    int index = (CACHED_POWERS_OFFSET + k - 1) / CACHED_POWERS_STEP + 1;
+    const CachedPower* cached = &cachedPowers[index];
+    DiyFp tenMinusK = {cached->f, cached->e};
+
+    int kappa;
+    if (!generateDigits(multiplyDiyFp(minus, tenMinusK), multiplyDiyFp(w, tenMinusK),
+                        multiplyDiyFp(plus, tenMinusK), digits, length, &kappa)) {
+        return false;
+    }
+    *exponent = kappa - cached->decimalExponent;
+    return true;
+}
+
+/* The exact but slow way: the first precision that reads back */
+static void shortestBySearch(double value, char* digits, int* length, int* exponent) {
+    char text[32];
+    for (int precision = 1; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*e", precision - 1, value);
+        if (strtod(text, NULL) == value) break;
+    }
+    // text is "d.ddde+xx" (or "de+xx")
+    int count = 0;
+    const char* c = text;
+    for (; *c != 'e'; c++) {
+        if (*c != '.') digits[count++] = *c;
+    }
+    *length = count;
+    *exponent = atoi(c + 1) - (count - 1);
+}
+
+static int formatInteger(uint64_t magnitude, char* buffer) {
+    char reversed[DIGIT_BUFFER_SIZE];
+    int count = 0;
+    do {
+        reversed[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    for (int i = 0; i < count; i++) buffer[i] = reversed[count - 1 - i];
+    return count;
+}
+
+int formatNumber(double value, char* buffer) {
+    char* out = buffer;
+    if (isnan(value)) {
+        // Spelled as %g would, sign included
+        if (signbit(value)) *out++ = '-';
+        memcpy(out, "nan", 4);
+        return (int)(out - buffer) + 3;
+    }
+    if (signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (isinf(value)) {
+        memcpy(out, "inf", 4);
+        return (int)(out - buffer) + 3;
+    }
+
+    // Integers below 2^53 are their own shortest form
+    if (value < 9007199254740992.0 && value == (double)(uint64_t)value) {
+        out += formatInteger((uint64_t)value, out);
+        *out = '\0';
+        return (int)(out - buffer);
+    }
+
+    char digits[DIGIT_BUFFER_SIZE];
+    int length, exponent;
+    if (!grisu3(value, digits, &length, &exponent)) {
+        shortestBySearch(value, digits, &length, &exponent);
+    }
+    while (length > 1 && digits[length - 1] == '0') {
+        length--;
+        exponent++;
+    }
+
+    int point = length + exponent;     // Digits before the decimal point
+    int scientific = point - 1;
+    if (scientific < -4 || scientific >= 17) {
+        *out++ = digits[0];
+        if (length > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, (size_t)(length - 1));
+            out += length - 1;
+        }
+        *out++ = 'e';
+        *out++ = scientific < 0 ? '-' : '+';
+        int magnitude = scientific < 0 ? -scientific : scientific;
+        if (magnitude < 10) *out++ = '0';
+        out += formatInteger((uint64_t)magnitude, out);
+    } else if (point <= 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = 0; i < -point; i++) *out++ = '0';
+        memcpy(out, digits, (size_t)length);
+        out += length;
+    } else if (point >= length) {
+        memcpy(out, digits, (size_t)length);
+        out += length;
+        for (int i = length; i < point; i++) *out++ = '0';
+    } else {
+        memcpy(out, digits, (size_t)point);
+        out += point;
+        *out++ = '.';
+        memcpy(out, digits + point, (size_t)(length - point));
+        out += length - point;
+    }
+    *out = '\0';
+    return (int)(out - buffer);
+}
+
+/* ========== Parsing ========== */
+
+#define MAX_MANTISSA_DIGITS 19      // Always fit in a uint64_t
+#define MAX_EXACT_INTEGER 9007199254740992ULL   // 2^53
+
+static const double exactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static bool isHexDigit(char c) {
+    return isDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+/* Digits, an optional point and more digits; false if there were none */
+static const char* skipMantissa(const char* c, const char* end, bool hex) {
+    bool any = false;
+    while (c < end && (hex ? isHexDigit(*c) : isDigit(*c))) { c++; any = true; }
+    if (c < end && *c == '.') {
+        c++;
+        while (c < end && (hex ? isHexDigit(*c) : isDigit(*c))) { c++; any = true; }
+    }
+    return any ? c : NULL;
+}
+
+/* An exponent after the mantissa, if there is one; NULL if it is malformed */
+static const char* skipExponent(const char* c, const char* end, char marker) {
+    if (c == end || (*c | 0x20) != marker) return c;
+    c++;
+    if (c < end && (*c == '+' || *c == '-')) c++;
+    if (c == end || !isDigit(*c)) return NULL;
+    while (c < end && isDigit(*c)) c++;
+    return c;
+}
+
+/*
+ * Clinger's fast path for a validated decimal numeral. Returns false if
+ * the value needs more than one rounding to compute.
+ */
+static bool parseDecimalFast(const char* c, const char* end, double* result) {
+#if FLT_EVAL_METHOD == 0
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    for (; c < end && isDigit(*c); c++) {
+        if (digits == MAX_MANTISSA_DIGITS) return false;
+        mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+        if (mantissa != 0) digits++;
+    }
+    if (c < end && *c == '.') {
+        for (c++; c < end && isDigit(*c); c++) {
+            if (digits == MAX_MANTISSA_DIGITS) return false;
+            mantissa = mantissa * 10 + (uint64_t)(*c - '0');
+            if (mantissa != 0) digits++;
+            exponent--;
+        }
+    }
+    if (c < end) {
+        c++;    // 'e'
+        bool negative = *c == '-';
+        if (*c == '+' || *c == '-') c++;
+        int written = 0;
+        for (; c < end; c++) {
+            if (written > 1000) return false;
+            written = written * 10 + (*c - '0');
+        }
+        exponent += negative ? -written : written;
+    }
+
+    if (mantissa > MAX_EXACT_INTEGER) return false;
+    double value = (double)mantissa;
+    if (mantissa == 0 || exponent == 0) {
+        *result = value;
+    } else if (exponent < 0) {
+        if (exponent < -22) return false;
+        *result = value / exactPowersOfTen[-exponent];
+    } else {
+        // 123e30 is 123e8 (still an exact integer) times 1e22
+        if (exponent > 22) {
+            for (; exponent > 22; exponent--) {
+                mantissa *= 10;
+                if (mantissa > MAX_EXACT_INTEGER) return false;
+            }
+            value = (double)mantissa;
+        }
+        *result = value * exactPowersOfTen[exponent];
+    }
+    return true;
+#else
+    // Excess precision (x87) would round twice
+    (void)c; (void)end; (void)result;
+    return false;
+#endif
+}
+
+bool parseNumber(const char* chars, int length, double* result) {
+    const char* c = chars;
+    const char* end = chars + length;
+    while (c < end && isSpace(*c)) c++;
+    while (end > c && isSpace(end[-1])) end--;
+
+    const char* numeral = c;    // With its sign, for strtod
+    bool negative = false;
+    if (c < end && (*c == '+' || *c == '-')) {
+        negative = *c == '-';
+        c++;
+    }
+    bool hex = end - c > 2 && c[0] == '0' && (c[1] | 0x20) == 'x';
+    const char* digits = hex ? c + 2 : c;
+
+    const char* after = skipMantissa(digits, end, hex);
+    if (after != NULL) after = skipExponent(after, end, hex ? 'p' : 'e');
+    if (after != end) return false;
+
+    if (!hex && parseDecimalFast(c, end, result)) {
+        if (negative) *result = -*result;
+        return true;
+    }
+
+    // strtod needs a terminated copy: the numeral may be followed by more
+    // source text it would read on into (a token "0" before "x1")
+    char local[64];
+    size_t size = (size_t)(end - numeral);
+    char* copy = size < sizeof(local) ? local : malloc(size + 1);
+    if (copy == NULL) return false;
+    memcpy(copy, numeral, size);
+    copy[size] = '\0';
+    *result = strtod(copy, NULL);
+    if (copy != local) free(copy);
+    return true;
+}
@@ -0,0 +1,33 @@
+/*
+ * number.h - Number formatting and parsing
+ *
+ * Every number <-> text conversion in the VM goes through here: print,
+ * tostring, tonumber, string.format's %s, gsub and number literals in
+ * the compiler. Formatting produces the shortest digit string that reads
+ * back as the same double, so tostring(x) round-trips through tonumber.
+ */
+
+#ifndef luapp_number_h
+#define luapp_number_h
+
+#include "common.h"
+
+#define NUMBER_BUFFER_SIZE 32   // Longest formatted number, with the '\0'
+
+/*
+ * Write the shortest round-trip form of value into buffer, returning its
+ * length. Integers print without a fraction ("42"); other values use as
+ * many digits as needed and no more ("0.1", "0.30000000000000004"), with
+ * an exponent ("1e+20", "5e-07") outside the %g-like range 1e-4 .. 1e17.
+ */
+int formatNumber(double value, char* buffer);
+
+/*
+ * Parse a whole Lua numeral: optional surrounding whitespace and sign,
+ * then decimal ("12", "1.5e-3", ".5") or hexadecimal ("0xff", "0x1p4").
+ * Returns false if anything else is in the text. The result is correctly
+ * rounded.
+ */
+bool parseNumber(const char* chars, int length, double* result);
+
+#endif
@@ -4,6 +4,7 @@
 
 #include "object.h"
 #include "memory.h"
+#include "objtable.h"
 #include "table.h"
 #include "vm.h"
 #include <stdio.h>
@@ -30,55 +31,90 @@ static Obj* allocateObject(size_t size, ObjType type) {
 }
 
 /* String interning - hash and check if string already exists */
-static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;  // FNV-1a
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
-    }
-    return hash;
+static uint32_t hashChars(const char* key, int length) {
+    return hashBytes(&vm.hashSeed, key, length);
 }
 
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+/* The characters follow the header in one allocation */
+static ObjString* newStringObject(int length) {
+    ObjString* string = (ObjString*)allocateObject(
+        sizeof(ObjString) + length + 1, OBJ_STRING);
     string->length = length;
-    string->chars = chars;
+    string->chars[length] = '\0';
+    return string;
+}
+
+/* Long strings skip hashing and interning (see ObjString) */
+ObjString* allocateLongString(int length) {
+    ObjString* string = newStringObject(length);
+    string->hash = 0;
+    string->interned = false;
+    string->hashed = false;
+    return string;
+}
+
+void hashString(ObjString* string) {
+    string->hash = hashChars(string->chars, string->length);
+    string->hashed = true;
+}
+
+static ObjString* allocateString(const char* chars, int length, uint32_t hash) {
+    ObjString* string = newStringObject(length);
+    memcpy(string->chars, chars, length);
     string->hash = hash;
+    string->interned = true;
+    string->hashed = true;
     
-    // Intern the string
+    // Intern the string (the table may grow and collect, so root it first)
+    push(OBJ_VAL(string));
     tableSet(&vm.strings, string, NIL_VAL);
+    pop();
     return string;
 }
 
 ObjString* copyString(const char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
+    if (length > INTERN_MAX_LENGTH) {
+        ObjString* string = allocateLongString(length);
+        memcpy(string->chars, chars, length);
+        return string;
+    }
+    
+    uint32_t hash = hashChars(chars, length);
     
     // Check if already interned
     ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
     
-    // Allocate new string
-    char* heapChars = ALLOCATE(char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+    return allocateString(chars, length, hash);
 }
 
-ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
+/*
+ * a .. b. A short result is assembled on the C stack so that an existing
+ * interned copy costs no allocation; a long one is written in place.
+ */
+ObjString* concatChars(const char* a, int aLength, const char* b, int bLength) {
+    int length = aLength + bLength;
+    if (length > INTERN_MAX_LENGTH) {
+        ObjString* string = allocateLongString(length);
+        memcpy(string->chars, a, aLength);
+        memcpy(string->chars + aLength, b, bLength);
+        return string;
     }
     
-    return allocateString(chars, length, hash);
+    char chars[INTERN_MAX_LENGTH];
+    memcpy(chars, a, aLength);
+    memcpy(chars + aLength, b, bLength);
+    return copyString(chars, length);
+}
+
+ObjString* concatStrings(ObjString* a, ObjString* b) {
+    return concatChars(a->chars, a->length, b->chars, b->length);
 }
 
 ObjFunction* newFunction(void) {
     ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
+    function->isVararg = false;
     function->upvalueCount = 0;
     function->name = NULL;
     initChunk(&function->chunk);
@@ -89,6 +125,7 @@ ObjNative* newNative(NativeFn function, ObjString* name) {
     ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
     native->function = function;
     native->name = name;
+    native->state = NIL_VAL;
     return native;
 }
 
@@ -120,13 +157,26 @@ ObjClass* newClass(ObjString* name) {
     klass->superclass = NULL;
     initTable(&klass->methods);
     initTable(&klass->privates);
+    klass->rootShape = NULL;
+    klass->fieldHint = 0;
+    
+    push(OBJ_VAL(klass));  // GC protection
+    klass->rootShape = newShape();
+    pop();
     return klass;
 }
 
 ObjInstance* newInstance(ObjClass* klass) {
+    // Size the field array for what earlier instances ended up with. It is
+    // allocated first so a GC here can't see a half-built instance.
+    int capacity = klass->fieldHint;
+    Value* fields = ALLOCATE(Value, capacity);
+    
     ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
     instance->klass = klass;
-    initTable(&instance->fields);
+    instance->shape = klass->rootShape;
+    instance->fields = fields;
+    instance->fieldCapacity = capacity;
     return instance;
 }
 
@@ -139,8 +189,10 @@ ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method) {
 
 ObjTable* newTable(void) {
     ObjTable* table = ALLOCATE_OBJ(ObjTable, OBJ_TABLE);
-    initTable(&table->entries);
     initValueArray(&table->array);
+    table->nodes = NULL;
+    table->nodeCount = 0;
+    table->nodeCapacity = 0;
     return table;
 }
 
@@ -151,6 +203,172 @@ ObjTrait* newTrait(ObjString* name) {
     return trait;
 }
 
+ObjShape* newShape(void) {
+    ObjShape* shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+    shape->fieldCount = 0;
+    initTable(&shape->slots);
+    initTable(&shape->transitions);
+    return shape;
+}
+
+/* ========== Ropes ========== */
+
+/* A rope that was already flattened stands in for its flat string */
+static Obj* ropeChild(Value value) {
+    Obj* object = AS_OBJ(value);
+    if (object->type == OBJ_ROPE && ((ObjRope*)object)->flat != NULL) {
+        return (Obj*)((ObjRope*)object)->flat;
+    }
+    if (object->type == OBJ_SLICE && ((ObjSlice*)object)->flat != NULL) {
+        return (Obj*)((ObjSlice*)object)->flat;
+    }
+    return object;
+}
+
+/* Callers keep left and right reachable */
+ObjRope* newRope(Value left, Value right) {
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = stringLength(left) + stringLength(right);
+    rope->flat = NULL;
+    rope->left = ropeChild(left);
+    rope->right = ropeChild(right);
+    return rope;
+}
+
+ObjString* flattenRope(ObjRope* rope) {
+    if (rope->flat != NULL) return rope->flat;
+    
+    // Allocating the result may collect, so keep the rope (and through it
+    // every leaf) reachable meanwhile
+    push(OBJ_VAL(rope));
+    ObjString* flat = allocateLongString(rope->length);
+    char* chars = flat->chars;
+    
+    // Copy the leaves left to right. Ropes built in a loop are as deep as
+    // the loop ran, so walk with an explicit stack instead of recursing.
+    int capacity = 16;
+    int count = 0;
+    Obj** pending = (Obj**)malloc(sizeof(Obj*) * capacity);
+    if (pending == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    pending[count++] = (Obj*)rope;
+    
+    int length = 0;
+    while (count > 0) {
+        Obj* node = pending[--count];
+        if (node->type == OBJ_ROPE && ((ObjRope*)node)->flat != NULL) {
+            node = (Obj*)((ObjRope*)node)->flat;
+        }
+        if (node->type != OBJ_ROPE) {
+            // A slice leaf is copied straight from its parent
+            StringView leaf = stringView(OBJ_VAL(node));
+            memcpy(chars + length, leaf.chars, leaf.length);
+            length += leaf.length;
+            continue;
+        }
+        
+        if (count + 2 > capacity) {
+            capacity *= 2;
+            pending = (Obj**)realloc(pending, sizeof(Obj*) * capacity);
+            if (pending == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(1);
+            }
+        }
+        pending[count++] = ((ObjRope*)node)->right;
+        pending[count++] = ((ObjRope*)node)->left;
+    }
+    free(pending);
+    
+    rope->flat = flat;
+    rope->left = NULL;
+    rope->right = NULL;
+    pop();
+    return rope->flat;
+}
+
+/* ========== Slices ========== */
+
+Value substringValue(ObjString* base, const char* chars, int length) {
+    if (chars == base->chars && length == base->length) return OBJ_VAL(base);
+    if (length < SLICE_MIN_LENGTH) return OBJ_VAL(copyString(chars, length));
+
+    ObjSlice* slice = ALLOCATE_OBJ(ObjSlice, OBJ_SLICE);
+    slice->length = length;
+    slice->flat = NULL;
+    slice->parent = base;
+    slice->offset = (int)(chars - base->chars);
+    return OBJ_VAL(slice);
+}
+
+ObjString* materializeSlice(ObjSlice* slice) {
+    if (slice->flat != NULL) return slice->flat;
+
+    // The slice keeps its parent alive while the copy is allocated
+    push(OBJ_VAL(slice));
+    ObjString* flat = allocateLongString(slice->length);
+    memcpy(flat->chars, slice->parent->chars + slice->offset, slice->length);
+    slice->flat = flat;
+    slice->parent = NULL;
+    pop();
+    return flat;
+}
+
+/* ========== Instance Fields ========== */
+
+int shapeSlot(ObjShape* shape, ObjString* name) {
+    Value slot;
+    if (!tableGet(&shape->slots, name, &slot)) return -1;
+    return (int)AS_NUMBER(slot);
+}
+
+/* The shape reached from 'shape' by adding 'name', created on first use */
+static ObjShape* shapeTransition(ObjShape* shape, ObjString* name) {
+    Value next;
+    if (tableGet(&shape->transitions, name, &next)) return AS_SHAPE(next);
+    
+    ObjShape* child = newShape();
+    push(OBJ_VAL(child));  // GC protection
+    tableAddAll(&shape->slots, &child->slots);
+    tableSet(&child->slots, name, NUMBER_VAL(shape->fieldCount));
+    child->fieldCount = shape->fieldCount + 1;
+    tableSet(&shape->transitions, name, OBJ_VAL(child));
+    pop();
+    return child;
+}
+
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value) {
+    int slot = shapeSlot(instance->shape, name);
+    if (slot < 0) return false;
+    *value = instance->fields[slot];
+    return true;
+}
+
+/* Callers keep the instance and value reachable (normally on the VM stack) */
+void instanceSetField(ObjInstance* instance, ObjString* name, Value value) {
+    int slot = shapeSlot(instance->shape, name);
+    if (slot >= 0) {
+        instance->fields[slot] = value;
+        return;
+    }
+    
+    ObjShape* next = shapeTransition(instance->shape, name);
+    if (next->fieldCount > instance->fieldCapacity) {
+        int oldCapacity = instance->fieldCapacity;
+        instance->fieldCapacity = GROW_CAPACITY(oldCapacity);
+        instance->fields = GROW_ARRAY(Value, instance->fields,
+                                      oldCapacity, instance->fieldCapacity);
+    }
+    instance->fields[next->fieldCount - 1] = value;
+    instance->shape = next;
+    
+    if (next->fieldCount > instance->klass->fieldHint) {
+        instance->klass->fieldHint = next->fieldCount;
+    }
+}
+
 /* GC: Mark a single object as reachable */
 void markObject(Obj* object) {
     if (object == NULL) return;
@@ -187,9 +405,15 @@ void blackenObject(Obj* object) {
     
     switch (object->type) {
         case OBJ_STRING:
-        case OBJ_NATIVE:
             // No outgoing references
             break;
+
+        case OBJ_NATIVE: {
+            ObjNative* native = (ObjNative*)object;
+            markObject((Obj*)native->name);
+            markValue(native->state);
+            break;
+        }
             
         case OBJ_UPVALUE:
             markValue(((ObjUpvalue*)object)->closed);
@@ -199,6 +423,16 @@ void blackenObject(Obj* object) {
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
             markArray(&function->chunk.constants);
+            // Cached classes and shapes must stay alive: a freed one's address
+            // could be reused by a new object and turn into a false cache hit
+            for (int i = 0; i < function->chunk.cacheCount; i++) {
+                InlineCache* cache = &function->chunk.caches[i];
+                for (int way = 0; way < IC_WAYS; way++) {
+                    markObject((Obj*)cache->klass[way]);
+                    markValue(cache->method[way]);
+                    markObject((Obj*)cache->shape[way]);
+                }
+            }
             break;
         }
         
@@ -216,13 +450,17 @@ void blackenObject(Obj* object) {
             markObject((Obj*)klass->name);
             markObject((Obj*)klass->superclass);
             markTable(&klass->methods);
+            markObject((Obj*)klass->rootShape);
             break;
         }
         
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
             markObject((Obj*)instance->klass);
-            markTable(&instance->fields);
+            markObject((Obj*)instance->shape);
+            for (int i = 0; i < instance->shape->fieldCount; i++) {
+                markValue(instance->fields[i]);
+            }
             break;
         }
         
@@ -235,8 +473,7 @@ void blackenObject(Obj* object) {
         
         case OBJ_TABLE: {
             ObjTable* table = (ObjTable*)object;
-            markTable(&table->entries);
-            markArray(&table->array);
+            markObjTable(table);
             break;
         }
         
@@ -246,6 +483,28 @@ void blackenObject(Obj* object) {
             markTable(&trait->methods);
             break;
         }
+        
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            markTable(&shape->slots);
+            markTable(&shape->transitions);
+            break;
+        }
+        
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            markObject((Obj*)rope->flat);
+            markObject(rope->left);
+            markObject(rope->right);
+            break;
+        }
+        
+        case OBJ_SLICE: {
+            ObjSlice* slice = (ObjSlice*)object;
+            markObject((Obj*)slice->flat);
+            markObject((Obj*)slice->parent);
+            break;
+        }
     }
 }
 
@@ -258,8 +517,7 @@ void freeObject(Obj* object) {
     switch (object->type) {
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            reallocate(object, sizeof(ObjString) + string->length + 1, 0);
             break;
         }
         
@@ -295,7 +553,7 @@ void freeObject(Obj* object) {
         
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
-            freeTable(&instance->fields);
+            FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
             FREE(ObjInstance, object);
             break;
         }
@@ -306,8 +564,7 @@ void freeObject(Obj* object) {
             
         case OBJ_TABLE: {
             ObjTable* table = (ObjTable*)object;
-            freeTable(&table->entries);
-            freeValueArray(&table->array);
+            freeObjTable(table);
             FREE(ObjTable, object);
             break;
         }
@@ -318,6 +575,22 @@ void freeObject(Obj* object) {
             FREE(ObjTrait, object);
             break;
         }
+        
+        case OBJ_SHAPE: {
+            ObjShape* shape = (ObjShape*)object;
+            freeTable(&shape->slots);
+            freeTable(&shape->transitions);
+            FREE(ObjShape, object);
+            break;
+        }
+        
+        case OBJ_ROPE:
+            FREE(ObjRope, object);
+            break;
+        
+        case OBJ_SLICE:
+            FREE(ObjSlice, object);
+            break;
     }
 }
 
@@ -325,8 +598,14 @@ void freeObject(Obj* object) {
 void printObject(Value value) {
     switch (OBJ_TYPE(value)) {
         case OBJ_STRING:
+        case OBJ_ROPE:
             printf("%s", AS_CSTRING(value));
             break;
+        case OBJ_SLICE: {
+            StringView view = stringView(value);
+            printf("%.*s", view.length, view.chars);
+            break;
+        }
         case OBJ_FUNCTION: {
             ObjFunction* fn = AS_FUNCTION(value);
             if (fn->name == NULL) {
@@ -365,9 +644,13 @@ void printObject(Value value) {
                 printValue(table->array.values[i]);
             }
             // Print hash part (simplified - just show count)
-            if (table->entries.count > 0) {
+            int hashed = 0;
+            for (int i = 0; i < table->nodeCapacity; i++) {
+                if (!IS_NIL(table->nodes[i].value)) hashed++;
+            }
+            if (hashed > 0) {
                 if (!first) printf(", ");
-                printf("... %d more", table->entries.count);
+                printf("... %d more", hashed);
             }
             printf("}");
             break;
@@ -375,5 +658,8 @@ void printObject(Value value) {
         case OBJ_TRAIT:
             printf("<trait %s>", AS_TRAIT(value)->name->chars);
             break;
+        case OBJ_SHAPE:
+            printf("<shape %d fields>", AS_SHAPE(value)->fieldCount);
+            break;
     }
 }
@@ -24,7 +24,10 @@ typedef enum {
     OBJ_INSTANCE,
     OBJ_BOUND_METHOD,
     OBJ_TABLE,
-    OBJ_TRAIT
+    OBJ_TRAIT,
+    OBJ_SHAPE,
+    OBJ_ROPE,
+    OBJ_SLICE
 } ObjType;
 
 /*
@@ -37,24 +40,88 @@ struct Obj {
     struct Obj* next;   // Next object in allocation list
 };
 
-/* ObjString - interned immutable string */
+/*
+ * ObjString - immutable string.
+ *
+ * Strings of up to INTERN_MAX_LENGTH bytes are interned, so equal short
+ * strings are the same object and compare by pointer. Longer ones (file
+ * contents, flattened ropes, long literals) are neither hashed nor
+ * interned when created: their hash is computed on first use as a table
+ * key, and equality falls back to comparing characters.
+ *
+ * The characters live in the same allocation as the header, so a string
+ * costs one malloc and reading it touches one cache line less.
+ */
+#define INTERN_MAX_LENGTH 40
+
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
-    uint32_t hash;      // Cached hash for fast table lookups
+    uint32_t hash;      // Valid once 'hashed' is set
+    bool interned;      // length <= INTERN_MAX_LENGTH
+    bool hashed;        // Always true for interned strings
+    char chars[];       // length bytes plus a '\0', in the same allocation
 };
 
+/*
+ * ObjRope - a string built by '..' that has not been looked at yet.
+ *
+ * Long concatenations make a node pointing at their two operands instead
+ * of copying them, so building a string piece by piece costs O(length)
+ * rather than O(length^2). The first time the string's characters, hash
+ * or identity are needed, asString() copies the leaves into one flat
+ * string; the node then keeps only that.
+ */
+#define ROPE_MIN_LENGTH 64      // Shorter results are concatenated eagerly
+
+#if ROPE_MIN_LENGTH <= INTERN_MAX_LENGTH
+#error "a flattened rope must be a long (uninterned) string"
+#endif
+
+typedef struct {
+    Obj obj;
+    int length;
+    ObjString* flat;    // Flat copy once flattened, else NULL
+    Obj* left;          // ObjString or ObjRope (NULL once flattened)
+    Obj* right;
+} ObjRope;
+
+/*
+ * ObjSlice - a long substring that has not been copied.
+ *
+ * string.sub, string.trim and pattern captures longer than an interned
+ * string point into the string they were cut from, so splitting a large
+ * input into lines or records copies nothing. Reading the characters
+ * (printing, '..', comparing, the string library) uses the parent's bytes
+ * in place through stringView(). Only when an ObjString itself is needed -
+ * a table key, a pattern, C code wanting a '\0' - does asString() copy the
+ * slice out, after which it keeps that copy and lets go of the parent.
+ */
+#define SLICE_MIN_LENGTH (INTERN_MAX_LENGTH + 1)    // Shorter ones are copied
+
+typedef struct {
+    Obj obj;
+    int length;
+    ObjString* flat;    // Copy once materialized, else NULL
+    ObjString* parent;  // Holds the characters (NULL once materialized)
+    int offset;         // Into parent->chars
+} ObjSlice;
+
 /* ObjFunction - compiled function (bytecode chunk + metadata) */
 typedef struct {
     Obj obj;
     int arity;          // Parameter count
+    bool isVararg;      // Declared with '...' after the fixed parameters
     int upvalueCount;
     Chunk chunk;        // Bytecode
     ObjString* name;    // Function name (NULL for scripts)
 } ObjFunction;
 
-/* Native C function signature */
+/*
+ * Native C function signature. The return value is the first result; a
+ * native with more results pushes the rest onto the VM stack, in order,
+ * before returning. args[-1] is the native being called.
+ */
 typedef Value (*NativeFn)(int argCount, Value* args);
 
 /* ObjNative - built-in C function (print, read, etc) */
@@ -62,6 +129,7 @@ typedef struct {
     Obj obj;
     NativeFn function;
     ObjString* name;
+    Value state;        // Per-object data (string.gmatch iterators), else nil
 } ObjNative;
 
 /*
@@ -83,6 +151,19 @@ typedef struct {
     int upvalueCount;
 } ObjClosure;
 
+/*
+ * ObjShape - hidden class describing an instance's field layout.
+ * Instances of a class that add the same fields in the same order walk the
+ * same transitions and end up sharing a shape, so the name -> slot map is
+ * stored once per layout instead of once per instance.
+ */
+typedef struct ObjShape {
+    Obj obj;
+    int fieldCount;         // Slots used by instances with this shape
+    Table slots;            // Field name -> slot index (number)
+    Table transitions;      // Field name -> ObjShape with that field added
+} ObjShape;
+
 /*
  * ObjClass - class definition with methods and inheritance.
  * 'privates' tracks which fields/methods are private.
@@ -93,13 +174,17 @@ typedef struct ObjClass {
     struct ObjClass* superclass;
     Table methods;          // Method name -> ObjClosure
     Table privates;         // Names marked private (value is just true)
+    ObjShape* rootShape;    // Shape of a fresh instance (no fields)
+    int fieldHint;          // Most fields any instance has had (presizing)
 } ObjClass;
 
-/* ObjInstance - instantiated object with fields */
+/* ObjInstance - instantiated object; field values live in shape order */
 typedef struct {
     Obj obj;
     ObjClass* klass;
-    Table fields;           // Field name -> Value
+    ObjShape* shape;        // Current layout, shared with similar instances
+    Value* fields;          // Field values indexed by shape slot
+    int fieldCapacity;
 } ObjInstance;
 
 /* ObjBoundMethod - method bound to a specific instance (for self) */
@@ -109,14 +194,23 @@ typedef struct {
     ObjClosure* method;
 } ObjBoundMethod;
 
+/* A hash part slot: an empty one has a nil key */
+typedef struct {
+    Value key;
+    Value value;            // nil once the key is deleted (until a rehash)
+} TableNode;
+
 /*
  * ObjTable - Lua table (associative array + array part)
  * The core data structure of Lua - can be used as array, dict, or both.
+ * Any value but nil and NaN can be a key (see objtable.h).
  */
 typedef struct {
     Obj obj;
-    Table entries;          // Key-value pairs (hash part)
     ValueArray array;       // Array part (integer keys 1..n)
+    TableNode* nodes;       // Hash part: every other key
+    int nodeCount;          // Nodes with a key, including deleted ones
+    int nodeCapacity;       // Power of two, or 0
 } ObjTable;
 
 /*
@@ -132,7 +226,7 @@ typedef struct {
 /* Type checking macros */
 #define OBJ_TYPE(value)     (AS_OBJ(value)->type)
 
-#define IS_STRING(value)    isObjType(value, OBJ_STRING)
+#define IS_STRING(value)    isString(value)     // Flat strings, ropes, slices
 #define IS_FUNCTION(value)  isObjType(value, OBJ_FUNCTION)
 #define IS_NATIVE(value)    isObjType(value, OBJ_NATIVE)
 #define IS_CLOSURE(value)   isObjType(value, OBJ_CLOSURE)
@@ -141,10 +235,13 @@ typedef struct {
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
 #define IS_TABLE(value)     isObjType(value, OBJ_TABLE)
 #define IS_TRAIT(value)     isObjType(value, OBJ_TRAIT)
+#define IS_SHAPE(value)     isObjType(value, OBJ_SHAPE)
+#define IS_ROPE(value)      isObjType(value, OBJ_ROPE)
+#define IS_SLICE(value)     isObjType(value, OBJ_SLICE)
 
 /* Object unpacking macros */
-#define AS_STRING(value)    ((ObjString*)AS_OBJ(value))
-#define AS_CSTRING(value)   (((ObjString*)AS_OBJ(value))->chars)
+#define AS_STRING(value)    asString(value)     // Flattens a rope, copies a slice
+#define AS_CSTRING(value)   (asString(value)->chars)
 #define AS_FUNCTION(value)  ((ObjFunction*)AS_OBJ(value))
 #define AS_NATIVE(value)    (((ObjNative*)AS_OBJ(value))->function)
 #define AS_CLOSURE(value)   ((ObjClosure*)AS_OBJ(value))
@@ -153,10 +250,15 @@ typedef struct {
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_TABLE(value)     ((ObjTable*)AS_OBJ(value))
 #define AS_TRAIT(value)     ((ObjTrait*)AS_OBJ(value))
+#define AS_SHAPE(value)     ((ObjShape*)AS_OBJ(value))
+#define AS_ROPE(value)      ((ObjRope*)AS_OBJ(value))
+#define AS_SLICE(value)     ((ObjSlice*)AS_OBJ(value))
 
 /* Object constructors */
 ObjString* copyString(const char* chars, int length);
-ObjString* takeString(char* chars, int length);
+ObjString* concatStrings(ObjString* a, ObjString* b);  // Callers keep a, b reachable
+ObjString* concatChars(const char* a, int aLength, const char* b, int bLength);
+ObjString* allocateLongString(int length);  // > INTERN_MAX_LENGTH; caller fills chars
 ObjFunction* newFunction(void);
 ObjNative* newNative(NativeFn function, ObjString* name);
 ObjClosure* newClosure(ObjFunction* function);
@@ -166,6 +268,16 @@ ObjInstance* newInstance(ObjClass* klass);
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
 ObjTable* newTable(void);
 ObjTrait* newTrait(ObjString* name);
+ObjShape* newShape(void);
+ObjRope* newRope(Value left, Value right);  // Both strings, ROPE_MIN_LENGTH+ total
+ObjString* flattenRope(ObjRope* rope);
+ObjString* materializeSlice(ObjSlice* slice);
+void hashString(ObjString* string);         // Fills in a long string's hash
+
+/* Instance fields (see ObjShape) */
+int shapeSlot(ObjShape* shape, ObjString* name);  // -1 if absent
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value);
+void instanceSetField(ObjInstance* instance, ObjString* name, Value value);
 
 /* GC helpers */
 void markObject(Obj* object);
@@ -180,4 +292,71 @@ static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline bool isString(Value value) {
+    if (!IS_OBJ(value)) return false;
+    ObjType type = AS_OBJ(value)->type;
+    return type == OBJ_STRING || type == OBJ_ROPE || type == OBJ_SLICE;
+}
+
+static inline ObjString* asString(Value value) {
+    Obj* object = AS_OBJ(value);
+    if (object->type == OBJ_STRING) return (ObjString*)object;
+    if (object->type == OBJ_SLICE) return materializeSlice((ObjSlice*)object);
+    return flattenRope((ObjRope*)object);
+}
+
+static inline uint32_t stringHash(ObjString* string) {
+    if (!string->hashed) hashString(string);
+    return string->hash;
+}
+
+/* Interned strings are equal only if identical; long ones by content */
+static inline bool stringsEqual(ObjString* a, ObjString* b) {
+    if (a == b) return true;
+    if (a->interned || a->length != b->length) return false;
+    if (a->hashed && b->hashed && a->hash != b->hash) return false;
+    return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+/* Length of a string value, without flattening a rope or copying a slice */
+static inline int stringLength(Value value) {
+    Obj* object = AS_OBJ(value);
+    if (object->type == OBJ_STRING) return ((ObjString*)object)->length;
+    if (object->type == OBJ_SLICE) return ((ObjSlice*)object)->length;
+    return ((ObjRope*)object)->length;
+}
+
+/*
+ * A string value's characters, read in place: not '\0'-terminated, and
+ * valid only while base (which owns them) is reachable. A rope is
+ * flattened first; a slice is not copied.
+ */
+typedef struct {
+    ObjString* base;
+    const char* chars;
+    int length;
+} StringView;
+
+static inline StringView stringView(Value value) {
+    StringView view;
+    Obj* object = AS_OBJ(value);
+    if (object->type == OBJ_SLICE && ((ObjSlice*)object)->flat == NULL) {
+        ObjSlice* slice = (ObjSlice*)object;
+        view.base = slice->parent;
+        view.chars = slice->parent->chars + slice->offset;
+    } else {
+        view.base = asString(value);
+        view.chars = view.base->chars;
+    }
+    view.length = stringLength(value);
+    return view;
+}
+
+/*
+ * length characters at chars, which lie inside base: the whole of base,
+ * an interned copy when short, or else a slice sharing base's bytes.
+ * The caller keeps base reachable.
+ */
+Value substringValue(ObjString* base, const char* chars, int length);
+
 #endif
@@ -0,0 +1,530 @@
+/*
+ * objtable.c - Lua tables: array part plus Value-keyed hash part
+ *
+ * The hash part is open addressing with linear probing, like Table, but
+ * without tombstones: a key is never removed from its node except by a
+ * rehash, which rebuilds both parts from the live pairs, or by the
+ * collector giving back a hash part with no live pairs left.
+ */
+
+#include "objtable.h"
+#include "memory.h"
+#include "vm.h"
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+/* Integer keys up to 2^ARRAY_MAX_BITS can live in the array part */
+#define ARRAY_MAX_BITS 30
+#define ARRAY_MAX_INDEX (1 << ARRAY_MAX_BITS)
+
+/* A shrinking array part keeps at least this many slots */
+#define ARRAY_MIN_CAPACITY 8
+
+/* ========== Keys ========== */
+
+/* key as an array index (1 .. ARRAY_MAX_INDEX), or 0 if it is not one */
+static int arrayIndex(Value key) {
+    if (!IS_NUMBER(key)) return 0;
+    double number = AS_NUMBER(key);
+    if (number >= 1 && number <= ARRAY_MAX_INDEX && number == (double)(int)number) {
+        return (int)number;
+    }
+    return 0;
+}
+
+/*
+ * The form a key is stored in: strings flat, -0 as 0 (so equal numbers
+ * have equal bits). False for the keys a table cannot hold.
+ */
+static bool normalizeKey(Value* key) {
+    if (IS_NIL(*key)) return false;
+    if (IS_NUMBER(*key)) {
+        double number = AS_NUMBER(*key);
+        if (isnan(number)) return false;
+        if (number == 0) *key = NUMBER_VAL(0);
+    } else if (IS_STRING(*key)) {
+        *key = OBJ_VAL(AS_STRING(*key));
+    }
+    return true;
+}
+
+/* A 64-bit finalizer (from MurmurHash3): every input bit affects the result */
+static uint32_t mixBits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static uint32_t hashKey(Value key) {
+    if (IS_OBJ(key)) {
+        Obj* object = AS_OBJ(key);
+        if (object->type == OBJ_STRING) return stringHash((ObjString*)object);
+        return mixBits((uint64_t)(uintptr_t)object);
+    }
+    if (IS_NUMBER(key)) {
+        double number = AS_NUMBER(key);
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        return mixBits(bits);
+    }
+    return AS_BOOL(key) ? 0x9e3779b9u : 0x7f4a7c15u;
+}
+
+/* Both keys normalized: numbers compare by value, strings by content */
+static bool keysEqual(Value a, Value b) {
+    if (IS_NUMBER(a)) return IS_NUMBER(b) && AS_NUMBER(a) == AS_NUMBER(b);
+    if (IS_OBJ(a)) {
+        if (!IS_OBJ(b)) return false;
+        Obj* x = AS_OBJ(a);
+        Obj* y = AS_OBJ(b);
+        if (x == y) return true;
+        return x->type == OBJ_STRING && y->type == OBJ_STRING &&
+               stringsEqual((ObjString*)x, (ObjString*)y);
+    }
+    return valuesEqual(a, b);
+}
+
+/* ========== Hash Part ========== */
+
+/* The node holding key, or the empty node where it would go */
+static TableNode* findNode(TableNode* nodes, int capacity, Value key, uint32_t hash) {
+    uint32_t index = hash & (uint32_t)(capacity - 1);
+    for (;;) {
+        TableNode* node = &nodes[index];
+        if (IS_NIL(node->key) || keysEqual(node->key, key)) return node;
+        index = (index + 1) & (uint32_t)(capacity - 1);
+    }
+}
+
+static TableNode* lookupNode(ObjTable* table, Value key) {
+    if (table->nodeCount == 0) return NULL;
+    TableNode* node = findNode(table->nodes, table->nodeCapacity, key, hashKey(key));
+    return IS_NIL(node->key) ? NULL : node;
+}
+
+/* Store a key known to be absent, in a hash part with room for it */
+static void insertNode(ObjTable* table, Value key, Value value) {
+    TableNode* node = findNode(table->nodes, table->nodeCapacity, key, hashKey(key));
+    node->key = key;
+    node->value = value;
+    table->nodeCount++;
+}
+
+/* ========== Array Part ========== */
+
+/*
+ * After t[n] = nil: n shrinks back to the last non-nil element. Below a
+ * quarter used, the block shrinks to twice what is left, so a drained
+ * array gives its memory back but popping and pushing at one size does
+ * not reallocate.
+ */
+static void trimArray(ObjTable* table) {
+    ValueArray* array = &table->array;
+    while (array->count > 0 && IS_NIL(array->values[array->count - 1])) array->count--;
+
+    int capacity = array->count * 2;
+    if (capacity < ARRAY_MIN_CAPACITY) capacity = ARRAY_MIN_CAPACITY;
+    if (array->count < array->capacity / 4 && capacity < array->capacity) {
+        array->values = GROW_ARRAY(Value, array->values, array->capacity, capacity);
+        array->capacity = capacity;
+    }
+}
+
+/* Move n + 1, n + 2, ... from the hash part to the end of the array */
+static void pullIntoArray(ObjTable* table) {
+    while (table->nodeCount > 0) {
+        TableNode* node = lookupNode(table, NUMBER_VAL(table->array.count + 1));
+        if (node == NULL || IS_NIL(node->value)) return;
+        writeValueArray(&table->array, node->value);    // The node roots it meanwhile
+        node->value = NIL_VAL;
+    }
+}
+
+static void appendArray(ObjTable* table, Value value) {
+    writeValueArray(&table->array, value);
+    pullIntoArray(table);
+}
+
+/* ========== Rehash ========== */
+
+/* Bucket b counts keys in (2^(b-1), 2^b]; bucket 0 is key 1 */
+static int keyBucket(unsigned int key) {
+    int bucket = 0;
+    for (unsigned int size = 1; size < key; size <<= 1) bucket++;
+    return bucket;
+}
+
+/* Count the array's non-nil slots into the buckets */
+static int countArray(ObjTable* table, int* buckets) {
+    int live = 0;
+    int bucket = 0;
+    int bucketEnd = 1;
+    for (int key = 1; key <= table->array.count; key++) {
+        if (key > bucketEnd) {
+            bucket++;
+            bucketEnd *= 2;
+        }
+        if (!IS_NIL(table->array.values[key - 1])) {
+            buckets[bucket]++;
+            live++;
+        }
+    }
+    return live;
+}
+
+/*
+ * Lua's rule: the largest power of two n such that more than n / 2 of
+ * the keys 1..n are in use (0 if there is none).
+ */
+static int arrayLimit(const int* buckets, int integerKeys) {
+    int below = 0;
+    int limit = 0;
+    int size = 1;
+    for (int bucket = 0; bucket <= ARRAY_MAX_BITS && integerKeys > size / 2;
+         bucket++, size *= 2) {
+        below += buckets[bucket];
+        if (below > size / 2) limit = size;
+    }
+    return limit;
+}
+
+/*
+ * Rebuild the table with arraySize array slots and room for hashCount
+ * keys in the hash part. Only the live pairs survive.
+ */
+static void resize(ObjTable* table, int arraySize, int hashCount) {
+    int capacity = 0;
+    if (hashCount > 0) {
+        capacity = 4;
+        while (hashCount * 4 > capacity * 3) capacity *= 2;    // Load <= 3/4
+    }
+
+    // Allocate everything first: a collection meanwhile still sees the
+    // old layout
+    TableNode* nodes = NULL;
+    if (capacity > 0) {
+        nodes = ALLOCATE(TableNode, capacity);
+        for (int i = 0; i < capacity; i++) {
+            nodes[i].key = NIL_VAL;
+            nodes[i].value = NIL_VAL;
+        }
+    }
+    ValueArray* array = &table->array;
+    if (arraySize > array->capacity) {
+        array->values = GROW_ARRAY(Value, array->values, array->capacity, arraySize);
+        array->capacity = arraySize;
+    }
+
+    TableNode* oldNodes = table->nodes;
+    int oldCapacity = table->nodeCapacity;
+    table->nodes = nodes;
+    table->nodeCapacity = capacity;
+    table->nodeCount = 0;
+
+    // Array slots past the new size move to the hash part
+    for (int i = arraySize; i < array->count; i++) {
+        if (!IS_NIL(array->values[i])) {
+            insertNode(table, NUMBER_VAL(i + 1), array->values[i]);
+        }
+    }
+    for (int i = array->count; i < arraySize; i++) array->values[i] = NIL_VAL;
+    array->count = arraySize;
+
+    for (int i = 0; i < oldCapacity; i++) {
+        TableNode* node = &oldNodes[i];
+        if (IS_NIL(node->key) || IS_NIL(node->value)) continue;
+        int index = arrayIndex(node->key);
+        if (index > 0 && index <= arraySize) {
+            array->values[index - 1] = node->value;
+        } else {
+            insertNode(table, node->key, node->value);
+        }
+    }
+    FREE_ARRAY(TableNode, oldNodes, oldCapacity);
+}
+
+/*
+ * The hash part is full and extraKey is about to be added: size both
+ * parts for the live keys plus that one. The array part is only
+ * reconsidered when integer keys are involved, so a big array does not
+ * make every rehash of a string-keyed hash part expensive.
+ */
+static void rehash(ObjTable* table, Value extraKey) {
+    int buckets[ARRAY_MAX_BITS + 1] = {0};
+    int liveNodes = 0;
+    int integerKeys = 0;
+    for (int i = 0; i < table->nodeCapacity; i++) {
+        TableNode* node = &table->nodes[i];
+        if (IS_NIL(node->key) || IS_NIL(node->value)) continue;
+        liveNodes++;
+        int index = arrayIndex(node->key);
+        if (index > 0) {
+            buckets[keyBucket((unsigned int)index)]++;
+            integerKeys++;
+        }
+    }
+    int extraIndex = arrayIndex(extraKey);
+    if (extraIndex > 0) {
+        buckets[keyBucket((unsigned int)extraIndex)]++;
+        integerKeys++;
+    }
+
+    if (integerKeys == 0) {
+        resize(table, table->array.count, liveNodes + 1);
+        return;
+    }
+
+    integerKeys += countArray(table, buckets);
+    int limit = arrayLimit(buckets, integerKeys);
+
+    // The new array ends at the highest key in use up to the limit
+    int arraySize = extraIndex <= limit ? extraIndex : 0;
+    for (int i = (table->array.count < limit ? table->array.count : limit); i > arraySize; i--) {
+        if (!IS_NIL(table->array.values[i - 1])) {
+            arraySize = i;
+            break;
+        }
+    }
+    int movedIn = 0;
+    for (int i = 0; i < table->nodeCapacity; i++) {
+        TableNode* node = &table->nodes[i];
+        if (IS_NIL(node->key) || IS_NIL(node->value)) continue;
+        int index = arrayIndex(node->key);
+        if (index > 0 && index <= limit) {
+            movedIn++;
+            if (index > arraySize) arraySize = index;
+        }
+    }
+    int movedOut = 0;
+    for (int i = arraySize; i < table->array.count; i++) {
+        if (!IS_NIL(table->array.values[i])) movedOut++;
+    }
+
+    bool extraInHash = extraIndex == 0 || extraIndex > arraySize;
+    resize(table, arraySize, liveNodes - movedIn + movedOut + (extraInHash ? 1 : 0));
+    pullIntoArray(table);
+}
+
+/* ========== Access ========== */
+
+Value objTableGet(ObjTable* table, Value key) {
+    int index = arrayIndex(key);
+    if (index > 0 && index <= table->array.count) return table->array.values[index - 1];
+    if (table->nodeCount == 0 || !normalizeKey(&key)) return NIL_VAL;
+
+    // Flattening the key may have collected an emptied hash part
+    TableNode* node = lookupNode(table, key);
+    return node == NULL ? NIL_VAL : node->value;
+}
+
+bool objTableSet(ObjTable* table, Value key, Value value) {
+    int index = arrayIndex(key);
+    if (index > 0 && index <= table->array.count) {
+        table->array.values[index - 1] = value;
+        if (index == table->array.count && IS_NIL(value)) trimArray(table);
+        return true;
+    }
+    if (index > 0 && index == table->array.count + 1 && !IS_NIL(value)) {
+        appendArray(table, value);
+        return true;
+    }
+    if (!normalizeKey(&key)) return false;
+
+    TableNode* node = lookupNode(table, key);
+    if (node != NULL) {
+        node->value = value;
+        return true;
+    }
+    if (IS_NIL(value)) return true;     // Already absent
+
+    if ((table->nodeCount + 1) * 4 > table->nodeCapacity * 3) {
+        rehash(table, key);
+        // The array part may have grown to take the key
+        if (index > 0 && index <= table->array.count) {
+            table->array.values[index - 1] = value;
+            return true;
+        }
+        if (index > 0 && index == table->array.count + 1) {
+            appendArray(table, value);
+            return true;
+        }
+    }
+    insertNode(table, key, value);
+    return true;
+}
+
+Value objTableGetField(ObjTable* table, ObjString* name) {
+    if (table->nodeCount == 0) return NIL_VAL;
+    return findNode(table->nodes, table->nodeCapacity, OBJ_VAL(name), stringHash(name))->value;
+}
+
+void objTableSetField(ObjTable* table, ObjString* name, Value value) {
+    objTableSet(table, OBJ_VAL(name), value);
+}
+
+void objTableReserve(ObjTable* table, int arraySize, int hashCount) {
+    ValueArray* array = &table->array;
+    if (arraySize > array->capacity) {
+        array->values = GROW_ARRAY(Value, array->values, array->capacity, arraySize);
+        array->capacity = arraySize;
+    }
+    if (hashCount > 0 && hashCount * 4 > table->nodeCapacity * 3) {
+        resize(table, array->count, hashCount);
+    }
+}
+
+void objTableSetList(ObjTable* table, int start, Value* values, int count) {
+    ValueArray* array = &table->array;
+    if (start != array->count + 1 || count > ARRAY_MAX_INDEX - array->count) {
+        // Not at the end of the array part (an earlier [k] = v took it)
+        for (int i = 0; i < count; i++) {
+            objTableSet(table, NUMBER_VAL((double)start + i), values[i]);
+        }
+        return;
+    }
+
+    if (array->count + count > array->capacity) {
+        int oldCapacity = array->capacity;
+        array->capacity = array->count + count;
+        if (array->capacity < GROW_CAPACITY(oldCapacity)) {
+            array->capacity = GROW_CAPACITY(oldCapacity);
+        }
+        array->values = GROW_ARRAY(Value, array->values, oldCapacity, array->capacity);
+    }
+    // Nils are stored too, as positions: #{1, nil, 3} is 3
+    memcpy(array->values + array->count, values, (size_t)count * sizeof(Value));
+    array->count += count;
+
+    if (table->nodeCount > 0) {
+        // [k] = v entries for these positions are overwritten, as in Lua
+        for (int i = 0; i < count; i++) {
+            TableNode* node = lookupNode(table, NUMBER_VAL((double)start + i));
+            if (node != NULL) node->value = NIL_VAL;
+        }
+        pullIntoArray(table);
+    }
+}
+
+void objTableSpanArray(ObjTable* table, int length) {
+    if (length <= table->array.count) return;
+    resize(table, length, table->nodeCount);
+}
+
+int objTableLength(ObjTable* table) {
+    ValueArray* array = &table->array;
+    int n = array->count;
+    if (n > 0 && IS_NIL(array->values[n - 1])) {
+        // A trailing hole (from a literal such as {1, nil}): binary search
+        // for a border, keeping values[low - 1] non-nil and values[high - 1] nil
+        int low = 0;
+        int high = n;
+        while (high - low > 1) {
+            int middle = low + (high - low) / 2;
+            if (IS_NIL(array->values[middle - 1])) {
+                high = middle;
+            } else {
+                low = middle;
+            }
+        }
+        return low;
+    }
+    if (table->nodeCount == 0 || IS_NIL(objTableGet(table, NUMBER_VAL(n + 1)))) return n;
+
+    // The sequence continues in the hash part: double until a nil, then
+    // binary search between the last non-nil and that nil
+    long long low = (long long)n + 1;
+    long long high = low * 2;
+    while (!IS_NIL(objTableGet(table, NUMBER_VAL((double)high)))) {
+        low = high;
+        if (high > INT_MAX / 2) return (int)low;
+        high *= 2;
+    }
+    while (high - low > 1) {
+        long long middle = low + (high - low) / 2;
+        if (IS_NIL(objTableGet(table, NUMBER_VAL((double)middle)))) {
+            high = middle;
+        } else {
+            low = middle;
+        }
+    }
+    return (int)low;
+}
+
+/* ========== Traversal ========== */
+
+/*
+ * A cursor c >= 0 resumes at array index c; c < 0 resumes at hash slot
+ * -c - 1. Keeping the two apart means the array shrinking under a
+ * traversal (t[#t] = nil) cannot throw off its place in the hash part.
+ */
+bool objTableNext(ObjTable* table, int* cursor, Value* key, Value* value) {
+    int position = *cursor;
+    for (; position >= 0 && position < table->array.count; position++) {
+        if (IS_NIL(table->array.values[position])) continue;
+        *key = NUMBER_VAL(position + 1);
+        *value = table->array.values[position];
+        *cursor = position + 1;
+        return true;
+    }
+
+    for (int slot = position < 0 ? -position - 1 : 0; slot < table->nodeCapacity; slot++) {
+        TableNode* node = &table->nodes[slot];
+        if (IS_NIL(node->key) || IS_NIL(node->value)) continue;
+        *key = node->key;
+        *value = node->value;
+        *cursor = -(slot + 2);
+        return true;
+    }
+    *cursor = -(table->nodeCapacity + 1);
+    return false;
+}
+
+bool objTableNextKey(ObjTable* table, Value* key, Value* value) {
+    int cursor = 0;
+    if (!IS_NIL(*key)) {
+        Value found = *key;
+        int index = arrayIndex(found);
+        TableNode* node = NULL;
+        if (index > 0 && index <= table->array.count) {
+            cursor = index;
+        } else if (normalizeKey(&found) && (node = lookupNode(table, found)) != NULL) {
+            cursor = -(int)(node - table->nodes) - 2;
+        } else if (index > 0) {
+            cursor = -1;    // Past an array end cleared during the traversal
+        } else {
+            return false;
+        }
+    }
+    return objTableNext(table, &cursor, key, value);
+}
+
+/* ========== Memory ========== */
+
+void markObjTable(ObjTable* table) {
+    markArray(&table->array);
+    // Keys whose value was set to nil are still compared against
+    int live = 0;
+    for (int i = 0; i < table->nodeCapacity; i++) {
+        markValue(table->nodes[i].key);
+        markValue(table->nodes[i].value);
+        if (!IS_NIL(table->nodes[i].value)) live++;
+    }
+
+    // Nothing left in the hash part: give it back. Unlike a rehash this
+    // cannot upset a traversal, which has no pairs left there to visit.
+    if (live == 0 && table->nodeCapacity > 0) {
+        FREE_ARRAY(TableNode, table->nodes, table->nodeCapacity);
+        table->nodes = NULL;
+        table->nodeCount = 0;
+        table->nodeCapacity = 0;
+    }
+}
+
+void freeObjTable(ObjTable* table) {
+    freeValueArray(&table->array);
+    FREE_ARRAY(TableNode, table->nodes, table->nodeCapacity);
+}
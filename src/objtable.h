@@ -0,0 +1,74 @@
+/*
+ * objtable.h - Lua tables (ObjTable)
+ *
+ * A table keeps the integer keys 1..n in an array part and every other
+ * key - strings, other numbers, booleans, objects - in a hash part keyed
+ * by Value. Storing at n + 1 appends to the array (and pulls n + 2, ...
+ * across if they were waiting in the hash part); any other integer key
+ * goes to the hash part, so t[1000000] = x costs one node, not a million
+ * slots. When the hash part fills up, Lua's sizing rule decides afresh
+ * which integer keys belong in the array: the largest power of two n
+ * such that more than half of 1..n are in use.
+ *
+ * Setting a hash key to nil keeps its node with a nil value, so a loop
+ * can clear fields while it traverses the table, as in Lua. Such nodes
+ * are dropped at the next rehash, and a hash part with nothing else left
+ * is freed by the next collection. The array part shrinks as t[#t] = nil
+ * drains it.
+ *
+ * Lookups that take a Value key flatten a rope or slice key (which may
+ * allocate): callers keep the key reachable.
+ */
+
+#ifndef luapp_objtable_h
+#define luapp_objtable_h
+
+#include "object.h"
+
+/* t[key], or nil */
+Value objTableGet(ObjTable* table, Value key);
+
+/* t[key] = value; false if key is nil or NaN */
+bool objTableSet(ObjTable* table, Value key, Value value);
+
+/* t.name and t.name = value, for names known to be flat strings */
+Value objTableGetField(ObjTable* table, ObjString* name);
+void objTableSetField(ObjTable* table, ObjString* name, Value value);
+
+/*
+ * Table literals: room for arraySize elements and hashCount other keys,
+ * then t[start], t[start + 1], ... = values[0], values[1], ... in one go.
+ * The values stay reachable (on the VM stack) while the table grows.
+ */
+void objTableReserve(ObjTable* table, int arraySize, int hashCount);
+void objTableSetList(ObjTable* table, int start, Value* values, int count);
+
+/*
+ * Move the keys 1..length into the array part, so natives can work on
+ * table->array.values directly. length is a border (every key in 1..length
+ * is present), as objTableLength returns.
+ */
+void objTableSpanArray(ObjTable* table, int length);
+
+/* #t: a border (t[n] ~= nil and t[n + 1] == nil), as Lua defines it */
+int objTableLength(ObjTable* table);
+
+/*
+ * Traversal: array part in order, then the hash part by slot. *cursor
+ * starts at 0 and is advanced past each pair returned; false at the end.
+ * Values may be changed (or set to nil) during a traversal, but adding
+ * keys may rehash the table and make it skip or repeat pairs.
+ */
+bool objTableNext(ObjTable* table, int* cursor, Value* key, Value* value);
+
+/*
+ * next(t, key): the pair after *key (the first when it is nil), written
+ * back into *key and *value. False at the end, or if key is not in t.
+ */
+bool objTableNextKey(ObjTable* table, Value* key, Value* value);
+
+/* GC: mark keys and values, freeing a hash part that holds no live pairs */
+void markObjTable(ObjTable* table);
+void freeObjTable(ObjTable* table);
+
+#endif
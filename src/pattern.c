@@ -0,0 +1,489 @@
+/*
+ * pattern.c - Lua pattern compiler, matcher and pattern cache
+ *
+ * The matcher follows Lua 5.4's lstrlib.c, but runs over pre-compiled
+ * items instead of the pattern text: classes and sets are resolved to
+ * bitmaps once, so each subject character is tested with one lookup.
+ */
+
+#include "pattern.h"
+#include "object.h"
+#include <ctype.h>
+#include <limits.h>
+
+#define CAPTURE_UNFINISHED (-1)
+#define MAX_MATCH_DEPTH 200     // Nested quantifiers/captures ("pattern too complex")
+
+typedef enum {
+    ITEM_SINGLE,        // One character in 'set', possibly quantified
+    ITEM_OPEN,          // '('
+    ITEM_POSITION,      // '()'
+    ITEM_CLOSE,         // ')'
+    ITEM_BACKREF,       // %1-%9: capture 'a' again
+    ITEM_BALANCE,       // %bxy: 'a' ... 'b', balanced
+    ITEM_FRONTIER,      // %f[set]: between a non-member and a member
+    ITEM_END_ANCHOR,    // Trailing '$'
+} ItemKind;
+
+typedef struct {
+    uint8_t kind;
+    char quantifier;    // ITEM_SINGLE: 0, '*', '+', '-' or '?'
+    uint8_t a;
+    uint8_t b;
+    uint8_t set[32];    // 256-bit membership (ITEM_SINGLE, ITEM_FRONTIER)
+} Item;
+
+struct Pattern {
+    bool anchored;
+    int captureCount;
+    int count;
+    Item items[];       // Never more than one per pattern character
+};
+
+/* ========== Compiling ========== */
+
+static bool inSet(const uint8_t* set, unsigned char c) {
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+static void addToSet(uint8_t* set, unsigned char c) {
+    set[c >> 3] |= (uint8_t)(1 << (c & 7));
+}
+
+/* Whether c belongs to %<cl> (any other cl stands for itself) */
+static bool matchClass(int c, int cl) {
+    bool result;
+    switch (tolower(cl)) {
+        case 'a': result = isalpha(c); break;
+        case 'c': result = iscntrl(c); break;
+        case 'd': result = isdigit(c); break;
+        case 'g': result = isgraph(c); break;
+        case 'l': result = islower(c); break;
+        case 'p': result = ispunct(c); break;
+        case 's': result = isspace(c); break;
+        case 'u': result = isupper(c); break;
+        case 'w': result = isalnum(c); break;
+        case 'x': result = isxdigit(c); break;
+        default: return cl == c;
+    }
+    if (isupper(cl)) result = !result;
+    return result;
+}
+
+static void addClass(uint8_t* set, unsigned char cl) {
+    for (int c = 0; c <= UCHAR_MAX; c++) {
+        if (matchClass(c, cl)) addToSet(set, (unsigned char)c);
+    }
+}
+
+/*
+ * Compile the set opening at p (the '['). Returns the character after
+ * the closing ']', or NULL if there is none. As in Lua, the first
+ * character (after an optional '^') is a member even if it is ']'. The
+ * pattern text is NUL-terminated, so looking one past 'end' is safe.
+ */
+static const char* compileSet(const char* p, const char* end, uint8_t* set) {
+    const char* open = p++;
+    bool negate = false;
+    if (*p == '^') {
+        negate = true;
+        open = p++;
+    }
+
+    // Find the closing ']' first: '-' ranges must not run into it
+    const char* close = p;
+    do {
+        if (close == end) return NULL;
+        if (*close++ == '%' && close < end) close++;
+    } while (*close != ']');
+    if (close == end) return NULL;
+
+    memset(set, 0, 32);
+    p = open;
+    while (++p < close) {
+        if (*p == '%') {
+            p++;
+            addClass(set, (unsigned char)*p);
+        } else if (p[1] == '-' && p + 2 < close) {
+            for (int c = (unsigned char)p[0]; c <= (unsigned char)p[2]; c++) {
+                addToSet(set, (unsigned char)c);
+            }
+            p += 2;
+        } else {
+            addToSet(set, (unsigned char)*p);
+        }
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) set[i] = (uint8_t)~set[i];
+    }
+    return close + 1;
+}
+
+static Pattern* compileError(Pattern* pattern, const char** error, const char* message) {
+    free(pattern);
+    *error = message;
+    return NULL;
+}
+
+static Pattern* compilePattern(const char* chars, int length, bool anchorable,
+                               const char** error) {
+    Pattern* pattern = (Pattern*)malloc(sizeof(Pattern) + sizeof(Item) * (length + 1));
+    if (pattern == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+
+    const char* p = chars;
+    const char* end = chars + length;
+    pattern->anchored = anchorable && p < end && *p == '^';
+    if (pattern->anchored) p++;
+    pattern->captureCount = 0;
+    pattern->count = 0;
+
+    int open[PATTERN_MAX_CAPTURES];     // Indexes of captures not yet closed
+    int openCount = 0;
+    bool closed[PATTERN_MAX_CAPTURES] = {false};
+
+    while (p < end) {
+        Item* item = &pattern->items[pattern->count++];
+        item->kind = ITEM_SINGLE;
+        item->quantifier = 0;
+
+        switch (*p) {
+            case '(':
+                if (pattern->captureCount == PATTERN_MAX_CAPTURES) {
+                    return compileError(pattern, error, "too many captures");
+                }
+                item->a = (uint8_t)pattern->captureCount;
+                if (p + 1 < end && p[1] == ')') {
+                    item->kind = ITEM_POSITION;
+                    closed[pattern->captureCount++] = true;
+                    p += 2;
+                } else {
+                    item->kind = ITEM_OPEN;
+                    open[openCount++] = pattern->captureCount++;
+                    p++;
+                }
+                continue;
+
+            case ')':
+                if (openCount == 0) {
+                    return compileError(pattern, error, "invalid pattern capture");
+                }
+                item->kind = ITEM_CLOSE;
+                closed[open[--openCount]] = true;
+                p++;
+                continue;
+
+            case '$':
+                if (p + 1 == end) {
+                    item->kind = ITEM_END_ANCHOR;
+                    p++;
+                    continue;
+                }
+                break;
+
+            case '%':
+                if (p + 1 == end) {
+                    return compileError(pattern, error, "malformed pattern (ends with '%')");
+                }
+                if (p[1] == 'b') {
+                    if (p + 3 >= end) {
+                        return compileError(pattern, error, "missing arguments to '%b'");
+                    }
+                    item->kind = ITEM_BALANCE;
+                    item->a = (uint8_t)p[2];
+                    item->b = (uint8_t)p[3];
+                    p += 4;
+                    continue;
+                }
+                if (p[1] == 'f') {
+                    p += 2;
+                    if (*p != '[') {
+                        return compileError(pattern, error, "missing '[' after '%f' in pattern");
+                    }
+                    item->kind = ITEM_FRONTIER;
+                    p = compileSet(p, end, item->set);
+                    if (p == NULL) {
+                        return compileError(pattern, error, "malformed pattern (missing ']')");
+                    }
+                    continue;
+                }
+                if (isdigit((unsigned char)p[1])) {
+                    int index = p[1] - '1';
+                    if (index < 0 || index >= pattern->captureCount || !closed[index]) {
+                        return compileError(pattern, error, "invalid capture index");
+                    }
+                    item->kind = ITEM_BACKREF;
+                    item->a = (uint8_t)index;
+                    p += 2;
+                    continue;
+                }
+                break;
+
+            default:
+                break;
+        }
+
+        // A single-character matcher, then its quantifier
+        memset(item->set, 0, sizeof(item->set));
+        if (*p == '.') {
+            memset(item->set, 0xff, sizeof(item->set));
+            p++;
+        } else if (*p == '%') {
+            addClass(item->set, (unsigned char)p[1]);
+            p += 2;
+        } else if (*p == '[') {
+            p = compileSet(p, end, item->set);
+            if (p == NULL) {
+                return compileError(pattern, error, "malformed pattern (missing ']')");
+            }
+        } else {
+            addToSet(item->set, (unsigned char)*p);
+            p++;
+        }
+        if (p < end && *p != '\0' && strchr("*+-?", *p) != NULL) item->quantifier = *p++;
+    }
+
+    if (openCount > 0) return compileError(pattern, error, "unfinished capture");
+    return pattern;
+}
+
+/* ========== Matching ========== */
+
+typedef struct {
+    const Pattern* pattern;
+    Match* match;
+    int depth;                  // Nesting left before "pattern too complex"
+    const char* error;
+} MatchState;
+
+static const char* doMatch(MatchState* ms, const char* s, int index);
+
+static const char* maxExpand(MatchState* ms, const char* s, int index) {
+    const uint8_t* set = ms->pattern->items[index].set;
+    ptrdiff_t count = 0;
+    while (s + count < ms->match->subjectEnd && inSet(set, (unsigned char)s[count])) {
+        count++;
+    }
+    // Longest run first, backing off one character at a time
+    for (; count >= 0; count--) {
+        const char* result = doMatch(ms, s + count, index + 1);
+        if (result != NULL || ms->error != NULL) return result;
+    }
+    return NULL;
+}
+
+static const char* minExpand(MatchState* ms, const char* s, int index) {
+    const uint8_t* set = ms->pattern->items[index].set;
+    for (;;) {
+        const char* result = doMatch(ms, s, index + 1);
+        if (result != NULL || ms->error != NULL) return result;
+        if (s < ms->match->subjectEnd && inSet(set, (unsigned char)*s)) {
+            s++;
+        } else {
+            return NULL;
+        }
+    }
+}
+
+static const char* startCapture(MatchState* ms, const char* s, int index, int length) {
+    Match* match = ms->match;
+    match->captures[match->captureCount].start = s;
+    match->captures[match->captureCount].length = length;
+    match->captureCount++;
+    const char* result = doMatch(ms, s, index);
+    if (result == NULL) match->captureCount--;
+    return result;
+}
+
+static const char* endCapture(MatchState* ms, const char* s, int index) {
+    Match* match = ms->match;
+    int capture = match->captureCount - 1;
+    while (match->captures[capture].length != CAPTURE_UNFINISHED) capture--;
+
+    match->captures[capture].length = (int)(s - match->captures[capture].start);
+    const char* result = doMatch(ms, s, index);
+    if (result == NULL) match->captures[capture].length = CAPTURE_UNFINISHED;
+    return result;
+}
+
+static const char* matchBalance(MatchState* ms, const char* s, char open, char close) {
+    const char* end = ms->match->subjectEnd;
+    if (s >= end || *s != open) return NULL;
+    int depth = 1;
+    while (++s < end) {
+        if (*s == close) {
+            if (--depth == 0) return s + 1;
+        } else if (*s == open) {
+            depth++;
+        }
+    }
+    return NULL;
+}
+
+/* Match items[index...] at s; the end of the match or NULL */
+static const char* doMatch(MatchState* ms, const char* s, int index) {
+    if (ms->depth-- == 0) {
+        ms->error = "pattern too complex";
+        return NULL;
+    }
+
+    const Item* items = ms->pattern->items;
+    const char* subjectEnd = ms->match->subjectEnd;
+    const char* result = s;
+
+    // Items that cannot backtrack advance in this loop; the rest recurse
+    while (index < ms->pattern->count) {
+        const Item* item = &items[index];
+        switch (item->kind) {
+            case ITEM_OPEN:
+                result = startCapture(ms, s, index + 1, CAPTURE_UNFINISHED);
+                goto done;
+            case ITEM_POSITION:
+                result = startCapture(ms, s, index + 1, CAPTURE_POSITION);
+                goto done;
+            case ITEM_CLOSE:
+                result = endCapture(ms, s, index + 1);
+                goto done;
+            case ITEM_END_ANCHOR:
+                result = s == subjectEnd ? s : NULL;
+                goto done;
+            case ITEM_BALANCE:
+                s = matchBalance(ms, s, (char)item->a, (char)item->b);
+                if (s == NULL) {
+                    result = NULL;
+                    goto done;
+                }
+                index++;
+                continue;
+            case ITEM_FRONTIER: {
+                unsigned char previous = s == ms->match->subject ? '\0' : (unsigned char)s[-1];
+                unsigned char current = s < subjectEnd ? (unsigned char)*s : '\0';
+                if (inSet(item->set, previous) || !inSet(item->set, current)) {
+                    result = NULL;
+                    goto done;
+                }
+                index++;
+                continue;
+            }
+            case ITEM_BACKREF: {
+                Capture* capture = &ms->match->captures[item->a];
+                if (capture->length < 0 || subjectEnd - s < capture->length ||
+                    memcmp(capture->start, s, capture->length) != 0) {
+                    result = NULL;
+                    goto done;
+                }
+                s += capture->length;
+                index++;
+                continue;
+            }
+            case ITEM_SINGLE: {
+                bool matched = s < subjectEnd && inSet(item->set, (unsigned char)*s);
+                switch (item->quantifier) {
+                    case '?':
+                        if (matched) {
+                            result = doMatch(ms, s + 1, index + 1);
+                            if (result != NULL || ms->error != NULL) goto done;
+                        }
+                        index++;
+                        continue;
+                    case '+':
+                        result = matched ? maxExpand(ms, s + 1, index) : NULL;
+                        goto done;
+                    case '*':
+                        result = maxExpand(ms, s, index);
+                        goto done;
+                    case '-':
+                        result = minExpand(ms, s, index);
+                        goto done;
+                    default:
+                        if (!matched) {
+                            result = NULL;
+                            goto done;
+                        }
+                        s++;
+                        index++;
+                        continue;
+                }
+            }
+        }
+    }
+    result = s;
+
+done:
+    ms->depth++;
+    return result;
+}
+
+bool patternAnchored(const Pattern* pattern) {
+    return pattern->anchored;
+}
+
+int patternCaptureCount(const Pattern* pattern) {
+    return pattern->captureCount;
+}
+
+const char* matchPattern(const Pattern* pattern, const char* subject,
+                         const char* subjectEnd, const char* at,
+                         Match* match, const char** error) {
+    match->subject = subject;
+    match->subjectEnd = subjectEnd;
+    match->captureCount = 0;
+
+    MatchState ms;
+    ms.pattern = pattern;
+    ms.match = match;
+    ms.depth = MAX_MATCH_DEPTH;
+    ms.error = NULL;
+    const char* result = doMatch(&ms, at, 0);
+    *error = ms.error;
+    return ms.error != NULL ? NULL : result;
+}
+
+/* ========== Pattern Cache ========== */
+
+void initPatternCache(PatternCache* cache) {
+    for (int i = 0; i < PATTERN_CACHE_SIZE; i++) {
+        cache->entries[i].source = NULL;
+        cache->entries[i].anchorable = true;
+        cache->entries[i].pattern = NULL;
+    }
+}
+
+void freePatternCache(PatternCache* cache) {
+    for (int i = 0; i < PATTERN_CACHE_SIZE; i++) free(cache->entries[i].pattern);
+    initPatternCache(cache);
+}
+
+/*
+ * Entries hold their pattern string weakly. A string that is about to be
+ * freed takes its entry with it, so a new string allocated at the same
+ * address never finds a stale program.
+ */
+void removeWhitePatterns(PatternCache* cache) {
+    for (int i = 0; i < PATTERN_CACHE_SIZE; i++) {
+        PatternCacheEntry* entry = &cache->entries[i];
+        if (entry->source != NULL && !entry->source->obj.isMarked) {
+            free(entry->pattern);
+            entry->source = NULL;
+            entry->pattern = NULL;
+        }
+    }
+}
+
+const Pattern* getPattern(PatternCache* cache, ObjString* source, bool anchorable,
+                          const char** error) {
+    PatternCacheEntry* entry =
+        &cache->entries[((uintptr_t)source >> 4) % PATTERN_CACHE_SIZE];
+    if (entry->source == source && entry->anchorable == anchorable) return entry->pattern;
+
+    Pattern* pattern = compilePattern(source->chars, source->length, anchorable, error);
+    if (pattern == NULL) return NULL;  // Malformed patterns are not cached
+
+    free(entry->pattern);
+    entry->source = source;
+    entry->anchorable = anchorable;
+    entry->pattern = pattern;
+    return pattern;
+}
@@ -0,0 +1,76 @@
+/*
+ * pattern.h - Lua pattern matching
+ *
+ * Lua 5.4 patterns (character classes, sets, the * + - ? quantifiers,
+ * captures, %b, %f and back-references) for string.find, match, gmatch
+ * and gsub. A pattern is compiled once into a flat list of items, each
+ * single-character matcher a 256-bit set, so matching never re-parses it.
+ * Compiled patterns are cached per pattern string object: a loop reusing
+ * the same literal compiles it only on the first iteration.
+ */
+
+#ifndef luapp_pattern_h
+#define luapp_pattern_h
+
+#include "value.h"
+
+#define PATTERN_MAX_CAPTURES 32
+#define PATTERN_CACHE_SIZE 64   // Direct-mapped, by pattern string address
+
+typedef struct Pattern Pattern;
+
+/* Capture spans of one successful match */
+#define CAPTURE_POSITION (-2)   // A () capture: 'start' is the position
+
+typedef struct {
+    const char* start;
+    int length;                 // Or CAPTURE_POSITION
+} Capture;
+
+typedef struct {
+    const char* subject;        // Whole subject (for positions and %f)
+    const char* subjectEnd;
+    int captureCount;
+    Capture captures[PATTERN_MAX_CAPTURES];
+} Match;
+
+typedef struct {
+    ObjString* source;          // Not a GC root: see removeWhitePatterns()
+    bool anchorable;            // As passed to getPattern()
+    Pattern* pattern;
+} PatternCacheEntry;
+
+typedef struct {
+    PatternCacheEntry entries[PATTERN_CACHE_SIZE];
+} PatternCache;
+
+void initPatternCache(PatternCache* cache);
+void freePatternCache(PatternCache* cache);
+
+/* Drop entries whose pattern string is about to be swept */
+void removeWhitePatterns(PatternCache* cache);
+
+/*
+ * The compiled form of source, from the cache or compiled now. Returns
+ * NULL for a malformed pattern, with *error describing it. Unless
+ * anchorable, a leading '^' is an ordinary character (string.gmatch).
+ */
+const Pattern* getPattern(PatternCache* cache, ObjString* source, bool anchorable,
+                          const char** error);
+
+/* Whether the pattern starts with '^' (matches only at the start position) */
+bool patternAnchored(const Pattern* pattern);
+
+/* Number of explicit captures in the pattern */
+int patternCaptureCount(const Pattern* pattern);
+
+/*
+ * Match the pattern at exactly 'at' in the subject. Returns the end of
+ * the match, or NULL; *error is set (and NULL returned) if matching
+ * needed more nesting than allowed.
+ */
+const char* matchPattern(const Pattern* pattern, const char* subject,
+                         const char* subjectEnd, const char* at,
+                         Match* match, const char** error);
+
+#endif
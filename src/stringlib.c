@@ -0,0 +1,797 @@
+/*
+ * stringlib.c - Native string library
+ *
+ * Replaces the old pure-script stdlib/string.luapp, which built every
+ * result one character at a time with '..'. Positions follow Lua: they
+ * start at 1, and negative ones count back from the end of the string.
+ * As with the other natives, bad arguments make a function return nil.
+ */
+
+#include "stringlib.h"
+#include "number.h"
+#include "objtable.h"
+#include "pattern.h"
+#include "vm.h"
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <string.h>
+
+/* ========== Argument Helpers ========== */
+
+/* First position of a range: 1-based, negatives from the end, clamped to 1 */
+static long long startPosition(long long position, long long length) {
+    if (position > 0) return position;
+    if (position == 0 || position < -length) return 1;
+    return length + position + 1;
+}
+
+/* Last position of a range, clamped to the string */
+static long long endPosition(long long position, long long length) {
+    if (position > length) return length;
+    if (position >= 0) return position;
+    if (position < -length) return 0;
+    return length + position + 1;
+}
+
+/* ========== Result Strings ========== */
+
+/*
+ * A result whose length is known up front. A long one is written straight
+ * into a new (uninterned) string; a short one goes through a stack buffer
+ * so that an existing interned copy is reused. Fetch every source string
+ * (stringView may flatten a rope) before beginResult: nothing roots the
+ * new string until it is returned.
+ */
+typedef struct {
+    ObjString* string;
+    char small[INTERN_MAX_LENGTH];
+    int length;
+} Result;
+
+static char* beginResult(Result* result, int length) {
+    result->length = length;
+    if (length > INTERN_MAX_LENGTH) {
+        result->string = allocateLongString(length);
+        return result->string->chars;
+    }
+    result->string = NULL;
+    return result->small;
+}
+
+static Value endResult(Result* result) {
+    if (result->string != NULL) return OBJ_VAL(result->string);
+    return OBJ_VAL(copyString(result->small, result->length));
+}
+
+/* Scratch space for results of unknown length (string.format) */
+typedef struct {
+    char* chars;
+    int length;
+    int capacity;
+} Buffer;
+
+static void reserveBuffer(Buffer* buffer, int count) {
+    if (buffer->length + count <= buffer->capacity) return;
+    int capacity = buffer->capacity < 64 ? 64 : buffer->capacity;
+    while (capacity < buffer->length + count) capacity *= 2;
+    buffer->chars = (char*)realloc(buffer->chars, capacity);
+    if (buffer->chars == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    buffer->capacity = capacity;
+}
+
+static void appendBuffer(Buffer* buffer, const char* chars, int length) {
+    if (length == 0) return;
+    reserveBuffer(buffer, length);
+    memcpy(buffer->chars + buffer->length, chars, length);
+    buffer->length += length;
+}
+
+static void appendFormatted(Buffer* buffer, const char* spec, ...) {
+    va_list args;
+    va_start(args, spec);
+    int length = vsnprintf(NULL, 0, spec, args);
+    va_end(args);
+
+    reserveBuffer(buffer, length + 1);
+    va_start(args, spec);
+    vsnprintf(buffer->chars + buffer->length, length + 1, spec, args);
+    va_end(args);
+    buffer->length += length;
+}
+
+/* ========== Searching ========== */
+
+/*
+ * First occurrence of needle in haystack, or NULL. memchr (vectorised in
+ * any serious libc) skips to candidate first bytes, so only those are
+ * compared in full.
+ */
+static const char* findPlain(const char* haystack, size_t length,
+                             const char* needle, size_t needleLength) {
+    if (needleLength == 0) return haystack;
+    if (needleLength > length) return NULL;
+
+    const char* last = haystack + (length - needleLength);
+    const char* cursor = haystack;
+    while (cursor <= last) {
+        cursor = (const char*)memchr(cursor, needle[0], (size_t)(last - cursor) + 1);
+        if (cursor == NULL) return NULL;
+        if (memcmp(cursor + 1, needle + 1, needleLength - 1) == 0) return cursor;
+        cursor++;
+    }
+    return NULL;
+}
+
+/* ========== Library Functions ========== */
+
+/* string.len(s) */
+static Value lenNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return NIL_VAL;
+    return NUMBER_VAL(stringLength(args[0]));
+}
+
+/* string.sub(s, i [, j]) - characters i through j (default: to the end) */
+static Value subNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_STRING(args[0])) return NIL_VAL;
+    long long i, j;
+    if (!optInteger(argCount, args, 1, 1, &i)) return NIL_VAL;
+    if (!optInteger(argCount, args, 2, -1, &j)) return NIL_VAL;
+
+    StringView string = stringView(args[0]);
+    i = startPosition(i, string.length);
+    j = endPosition(j, string.length);
+    if (i > j) return OBJ_VAL(copyString("", 0));
+    if (i == 1 && j == string.length) return args[0];
+
+    // A long piece shares the subject's characters instead of copying them
+    return substringValue(string.base, string.chars + i - 1, (int)(j - i + 1));
+}
+
+/* string.byte(s [, i [, j]]) - codes of characters i through j (default: i) */
+static Value byteNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return NIL_VAL;
+    long long i, j;
+    if (!optInteger(argCount, args, 1, 1, &i)) return NIL_VAL;
+    if (!optInteger(argCount, args, 2, i, &j)) return NIL_VAL;
+
+    StringView string = stringView(args[0]);
+    i = startPosition(i, string.length);
+    j = endPosition(j, string.length);
+    if (i > j) return NIL_VAL;
+
+    // Codes after the first are extra results, pushed past the arguments
+    int count = (int)(j - i + 1);
+    if (!reserveStack(count - 1)) return NIL_VAL;
+    const unsigned char* chars = (const unsigned char*)string.chars + i - 1;
+    for (int k = 1; k < count; k++) push(NUMBER_VAL(chars[k]));
+    return NUMBER_VAL(chars[0]);
+}
+
+/* string.char(...) - string of the given character codes */
+static Value charNative(int argCount, Value* args) {
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) return NIL_VAL;
+        double code = AS_NUMBER(args[i]);
+        if (code < 0 || code > UCHAR_MAX) return NIL_VAL;
+    }
+
+    Result result;
+    char* chars = beginResult(&result, argCount);
+    for (int i = 0; i < argCount; i++) {
+        chars[i] = (char)(unsigned char)AS_NUMBER(args[i]);
+    }
+    return endResult(&result);
+}
+
+/* string.rep(s, n [, sep]) - n copies of s, separated by sep */
+static Value repNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_STRING(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
+    if (argCount > 2 && !IS_NIL(args[2]) && !IS_STRING(args[2])) return NIL_VAL;
+
+    long long n = (long long)AS_NUMBER(args[1]);
+    if (n <= 0) return OBJ_VAL(copyString("", 0));
+
+    StringView string = stringView(args[0]);
+    StringView separator = {NULL, "", 0};
+    if (argCount > 2 && !IS_NIL(args[2])) separator = stringView(args[2]);
+    long long sepLength = separator.length;
+    if ((double)n * (string.length + sepLength) > INT_MAX) return NIL_VAL;  // Too large
+    long long total = n * string.length + (n - 1) * sepLength;
+
+    Result result;
+    char* chars = beginResult(&result, (int)total);
+    for (long long k = 0; k < n; k++) {
+        if (k > 0 && sepLength > 0) {
+            memcpy(chars, separator.chars, (size_t)sepLength);
+            chars += sepLength;
+        }
+        memcpy(chars, string.chars, string.length);
+        chars += string.length;
+    }
+    return endResult(&result);
+}
+
+static Value mapChars(int argCount, Value* args, int (*map)(int)) {
+    if (argCount < 1 || !IS_STRING(args[0])) return NIL_VAL;
+    StringView string = stringView(args[0]);
+
+    Result result;
+    char* chars = beginResult(&result, string.length);
+    for (int i = 0; i < string.length; i++) {
+        chars[i] = (char)map((unsigned char)string.chars[i]);
+    }
+    return endResult(&result);
+}
+
+/* string.upper(s) */
+static Value upperNative(int argCount, Value* args) {
+    return mapChars(argCount, args, toupper);
+}
+
+/* string.lower(s) */
+static Value lowerNative(int argCount, Value* args) {
+    return mapChars(argCount, args, tolower);
+}
+
+/* string.reverse(s) */
+static Value reverseNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return NIL_VAL;
+    StringView string = stringView(args[0]);
+
+    Result result;
+    char* chars = beginResult(&result, string.length);
+    for (int i = 0; i < string.length; i++) {
+        chars[i] = string.chars[string.length - 1 - i];
+    }
+    return endResult(&result);
+}
+
+/* ========== Pattern Matching ========== */
+
+/* Whether a pattern has no magic characters, so a plain search will do */
+static bool isPlainPattern(ObjString* pattern) {
+    for (int i = 0; i < pattern->length; i++) {
+        char c = pattern->chars[i];
+        if (c != '\0' && strchr("^$*+?.([%-", c) != NULL) return false;
+    }
+    return true;
+}
+
+/* The compiled pattern string, or NULL after raising an error */
+static const Pattern* compiledPatternAs(ObjString* source, bool anchorable) {
+    const char* error;
+    const Pattern* pattern = getPattern(&vm.patternCache, source, anchorable, &error);
+    if (pattern == NULL) runtimeError("Bad pattern '%s': %s.", source->chars, error);
+    return pattern;
+}
+
+static const Pattern* compiledPattern(ObjString* source) {
+    return compiledPatternAs(source, true);
+}
+
+/*
+ * Capture i of a match, or the whole match when the pattern has none.
+ * subject owns the matched characters; a long capture is a slice of it.
+ */
+static Value captureValue(ObjString* subject, Match* match, int i,
+                          const char* start, const char* end) {
+    if (match->captureCount == 0) return substringValue(subject, start, (int)(end - start));
+    Capture* capture = &match->captures[i];
+    if (capture->length == CAPTURE_POSITION) {
+        return NUMBER_VAL((double)(capture->start - match->subject + 1));
+    }
+    return substringValue(subject, capture->start, capture->length);
+}
+
+/* Push every capture (or the whole match); returns how many */
+static int pushCaptures(ObjString* subject, Match* match, const char* start,
+                        const char* end, bool wholeIfNone) {
+    int count = match->captureCount;
+    if (count == 0 && wholeIfNone) count = 1;
+    if (!reserveStack(count)) return -1;
+    for (int i = 0; i < count; i++) push(captureValue(subject, match, i, start, end));
+    return count;
+}
+
+/* Hand back the top count stack values as a native's results */
+static Value returnPushed(int count) {
+    Value first = vm.stackTop[-count];
+    memmove(vm.stackTop - count, vm.stackTop - count + 1, sizeof(Value) * (count - 1));
+    vm.stackTop--;
+    return first;
+}
+
+/*
+ * Shared by find and match: the first match at or after init. find gives
+ * its start and end positions, then any captures; match gives the
+ * captures, or the whole match.
+ */
+static Value findOrMatch(int argCount, Value* args, bool find) {
+    if (argCount < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    long long init;
+    if (!optInteger(argCount, args, 2, 1, &init)) return NIL_VAL;
+    bool plain = argCount > 3 && !IS_NIL(args[3]) &&
+                 !(IS_BOOL(args[3]) && !AS_BOOL(args[3]));
+
+    StringView string = stringView(args[0]);
+    ObjString* patternString = AS_STRING(args[1]);
+    init = startPosition(init, string.length);
+    if (init > (long long)string.length + 1) return NIL_VAL;
+
+    const char* subject = string.chars;
+    const char* subjectEnd = subject + string.length;
+
+    if (find && (plain || isPlainPattern(patternString))) {
+        const char* found = findPlain(subject + init - 1, (size_t)(string.length - init + 1),
+                                      patternString->chars, patternString->length);
+        if (found == NULL) return NIL_VAL;
+
+        int start = (int)(found - subject) + 1;
+        if (!reserveStack(1)) return NIL_VAL;
+        push(NUMBER_VAL(start + patternString->length - 1));
+        return NUMBER_VAL(start);
+    }
+
+    const Pattern* pattern = compiledPattern(patternString);
+    if (pattern == NULL) return NIL_VAL;
+
+    const char* s = subject + init - 1;
+    do {
+        Match match;
+        const char* error;
+        const char* end = matchPattern(pattern, subject, subjectEnd, s, &match, &error);
+        if (error != NULL) {
+            runtimeError("Bad pattern '%s': %s.", patternString->chars, error);
+            return NIL_VAL;
+        }
+        if (end == NULL) continue;
+
+        if (!find) {
+            int count = pushCaptures(string.base, &match, s, end, true);
+            return count < 0 ? NIL_VAL : returnPushed(count);
+        }
+        if (!reserveStack(2)) return NIL_VAL;
+        push(NUMBER_VAL((double)(s - subject + 1)));
+        push(NUMBER_VAL((double)(end - subject)));
+        int count = pushCaptures(string.base, &match, s, end, false);
+        return count < 0 ? NIL_VAL : returnPushed(count + 2);
+    } while (s++ < subjectEnd && !patternAnchored(pattern));
+
+    return NIL_VAL;
+}
+
+/*
+ * string.find(s, pattern [, init [, plain]]) - start and end positions of
+ * the first match at or after init, then its captures, or nil. A pattern
+ * without magic characters (or plain = true) is searched for literally.
+ */
+static Value findNative(int argCount, Value* args) {
+    return findOrMatch(argCount, args, true);
+}
+
+/* string.match(s, pattern [, init]) - captures of the first match, or nil */
+static Value matchNative(int argCount, Value* args) {
+    return findOrMatch(argCount, args, false);
+}
+
+/*
+ * A gmatch iterator keeps its subject, pattern and progress in an array
+ * table, as the native's state.
+ */
+enum { GMATCH_SUBJECT, GMATCH_PATTERN, GMATCH_POSITION, GMATCH_LAST_END };
+
+static Value gmatchStep(int argCount, Value* args) {
+    (void)argCount;
+    ObjTable* state = AS_TABLE(((ObjNative*)AS_OBJ(args[-1]))->state);
+    Value* fields = state->array.values;
+    StringView string = stringView(fields[GMATCH_SUBJECT]);
+    ObjString* patternString = AS_STRING(fields[GMATCH_PATTERN]);
+
+    // Re-fetched on every step: the loop body may have evicted it
+    const Pattern* pattern = compiledPatternAs(patternString, false);
+    if (pattern == NULL) return NIL_VAL;
+
+    const char* subject = string.chars;
+    const char* subjectEnd = subject + string.length;
+    int lastEnd = (int)AS_NUMBER(fields[GMATCH_LAST_END]);
+    for (const char* s = subject + (int)AS_NUMBER(fields[GMATCH_POSITION]);
+         s <= subjectEnd; s++) {
+        Match match;
+        const char* error;
+        const char* end = matchPattern(pattern, subject, subjectEnd, s, &match, &error);
+        if (error != NULL) {
+            runtimeError("Bad pattern '%s': %s.", patternString->chars, error);
+            return NIL_VAL;
+        }
+        // An empty match right where the previous one ended is skipped
+        if (end != NULL && end - subject != lastEnd) {
+            fields[GMATCH_POSITION] = NUMBER_VAL((double)(end - subject));
+            fields[GMATCH_LAST_END] = fields[GMATCH_POSITION];
+            int count = pushCaptures(string.base, &match, s, end, true);
+            return count < 0 ? NIL_VAL : returnPushed(count);
+        }
+    }
+
+    fields[GMATCH_POSITION] = NUMBER_VAL(string.length + 1);
+    return NIL_VAL;
+}
+
+/*
+ * string.gmatch(s, pattern [, init]) - an iterator over the matches, for
+ * use in a for-in loop: for word in string.gmatch(text, "%a+") do ... end.
+ * As in Lua 5.4, a leading '^' is matched as an ordinary character here.
+ */
+static Value gmatchNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    long long init;
+    if (!optInteger(argCount, args, 2, 1, &init)) return NIL_VAL;
+
+    int length = stringLength(args[0]);
+    ObjString* patternString = AS_STRING(args[1]);
+    if (compiledPatternAs(patternString, false) == NULL) return NIL_VAL;  // Report it now
+    init = startPosition(init, length);
+    if (init > (long long)length + 1) init = length + 1;
+
+    ObjTable* state = newTable();
+    push(OBJ_VAL(state));
+    writeValueArray(&state->array, args[0]);   // A slice subject stays a slice
+    writeValueArray(&state->array, OBJ_VAL(patternString));
+    writeValueArray(&state->array, NUMBER_VAL((double)(init - 1)));
+    writeValueArray(&state->array, NUMBER_VAL(-1));
+
+    ObjNative* iterator = newNative(gmatchStep, NULL);
+    iterator->state = OBJ_VAL(state);
+    pop();
+    return OBJ_VAL(iterator);
+}
+
+/* gsub: append a replacement value (string or number); false if unusable */
+static bool appendReplacement(Buffer* buffer, Value value, const char* start, const char* end) {
+    if (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value))) {
+        appendBuffer(buffer, start, (int)(end - start));  // Keep the match
+    } else if (IS_STRING(value)) {
+        StringView string = stringView(value);
+        appendBuffer(buffer, string.chars, string.length);
+    } else if (IS_NUMBER(value)) {
+        char number[NUMBER_BUFFER_SIZE];
+        appendBuffer(buffer, number, formatNumber(AS_NUMBER(value), number));
+    } else {
+        runtimeError("Invalid replacement value (not a string or number).");
+        return false;
+    }
+    return true;
+}
+
+/* gsub: expand %0-%9 and %% in a replacement string */
+static bool appendTemplate(Buffer* buffer, ObjString* template, Match* match,
+                           const char* start, const char* end) {
+    const char* p = template->chars;
+    const char* templateEnd = p + template->length;
+    while (p < templateEnd) {
+        const char* percent = (const char*)memchr(p, '%', (size_t)(templateEnd - p));
+        if (percent == NULL) percent = templateEnd;
+        appendBuffer(buffer, p, (int)(percent - p));
+        if (percent == templateEnd) break;
+
+        p = percent + 1;
+        if (p < templateEnd && *p == '%') {
+            appendBuffer(buffer, "%", 1);
+        } else if (p < templateEnd && *p == '0') {
+            appendBuffer(buffer, start, (int)(end - start));
+        } else if (p < templateEnd && *p >= '1' && *p <= '9' &&
+                   (*p - '1' < match->captureCount || (*p == '1' && match->captureCount == 0))) {
+            if (match->captureCount == 0) {
+                appendBuffer(buffer, start, (int)(end - start));
+            } else {
+                Capture* capture = &match->captures[*p - '1'];
+                if (capture->length == CAPTURE_POSITION) {
+                    appendFormatted(buffer, "%d", (int)(capture->start - match->subject + 1));
+                } else {
+                    appendBuffer(buffer, capture->start, capture->length);
+                }
+            }
+        } else {
+            runtimeError("Invalid use of '%%' in replacement string.");
+            return false;
+        }
+        p++;
+    }
+    return true;
+}
+
+/*
+ * string.gsub(s, pattern, repl [, n]) - s with (the first n) matches
+ * replaced, and the number of matches. repl is a string (%0-%9 insert
+ * captures), a table indexed by the first capture, or a function called
+ * with the captures; a nil or false lookup/result keeps the match.
+ */
+static Value gsubNative(int argCount, Value* args) {
+    if (argCount < 3 || !IS_STRING(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    Value replacement = args[2];
+    if (!IS_STRING(replacement) && !IS_NUMBER(replacement) && !IS_TABLE(replacement) &&
+        !IS_CLOSURE(replacement) && !IS_NATIVE(replacement) &&
+        !IS_BOUND_METHOD(replacement)) {
+        return NIL_VAL;
+    }
+    long long maxCount;
+    if (!optInteger(argCount, args, 3, LLONG_MAX, &maxCount)) return NIL_VAL;
+
+    // args is not used past here: callbacks may move the stack, though
+    // every argument stays rooted in its slot
+    StringView string = stringView(args[0]);
+    ObjString* patternString = AS_STRING(args[1]);
+    if (IS_NUMBER(replacement)) {
+        char number[NUMBER_BUFFER_SIZE];
+        int length = formatNumber(AS_NUMBER(replacement), number);
+        replacement = OBJ_VAL(copyString(number, length));
+        args[2] = replacement;
+    }
+    const Pattern* pattern = compiledPattern(patternString);
+    if (pattern == NULL) return NIL_VAL;
+    bool anchored = patternAnchored(pattern);
+
+    // A callback may materialize a slice subject, which then drops its
+    // parent: keep the characters being matched reachable until the end
+    if (!reserveStack(1)) return NIL_VAL;
+    push(OBJ_VAL(string.base));
+
+    const char* subject = string.chars;
+    const char* subjectEnd = subject + string.length;
+    const char* s = subject;
+    const char* lastEnd = NULL;
+    long long count = 0;
+    Buffer buffer = {NULL, 0, 0};
+
+    while (count < maxCount) {
+        Match match;
+        const char* error;
+        const char* end = matchPattern(pattern, subject, subjectEnd, s, &match, &error);
+        if (error != NULL) {
+            runtimeError("Bad pattern '%s': %s.", patternString->chars, error);
+            goto fail;
+        }
+
+        if (end != NULL && end != lastEnd) {
+            count++;
+            if (IS_STRING(replacement)) {
+                if (!appendTemplate(&buffer, AS_STRING(replacement), &match, s, end)) goto fail;
+            } else if (IS_TABLE(replacement)) {
+                Value key = captureValue(string.base, &match, 0, s, end);
+                Value value = objTableGet(AS_TABLE(replacement), key);
+                if (!appendReplacement(&buffer, value, s, end)) goto fail;
+            } else {
+                if (!reserveStack(1)) goto fail;
+                push(replacement);
+                int captures = pushCaptures(string.base, &match, s, end, true);
+                if (captures < 0) goto fail;
+                if (!callFunction(captures, 1)) goto fail;
+                Value value = pop();
+                push(value);  // Rooted while it is appended
+                bool appended = appendReplacement(&buffer, value, s, end);
+                pop();
+                if (!appended) goto fail;
+                // The callback may have evicted the compiled pattern
+                pattern = compiledPattern(patternString);
+                if (pattern == NULL) goto fail;
+            }
+            s = lastEnd = end;
+        } else if (s < subjectEnd) {
+            appendBuffer(&buffer, s++, 1);
+        } else {
+            break;
+        }
+        if (anchored) break;
+    }
+    appendBuffer(&buffer, s, (int)(subjectEnd - s));
+
+    Value result = OBJ_VAL(copyString(buffer.chars != NULL ? buffer.chars : "", buffer.length));
+    free(buffer.chars);
+    pop();  // The subject's base; result needs no rooting until we return
+    push(NUMBER_VAL((double)count));
+    return result;
+
+fail:
+    free(buffer.chars);
+    return NIL_VAL;
+}
+
+/* string.startswith(s, prefix) */
+static Value startswithNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    StringView string = stringView(args[0]);
+    StringView prefix = stringView(args[1]);
+    return BOOL_VAL(prefix.length <= string.length &&
+                    memcmp(string.chars, prefix.chars, prefix.length) == 0);
+}
+
+/* string.endswith(s, suffix) */
+static Value endswithNative(int argCount, Value* args) {
+    if (argCount < 2 || !IS_STRING(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    StringView string = stringView(args[0]);
+    StringView suffix = stringView(args[1]);
+    return BOOL_VAL(suffix.length <= string.length &&
+                    memcmp(string.chars + string.length - suffix.length,
+                           suffix.chars, suffix.length) == 0);
+}
+
+/* string.trim(s) - s without leading and trailing whitespace */
+static Value trimNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return NIL_VAL;
+    StringView string = stringView(args[0]);
+
+    int start = 0;
+    int end = string.length;
+    while (start < end && isspace((unsigned char)string.chars[start])) start++;
+    while (end > start && isspace((unsigned char)string.chars[end - 1])) end--;
+    if (start == 0 && end == string.length) return args[0];
+    return substringValue(string.base, string.chars + start, end - start);
+}
+
+/* %q: a string literal that reads back as the same string */
+static void appendQuoted(Buffer* buffer, ObjString* string) {
+    appendBuffer(buffer, "\"", 1);
+    for (int i = 0; i < string->length; i++) {
+        unsigned char c = (unsigned char)string->chars[i];
+        if (c == '"' || c == '\\') {
+            char escaped[2] = {'\\', (char)c};
+            appendBuffer(buffer, escaped, 2);
+        } else if (c == '\n') {
+            appendBuffer(buffer, "\\n", 2);
+        } else if (c == '\r') {
+            appendBuffer(buffer, "\\r", 2);
+        } else if (c == '\t') {
+            appendBuffer(buffer, "\\t", 2);
+        } else if (iscntrl(c)) {
+            // Three digits when a digit follows, so it is not read as part
+            bool digitNext = i + 1 < string->length && isdigit((unsigned char)string->chars[i + 1]);
+            appendFormatted(buffer, digitNext ? "\\%03d" : "\\%d", c);
+        } else {
+            appendBuffer(buffer, (const char*)&c, 1);
+        }
+    }
+    appendBuffer(buffer, "\"", 1);
+}
+
+/* %s of a non-string, spelled as tostring() would */
+static const char* plainName(Value value, char* number) {
+    if (IS_NUMBER(value)) {
+        formatNumber(AS_NUMBER(value), number);
+        return number;
+    }
+    if (IS_BOOL(value)) return AS_BOOL(value) ? "true" : "false";
+    if (IS_NIL(value)) return "nil";
+    return "<object>";
+}
+
+/*
+ * Copy one conversion spec ("%-8.3f") from format into spec, C style.
+ * Flags, a width and a precision of up to two digits each are allowed,
+ * as in Lua. Returns the conversion character, or 0 if malformed.
+ */
+static char readSpec(const char** format, char* spec) {
+    const char* start = *format;  // At the '%'
+    const char* p = start + 1;
+    while (*p != '\0' && strchr("-+ #0", *p) != NULL && p - start <= 5) p++;
+    if (isdigit((unsigned char)*p)) p++;
+    if (isdigit((unsigned char)*p)) p++;
+    if (*p == '.') {
+        p++;
+        if (isdigit((unsigned char)*p)) p++;
+        if (isdigit((unsigned char)*p)) p++;
+    }
+    if (*p == '\0' || isdigit((unsigned char)*p)) return 0;
+
+    int length = (int)(p - start) + 1;
+    memcpy(spec, start, length);
+    spec[length] = '\0';
+    *format = p + 1;
+    return *p;
+}
+
+/* string.format(fmt, ...) - printf-style formatting */
+static Value formatNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_STRING(args[0])) return NIL_VAL;
+    ObjString* formatString = AS_STRING(args[0]);
+    const char* format = formatString->chars;
+    const char* end = format + formatString->length;
+
+    Buffer buffer = {NULL, 0, 0};
+    int arg = 1;
+    while (format < end) {
+        const char* percent = (const char*)memchr(format, '%', (size_t)(end - format));
+        if (percent == NULL) percent = end;
+        appendBuffer(&buffer, format, (int)(percent - format));
+        format = percent;
+        if (format == end) break;
+
+        if (format[1] == '%') {
+            appendBuffer(&buffer, "%", 1);
+            format += 2;
+            continue;
+        }
+
+        char spec[32];  // '%', flags, width, precision and the 'll' added below
+        char conversion = readSpec(&format, spec);
+        if (conversion == 0 || arg >= argCount) goto fail;
+        Value value = args[arg++];
+        int specLength = (int)strlen(spec);
+
+        switch (conversion) {
+            case 'd': case 'i': case 'x': case 'X': case 'o': case 'c': {
+                if (!IS_NUMBER(value)) goto fail;
+                if (conversion == 'c') {
+                    appendFormatted(&buffer, spec, (int)AS_NUMBER(value));
+                    break;
+                }
+                // Widen to long long: numbers are doubles, not C ints
+                spec[specLength - 1] = 'l';
+                spec[specLength] = 'l';
+                spec[specLength + 1] = conversion;
+                spec[specLength + 2] = '\0';
+                appendFormatted(&buffer, spec, (long long)AS_NUMBER(value));
+                break;
+            }
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+            case 'a': case 'A':
+                if (!IS_NUMBER(value)) goto fail;
+                appendFormatted(&buffer, spec, AS_NUMBER(value));
+                break;
+            case 'q':
+                if (!IS_STRING(value)) goto fail;
+                appendQuoted(&buffer, AS_STRING(value));
+                break;
+            case 's': {
+                char number[NUMBER_BUFFER_SIZE];
+                if (specLength == 2 && IS_STRING(value)) {
+                    StringView string = stringView(value);
+                    appendBuffer(&buffer, string.chars, string.length);
+                } else if (IS_STRING(value)) {
+                    appendFormatted(&buffer, spec, AS_CSTRING(value));
+                } else {
+                    appendFormatted(&buffer, spec, plainName(value, number));
+                }
+                break;
+            }
+            default:
+                goto fail;
+        }
+    }
+
+    Value result = OBJ_VAL(copyString(buffer.chars != NULL ? buffer.chars : "", buffer.length));
+    free(buffer.chars);
+    return result;
+
+fail:
+    free(buffer.chars);
+    return NIL_VAL;
+}
+
+/* ========== Registration ========== */
+
+static const LibFunction stringFunctions[] = {
+    {"len", lenNative},
+    {"sub", subNative},
+    {"byte", byteNative},
+    {"char", charNative},
+    {"rep", repNative},
+    {"upper", upperNative},
+    {"lower", lowerNative},
+    {"reverse", reverseNative},
+    {"find", findNative},
+    {"match", matchNative},
+    {"gmatch", gmatchNative},
+    {"gsub", gsubNative},
+    {"format", formatNative},
+    {"startswith", startswithNative},
+    {"endswith", endswithNative},
+    {"trim", trimNative},
+    {NULL, NULL}
+};
+
+ObjTable* openStringLib(void) {
+    return openLib("string", stringFunctions);
+}
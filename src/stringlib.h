@@ -0,0 +1,18 @@
+/*
+ * stringlib.h - Native string library
+ *
+ * The 'string' table (string.sub, string.find, string.format, ...) is
+ * built in C when the VM starts. It is also what require("string")
+ * returns, and it supplies methods for string receivers: s:upper() is
+ * string.upper(s).
+ */
+
+#ifndef luapp_stringlib_h
+#define luapp_stringlib_h
+
+#include "object.h"
+
+/* Build the library, define the 'string' global and register the module */
+ObjTable* openStringLib(void);
+
+#endif
@@ -1,5 +1,14 @@
 /*
- * table.c - Hash table implementation
+ * table.c - Hash table implementation (see table.h)
+ *
+ * Slots come in groups of TABLE_GROUP_WIDTH. A key's hash picks its
+ * first group (the bits above the low 7) and the low 7 bits are its
+ * fragment, stored in the slot's control byte. Probing visits groups in
+ * triangular order (g, g+1, g+3, g+6, ...), which covers every group of
+ * a power-of-two count; it stops at the first group with an empty slot.
+ *
+ * A table smaller than one group pads its control bytes out to a full
+ * group with sentinels, which match neither a fragment nor a free slot.
  */
 
 #include "table.h"
@@ -7,102 +16,278 @@
 #include "object.h"
 #include <string.h>
 
-#define TABLE_MAX_LOAD 0.75
+#if defined(__SSE2__) && !defined(LUAPP_NO_SIMD)
+#include <emmintrin.h>
+#define TABLE_SSE2 1
+#else
+#define TABLE_SSE2 0
+#endif
+
+#define CONTROL_EMPTY    0x80
+#define CONTROL_DELETED  0xfe
+#define CONTROL_SENTINEL 0xff
+
+#define MIN_CAPACITY 8
+
+/* Bit i set for the i-th slot of a group */
+typedef uint32_t GroupMask;
+
+/* ========== Group Matching ========== */
+
+#if TABLE_SSE2
+
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)byte)));
+}
+
+/* Empty or deleted: as signed bytes, the only control values below -1 */
+static inline GroupMask matchFree(const uint8_t* group) {
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), control));
+}
+
+#else
+
+static inline GroupMask matchByte(const uint8_t* group, uint8_t byte) {
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+        mask |= (GroupMask)(group[i] == byte) << i;
+    }
+    return mask;
+}
+
+static inline GroupMask matchFree(const uint8_t* group) {
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_WIDTH; i++) {
+        mask |= (GroupMask)(group[i] == CONTROL_EMPTY || group[i] == CONTROL_DELETED) << i;
+    }
+    return mask;
+}
+
+#endif
+
+static inline GroupMask matchEmpty(const uint8_t* group) {
+    return matchByte(group, CONTROL_EMPTY);
+}
+
+static inline int lowestBit(GroupMask mask) {
+#if defined(__GNUC__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/* ========== Layout ========== */
+
+static inline uint8_t hashFragment(uint32_t hash) {
+    return (uint8_t)(hash & 0x7f);
+}
+
+static inline int groupMask(int capacity) {
+    return capacity <= TABLE_GROUP_WIDTH ? 0 : capacity / TABLE_GROUP_WIDTH - 1;
+}
+
+static inline int controlSize(int capacity) {
+    return capacity < TABLE_GROUP_WIDTH ? TABLE_GROUP_WIDTH : capacity;
+}
+
+/* Entries a table of this capacity holds before it rehashes: 7/8 full */
+static inline int maxLoad(int capacity) {
+    return capacity - capacity / 8;
+}
 
 void initTable(Table* table) {
     table->count = 0;
     table->capacity = 0;
+    table->growthLeft = 0;
+    table->control = NULL;
     table->entries = NULL;
 }
 
 void freeTable(Table* table) {
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    if (table->capacity > 0) {
+        FREE_ARRAY(uint8_t, table->control, controlSize(table->capacity));
+        FREE_ARRAY(Entry, table->entries, table->capacity);
+    }
     initTable(table);
 }
 
-/* Find entry slot for key (or empty slot for insertion) */
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash & (capacity - 1);  // capacity is power of 2
-    Entry* tombstone = NULL;
-    
-    for (;;) {
-        Entry* entry = &entries[index];
-        
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty slot - return tombstone if we passed one
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // Tombstone
-                if (tombstone == NULL) tombstone = entry;
+/* ========== Probing ========== */
+
+/* Slot holding key, or -1 */
+static int findIndex(Table* table, ObjString* key, uint32_t hash) {
+    uint8_t fragment = hashFragment(hash);
+    int mask = groupMask(table->capacity);
+    int group = (int)(hash >> 7) & mask;
+    for (int step = 1;; step++) {
+        const uint8_t* control = table->control + group * TABLE_GROUP_WIDTH;
+        for (GroupMask match = matchByte(control, fragment); match != 0; match &= match - 1) {
+            int index = group * TABLE_GROUP_WIDTH + lowestBit(match);
+            ObjString* candidate = table->entries[index].key;
+            // Short keys are interned, so only long ones ever need their
+            // characters compared
+            if (candidate == key || (!key->interned && stringsEqual(candidate, key))) {
+                return index;
             }
-        } else if (entry->key == key) {
-            // Found the key (pointer comparison works due to interning)
-            return entry;
         }
-        
-        index = (index + 1) & (capacity - 1);  // Linear probing
+        if (matchEmpty(control) != 0) return -1;
+        group = (group + step) & mask;
+    }
+}
+
+/* First empty or deleted slot on hash's probe sequence */
+static int findFree(Table* table, uint32_t hash) {
+    int mask = groupMask(table->capacity);
+    int group = (int)(hash >> 7) & mask;
+    for (int step = 1;; step++) {
+        GroupMask match = matchFree(table->control + group * TABLE_GROUP_WIDTH);
+        if (match != 0) return group * TABLE_GROUP_WIDTH + lowestBit(match);
+        group = (group + step) & mask;
     }
 }
 
-static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
+/* Store a key known to be absent into the free slot at index */
+static void fillSlot(Table* table, int index, ObjString* key, uint32_t hash, Value value) {
+    if (table->control[index] == CONTROL_EMPTY) table->growthLeft--;
+    table->control[index] = hashFragment(hash);
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    table->count++;
+}
+
+/*
+ * Empty the slot at index. If its group still has an empty slot, no
+ * probe has ever gone past the group, so the slot can simply become
+ * empty again; otherwise it must stay a tombstone (deleted) to keep
+ * later keys reachable.
+ */
+static void clearSlot(Table* table, int index) {
+    const uint8_t* group = table->control + (index & ~(TABLE_GROUP_WIDTH - 1));
+    if (matchEmpty(group) != 0) {
+        table->control[index] = CONTROL_EMPTY;
+        table->growthLeft++;
+    } else {
+        table->control[index] = CONTROL_DELETED;
+    }
+    table->entries[index].key = NULL;
+    table->entries[index].value = NIL_VAL;
+    table->count--;
+}
+
+/* Rebuild with the given capacity, dropping tombstones */
+static void resize(Table* table, int capacity) {
+    Table resized;
+    resized.count = 0;
+    resized.capacity = capacity;
+    resized.growthLeft = maxLoad(capacity);
+    resized.control = ALLOCATE(uint8_t, controlSize(capacity));
+    resized.entries = ALLOCATE(Entry, capacity);
+    memset(resized.control, CONTROL_EMPTY, (size_t)capacity);
+    memset(resized.control + capacity, CONTROL_SENTINEL, (size_t)(controlSize(capacity) - capacity));
     for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
+        resized.entries[i].key = NULL;
+        resized.entries[i].value = NIL_VAL;
     }
-    
-    // Rehash existing entries
-    table->count = 0;
+
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if (entry->key == NULL) continue;
-        
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        uint32_t hash = stringHash(entry->key);
+        fillSlot(&resized, findFree(&resized, hash), entry->key, hash, entry->value);
+    }
+
+    freeTable(table);
+    *table = resized;
+}
+
+/*
+ * No empty slot may be used up: grow, or - when tombstones rather than
+ * live entries fill the table - rebuild at the same size.
+ */
+static void rehash(Table* table) {
+    if (table->capacity == 0) {
+        resize(table, MIN_CAPACITY);
+    } else if (table->count + 1 > maxLoad(table->capacity) / 2) {
+        int capacity = table->capacity * 2;
+        if (capacity < TABLE_GROUP_WIDTH) capacity = TABLE_GROUP_WIDTH;
+        resize(table, capacity);
+    } else {
+        resize(table, table->capacity);
+    }
+}
+
+/* Smallest capacity at which count entries fill at most half the load limit */
+static int fitCapacity(int count) {
+    int capacity = MIN_CAPACITY;
+    while (count > maxLoad(capacity) / 2) {
+        capacity = capacity < TABLE_GROUP_WIDTH ? TABLE_GROUP_WIDTH : capacity * 2;
     }
-    
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-    table->entries = entries;
-    table->capacity = capacity;
+    return capacity;
 }
 
+/*
+ * Shrink a table whose demand - its entries after a delete, or before a
+ * collection removed any - is below 1/8 of its capacity, and rebuild one
+ * whose tombstones outnumber its live entries. Sizing the intern table
+ * by its demand before the collection keeps it from shrinking only to
+ * grow back by the next one.
+ */
+static void compact(Table* table, int demand) {
+    int tombstones = maxLoad(table->capacity) - table->growthLeft - table->count;
+    if (table->capacity > MIN_CAPACITY && demand < table->capacity / 8) {
+        resize(table, fitCapacity(demand));
+    } else if (tombstones > table->count) {
+        resize(table, table->capacity);
+    }
+}
+
+/* ========== Access ========== */
+
 bool tableSet(Table* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    uint32_t hash = stringHash(key);
+    if (table->count > 0) {
+        int index = findIndex(table, key, hash);
+        if (index >= 0) {
+            table->entries[index].value = value;
+            return false;
+        }
+    }
+
+    if (table->capacity == 0) rehash(table);
+    int index = findFree(table, hash);
+    if (table->control[index] == CONTROL_EMPTY && table->growthLeft == 0) {
+        rehash(table);
+        index = findFree(table, hash);
     }
-    
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;  // Don't count tombstones
-    
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    fillSlot(table, index, key, hash, value);
+    return true;
 }
 
 bool tableGet(Table* table, ObjString* key, Value* value) {
     if (table->count == 0) return false;
-    
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
-    
-    *value = entry->value;
+
+    int index = findIndex(table, key, stringHash(key));
+    if (index < 0) return false;
+
+    *value = table->entries[index].value;
     return true;
 }
 
 bool tableDelete(Table* table, ObjString* key) {
     if (table->count == 0) return false;
-    
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
-    
-    // Place tombstone
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+
+    int index = findIndex(table, key, stringHash(key));
+    if (index < 0) return false;
+
+    clearSlot(table, index);
+    compact(table, table->count);
     return true;
 }
 
@@ -117,24 +302,26 @@ void tableAddAll(Table* from, Table* to) {
 
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
-    
-    uint32_t index = hash & (table->capacity - 1);
-    
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) return NULL;  // Empty non-tombstone
-        } else if (entry->key->length == length &&
-                   entry->key->hash == hash &&
-                   memcmp(entry->key->chars, chars, length) == 0) {
-            return entry->key;
+
+    uint8_t fragment = hashFragment(hash);
+    int mask = groupMask(table->capacity);
+    int group = (int)(hash >> 7) & mask;
+    for (int step = 1;; step++) {
+        const uint8_t* control = table->control + group * TABLE_GROUP_WIDTH;
+        for (GroupMask match = matchByte(control, fragment); match != 0; match &= match - 1) {
+            ObjString* key = table->entries[group * TABLE_GROUP_WIDTH + lowestBit(match)].key;
+            if (key->length == length && key->hash == hash &&
+                memcmp(key->chars, chars, length) == 0) {
+                return key;
+            }
         }
-        
-        index = (index + 1) & (table->capacity - 1);
+        if (matchEmpty(control) != 0) return NULL;
+        group = (group + step) & mask;
     }
 }
 
+/* ========== Garbage Collection ========== */
+
 void markTable(Table* table) {
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
@@ -144,10 +331,12 @@ void markTable(Table* table) {
 }
 
 void tableRemoveWhite(Table* table) {
+    int demand = table->count;
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
         if (entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
+            clearSlot(table, i);
         }
     }
+    compact(table, demand);
 }
@@ -2,7 +2,15 @@
  * table.h - Hash table for strings -> values
  * 
  * Used for globals, object fields, methods, and string interning.
- * Keys are always ObjString* (interned, so pointer comparison works).
+ * Keys are always ObjString*. Short ones are interned and compare by
+ * pointer; long ones are hashed on first use and compared by content.
+ *
+ * The layout is a Swiss table: beside the entries is one control byte
+ * per slot - empty, deleted, or the low 7 bits of the key's hash - and
+ * a lookup scans a whole group of TABLE_GROUP_WIDTH control bytes at a
+ * time (with SSE2 where available), only comparing keys whose 7 bits
+ * match. A miss usually ends at the first group, without touching an
+ * entry.
  */
 
 #ifndef luapp_table_h
@@ -11,14 +19,18 @@
 #include "common.h"
 #include "value.h"
 
+#define TABLE_GROUP_WIDTH 16
+
 typedef struct {
-    ObjString* key;     // NULL = empty slot, tombstone if key=NULL but value!=NIL
+    ObjString* key;     // NULL = empty or deleted slot
     Value value;
 } Entry;
 
 typedef struct {
-    int count;          // Entries + tombstones
-    int capacity;
+    int count;          // Live entries
+    int capacity;       // Slots: 0, 8, or a multiple of TABLE_GROUP_WIDTH
+    int growthLeft;     // Empty slots that may still be filled before a rehash
+    uint8_t* control;   // max(capacity, TABLE_GROUP_WIDTH) bytes
     Entry* entries;
 } Table;
 
@@ -31,7 +43,7 @@ bool tableSet(Table* table, ObjString* key, Value value);
 /* Returns true if found, stores value in *value */
 bool tableGet(Table* table, ObjString* key, Value* value);
 
-/* Returns true if deleted */
+/* Returns true if deleted; a table left under 1/8 full shrinks */
 bool tableDelete(Table* table, ObjString* key);
 
 /* Copy all entries from src to dest */
@@ -43,7 +55,8 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
 /* GC: mark all keys and values */
 void markTable(Table* table);
 
-/* GC: remove unmarked string keys (for string interning table) */
+/* GC: remove unmarked string keys (for string interning table), then
+ * shrink or drop tombstones as tableDelete does */
 void tableRemoveWhite(Table* table);
 
 #endif
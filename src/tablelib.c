@@ -0,0 +1,482 @@
+/*
+ * tablelib.c - Native table library
+ *
+ * Replaces the old pure-script stdlib/table.luapp, which shifted elements
+ * one assignment at a time and sorted by bubble sort. The sequence
+ * functions first move 1..#t into the array part (objTableSpanArray) and
+ * then shift it with memmove; sort is a pattern-defeating quicksort over
+ * the array part. As with the other natives, bad arguments make a
+ * function return nil.
+ */
+
+#include "tablelib.h"
+#include "number.h"
+#include "objtable.h"
+#include "vm.h"
+#include <limits.h>
+#include <string.h>
+
+/* ========== insert / remove ========== */
+
+/* table.insert(t, [position,] value) - shifts t[position..#t] up by one */
+static Value insertNative(int argCount, Value* args) {
+    if ((argCount != 2 && argCount != 3) || !IS_TABLE(args[0])) return NIL_VAL;
+    ObjTable* table = AS_TABLE(args[0]);
+    int length = objTableLength(table);
+    long long position = length + 1;
+    if (argCount == 3 &&
+        (!optInteger(argCount, args, 1, 0, &position) || position < 1 || position > length + 1)) {
+        return NIL_VAL;
+    }
+    Value value = args[argCount - 1];
+    if (position == length + 1) {
+        objTableSet(table, NUMBER_VAL(position), value);
+        return NIL_VAL;
+    }
+
+    // Grow by one (t[n + 1] = t[n]), then shift the rest up in one move
+    objTableSpanArray(table, length);
+    objTableSet(table, NUMBER_VAL(length + 1), table->array.values[length - 1]);
+    Value* values = table->array.values;
+    memmove(values + position, values + position - 1, sizeof(Value) * (size_t)(length - position));
+    values[position - 1] = value;
+    return NIL_VAL;
+}
+
+/* table.remove(t, [position]) - t[position] (default #t), shifting the rest down */
+static Value removeNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_TABLE(args[0])) return NIL_VAL;
+    ObjTable* table = AS_TABLE(args[0]);
+    int length = objTableLength(table);
+    long long position;
+    if (!optInteger(argCount, args, 1, length, &position)) return NIL_VAL;
+    // As in Lua, #t + 1 (and 0 for an empty table) may be "removed" too
+    if (position != length && (position < 1 || position > length + 1)) return NIL_VAL;
+
+    // Still in the table (rooted) while the array part may be rebuilt
+    Value removed = objTableGet(table, NUMBER_VAL(position));
+    if (position >= 1 && position < length) {
+        objTableSpanArray(table, length);
+        Value* values = table->array.values;
+        memmove(values + position - 1, values + position,
+                sizeof(Value) * (size_t)(length - position));
+        position = length;
+    }
+    objTableSet(table, NUMBER_VAL(position), NIL_VAL);
+    return removed;
+}
+
+/* ========== concat / unpack / move ========== */
+
+/* Length of a string or number as concat writes it; -1 for anything else */
+static int pieceLength(Value value) {
+    if (IS_NUMBER(value)) {
+        char number[NUMBER_BUFFER_SIZE];
+        return formatNumber(AS_NUMBER(value), number);
+    }
+    if (!IS_STRING(value)) return -1;
+    // Ropes are flattened up front: nothing may allocate once copying starts
+    if (IS_ROPE(value)) (void)AS_STRING(value);
+    return stringLength(value);
+}
+
+static char* writePiece(char* chars, Value value) {
+    if (IS_NUMBER(value)) {
+        char number[NUMBER_BUFFER_SIZE];
+        int length = formatNumber(AS_NUMBER(value), number);
+        memcpy(chars, number, (size_t)length);
+        return chars + length;
+    }
+    StringView piece = stringView(value);
+    memcpy(chars, piece.chars, (size_t)piece.length);
+    return chars + piece.length;
+}
+
+/* table.concat(t, [separator, [i, [j]]]) - t[i] .. separator .. ... .. t[j] */
+static Value concatNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_TABLE(args[0])) return NIL_VAL;
+    ObjTable* table = AS_TABLE(args[0]);
+    Value separator = argCount > 1 && !IS_NIL(args[1]) ? args[1] : NIL_VAL;
+    long long first;
+    long long last;
+    if (!optInteger(argCount, args, 2, 1, &first) ||
+        !optInteger(argCount, args, 3, objTableLength(table), &last)) {
+        return NIL_VAL;
+    }
+    if (first > last) return OBJ_VAL(copyString("", 0));
+
+    long long length = 0;
+    int separatorLength = 0;
+    if (!IS_NIL(separator) && (separatorLength = pieceLength(separator)) < 0) return NIL_VAL;
+    for (long long i = first; i <= last; i++) {
+        int pieceSize = pieceLength(objTableGet(table, NUMBER_VAL((double)i)));
+        if (pieceSize < 0) return NIL_VAL;
+        length += pieceSize + (i < last ? separatorLength : 0);
+        if (length > INT_MAX) return NIL_VAL;  // Too large
+    }
+
+    char shortChars[INTERN_MAX_LENGTH];
+    ObjString* result = NULL;
+    char* chars = shortChars;
+    if (length > INTERN_MAX_LENGTH) {
+        result = allocateLongString((int)length);
+        chars = result->chars;
+    }
+    for (long long i = first; i <= last; i++) {
+        chars = writePiece(chars, objTableGet(table, NUMBER_VAL((double)i)));
+        if (i < last && separatorLength > 0) chars = writePiece(chars, separator);
+    }
+    if (result == NULL) result = copyString(shortChars, (int)length);
+    return OBJ_VAL(result);
+}
+
+/* table.unpack(t, [i, [j]]) - t[i], ..., t[j] (j defaults to #t) */
+static Value unpackNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_TABLE(args[0])) return NIL_VAL;
+    ObjTable* table = AS_TABLE(args[0]);
+    long long first;
+    long long last;
+    if (!optInteger(argCount, args, 1, 1, &first) ||
+        !optInteger(argCount, args, 2, objTableLength(table), &last)) {
+        return NIL_VAL;
+    }
+    if (first > last) return NIL_VAL;
+
+    long long count = (long long)last - first + 1;
+    if (count >= INT_MAX || !reserveStack((int)count - 1)) {
+        runtimeError("Too many results to unpack.");
+        return NIL_VAL;
+    }
+    for (long long i = (long long)first + 1; i <= last; i++) {
+        push(objTableGet(table, NUMBER_VAL((double)i)));
+    }
+    return objTableGet(table, NUMBER_VAL(first));
+}
+
+/*
+ * table.move(a1, f, e, t, [a2]) - a2[t..] = a1[f..e], correct for
+ * overlapping ranges; returns a2 (default a1)
+ */
+static Value moveNative(int argCount, Value* args) {
+    if (argCount < 4 || !IS_TABLE(args[0])) return NIL_VAL;
+    ObjTable* source = AS_TABLE(args[0]);
+    ObjTable* destination = source;
+    if (argCount > 4 && !IS_NIL(args[4])) {
+        if (!IS_TABLE(args[4])) return NIL_VAL;
+        destination = AS_TABLE(args[4]);
+    }
+    long long first;
+    long long last;
+    long long target;
+    if (!optInteger(argCount, args, 1, 0, &first) || !optInteger(argCount, args, 2, 0, &last) ||
+        !optInteger(argCount, args, 3, 0, &target) || IS_NIL(args[1]) || IS_NIL(args[2]) ||
+        IS_NIL(args[3])) {
+        return NIL_VAL;
+    }
+    Value result = OBJ_VAL(destination);
+    if (first > last) return result;
+
+    long long count = (long long)last - first + 1;
+    if (count > INT_MAX || (long long)target + count - 1 > INT_MAX) return NIL_VAL;
+
+    if (first >= 1 && last <= source->array.count &&
+        target >= 1 && target + count - 1 <= destination->array.count) {
+        // Both ranges inside array parts: one move, overlap or not
+        memmove(destination->array.values + target - 1, source->array.values + first - 1,
+                sizeof(Value) * (size_t)count);
+    } else if (target > last || target <= first || source != destination) {
+        for (long long i = 0; i < count; i++) {
+            objTableSet(destination, NUMBER_VAL((double)(target + i)),
+                        objTableGet(source, NUMBER_VAL((double)(first + i))));
+        }
+    } else {
+        // Overlapping, moving up: copy from the end so nothing is overwritten first
+        for (long long i = count - 1; i >= 0; i--) {
+            objTableSet(destination, NUMBER_VAL((double)(target + i)),
+                        objTableGet(source, NUMBER_VAL((double)(first + i))));
+        }
+    }
+    return result;
+}
+
+/* ========== sort ========== */
+
+/*
+ * Pattern-defeating quicksort (Orson Peters' pdqsort): median-of-three
+ * (ninther for large ranges) quicksort that notices already partitioned
+ * ranges and runs of equal elements, and falls back to heapsort after too
+ * many unbalanced partitions, so it stays O(n log n) on any input.
+ *
+ * Elements are addressed by index into the array part and re-read after
+ * every comparison: a comparator may modify the table or trigger a
+ * collection, so no element is ever held only in a C local. Every scan
+ * is bounded, so an inconsistent comparator gives an unspecified order
+ * (or an error), never an out-of-range access.
+ */
+
+#define INSERTION_SORT_THRESHOLD 24
+#define NINTHER_THRESHOLD 128
+#define PARTIAL_INSERTION_LIMIT 8
+
+typedef enum {
+    SORT_NUMBERS,       // No comparator, all numbers: '<' on doubles
+    SORT_STRINGS,       // No comparator, all strings: byte order
+    SORT_COMPARATOR,    // comparator(a, b) is true when a goes before b
+} SortMode;
+
+typedef struct {
+    ObjTable* table;
+    int count;          // Sorting array.values[0 .. count)
+    SortMode mode;
+    Value comparator;
+    bool failed;        // A runtime error was reported: unwind
+} Sorter;
+
+static int compareStrings(Value a, Value b) {
+    StringView x = stringView(a);
+    StringView y = stringView(b);
+    int length = x.length < y.length ? x.length : y.length;
+    int order = memcmp(x.chars, y.chars, (size_t)length);
+    if (order != 0) return order;
+    return x.length - y.length;
+}
+
+static void sortError(Sorter* sorter, const char* message) {
+    if (sorter->failed) return;
+    runtimeError("%s", message);
+    sorter->failed = true;
+}
+
+/* Does element i go before element j? */
+static bool lessAt(Sorter* sorter, int i, int j) {
+    if (sorter->failed) return false;
+    Value* values = sorter->table->array.values;
+    switch (sorter->mode) {
+        case SORT_NUMBERS:
+            return AS_NUMBER(values[i]) < AS_NUMBER(values[j]);
+        case SORT_STRINGS:
+            return compareStrings(values[i], values[j]) < 0;
+        case SORT_COMPARATOR:
+            break;
+    }
+
+    if (!reserveStack(3)) {
+        sortError(sorter, "Stack overflow.");
+        return false;
+    }
+    push(sorter->comparator);
+    push(values[i]);
+    push(values[j]);
+    if (!callFunction(2, 1)) {
+        sorter->failed = true;  // Already reported
+        return false;
+    }
+    Value before = pop();
+    if (sorter->table->array.count < sorter->count) {
+        sortError(sorter, "Table was resized during 'table.sort'.");
+        return false;
+    }
+    return !IS_NIL(before) && !(IS_BOOL(before) && !AS_BOOL(before));
+}
+
+static void swapAt(Sorter* sorter, int i, int j) {
+    Value* values = sorter->table->array.values;
+    Value swapped = values[i];
+    values[i] = values[j];
+    values[j] = swapped;
+}
+
+/* Order elements a, b and c */
+static void sort3(Sorter* sorter, int a, int b, int c) {
+    if (lessAt(sorter, b, a)) swapAt(sorter, a, b);
+    if (lessAt(sorter, c, b)) swapAt(sorter, b, c);
+    if (lessAt(sorter, b, a)) swapAt(sorter, a, b);
+}
+
+static void insertionSort(Sorter* sorter, int low, int high) {
+    for (int i = low + 1; i < high; i++) {
+        for (int j = i; j > low && lessAt(sorter, j, j - 1); j--) swapAt(sorter, j, j - 1);
+    }
+}
+
+/* Insertion sort that gives up (false) after PARTIAL_INSERTION_LIMIT moves */
+static bool partialInsertionSort(Sorter* sorter, int low, int high) {
+    int moves = 0;
+    for (int i = low + 1; i < high; i++) {
+        for (int j = i; j > low && lessAt(sorter, j, j - 1); j--) {
+            swapAt(sorter, j, j - 1);
+            if (++moves > PARTIAL_INSERTION_LIMIT) return false;
+        }
+    }
+    return true;
+}
+
+static void siftDown(Sorter* sorter, int low, int root, int size) {
+    for (;;) {
+        int child = 2 * root + 1;
+        if (child >= size) return;
+        if (child + 1 < size && lessAt(sorter, low + child, low + child + 1)) child++;
+        if (!lessAt(sorter, low + root, low + child)) return;
+        swapAt(sorter, low + root, low + child);
+        root = child;
+    }
+}
+
+static void heapSort(Sorter* sorter, int low, int high) {
+    int size = high - low;
+    for (int root = size / 2 - 1; root >= 0; root--) siftDown(sorter, low, root, size);
+    for (int end = size - 1; end > 0 && !sorter->failed; end--) {
+        swapAt(sorter, low, low + end);
+        siftDown(sorter, low, 0, end);
+    }
+}
+
+/*
+ * Partition [low, high) around the pivot at low: smaller elements to its
+ * left, the rest to its right. Returns the pivot's final position;
+ * *alreadyPartitioned is set when no element had to be swapped.
+ */
+static int partitionRight(Sorter* sorter, int low, int high, bool* alreadyPartitioned) {
+    int i = low;
+    int j = high;
+    *alreadyPartitioned = true;
+    for (;;) {
+        while (++i < high && lessAt(sorter, i, low)) {}
+        while (--j > low && !lessAt(sorter, j, low)) {}
+        if (i >= j) break;
+        swapAt(sorter, i, j);
+        *alreadyPartitioned = false;
+    }
+    swapAt(sorter, low, j);
+    return j;
+}
+
+/*
+ * As partitionRight, but elements equal to the pivot go to its left. Used
+ * when the pivot equals the element before the range, so the left part is
+ * all equal and needs no further sorting.
+ */
+static int partitionLeft(Sorter* sorter, int low, int high) {
+    int i = low;
+    int j = high;
+    for (;;) {
+        while (++i < high && !lessAt(sorter, low, i)) {}
+        while (--j > low && lessAt(sorter, low, j)) {}
+        if (i >= j) break;
+        swapAt(sorter, i, j);
+    }
+    swapAt(sorter, low, j);
+    return j;
+}
+
+static void sortRange(Sorter* sorter, int low, int high, int badAllowed, bool leftmost) {
+    while (!sorter->failed) {
+        int size = high - low;
+        if (size < INSERTION_SORT_THRESHOLD) {
+            insertionSort(sorter, low, high);
+            return;
+        }
+
+        // Pivot to low
+        int middle = low + size / 2;
+        if (size > NINTHER_THRESHOLD) {
+            sort3(sorter, low, middle, high - 1);
+            sort3(sorter, low + 1, middle - 1, high - 2);
+            sort3(sorter, low + 2, middle + 1, high - 3);
+            sort3(sorter, middle - 1, middle, middle + 1);
+            swapAt(sorter, low, middle);
+        } else {
+            sort3(sorter, middle, low, high - 1);
+        }
+
+        // Everything here is >= the element before it; if the pivot is
+        // equal to that one, split off the run of equal elements
+        if (!leftmost && !lessAt(sorter, low - 1, low)) {
+            low = partitionLeft(sorter, low, high) + 1;
+            continue;
+        }
+
+        bool alreadyPartitioned;
+        int pivot = partitionRight(sorter, low, high, &alreadyPartitioned);
+        int leftSize = pivot - low;
+        int rightSize = high - pivot - 1;
+        if (leftSize < size / 8 || rightSize < size / 8) {
+            if (--badAllowed == 0) {
+                heapSort(sorter, low, high);
+                return;
+            }
+            // Shuffle a few elements to break up the pattern behind it
+            if (leftSize >= INSERTION_SORT_THRESHOLD) {
+                swapAt(sorter, low, low + leftSize / 4);
+                swapAt(sorter, pivot - 1, pivot - leftSize / 4);
+            }
+            if (rightSize >= INSERTION_SORT_THRESHOLD) {
+                swapAt(sorter, pivot + 1, pivot + 1 + rightSize / 4);
+                swapAt(sorter, high - 1, high - rightSize / 4);
+            }
+        } else if (alreadyPartitioned && partialInsertionSort(sorter, low, pivot) &&
+                   partialInsertionSort(sorter, pivot + 1, high)) {
+            return;
+        }
+
+        sortRange(sorter, low, pivot, badAllowed, leftmost);
+        low = pivot + 1;
+        leftmost = false;
+    }
+}
+
+/*
+ * table.sort(t, [comparator]) - sorts t[1..#t] in place. Without a
+ * comparator the elements must be all numbers or all strings.
+ */
+static Value sortNative(int argCount, Value* args) {
+    if (argCount < 1 || !IS_TABLE(args[0])) return NIL_VAL;
+    Sorter sorter;
+    sorter.table = AS_TABLE(args[0]);
+    sorter.count = objTableLength(sorter.table);
+    sorter.mode = SORT_COMPARATOR;
+    sorter.comparator = argCount > 1 ? args[1] : NIL_VAL;
+    sorter.failed = false;
+
+    if (!IS_NIL(sorter.comparator)) {
+        if (!IS_CLOSURE(sorter.comparator) && !IS_NATIVE(sorter.comparator) &&
+            !IS_BOUND_METHOD(sorter.comparator)) {
+            return NIL_VAL;
+        }
+    }
+    objTableSpanArray(sorter.table, sorter.count);
+    if (sorter.count < 2) return NIL_VAL;
+
+    if (IS_NIL(sorter.comparator)) {
+        Value* values = sorter.table->array.values;
+        sorter.mode = IS_NUMBER(values[0]) ? SORT_NUMBERS : SORT_STRINGS;
+        for (int i = 0; i < sorter.count; i++) {
+            if (sorter.mode == SORT_NUMBERS ? !IS_NUMBER(values[i]) : !IS_STRING(values[i])) {
+                return NIL_VAL;
+            }
+            // Comparisons read strings in place: flatten ropes first
+            if (IS_ROPE(values[i])) (void)AS_STRING(values[i]);
+        }
+    }
+
+    int badAllowed = 0;
+    for (int size = sorter.count; size > 0; size >>= 1) badAllowed++;
+    sortRange(&sorter, 0, sorter.count, badAllowed, true);
+    return NIL_VAL;
+}
+
+/* ========== Library ========== */
+
+static const LibFunction tableFunctions[] = {
+    {"insert", insertNative},
+    {"remove", removeNative},
+    {"concat", concatNative},
+    {"sort", sortNative},
+    {"unpack", unpackNative},
+    {"move", moveNative},
+    {NULL, NULL}
+};
+
+ObjTable* openTableLib(void) {
+    return openLib("table", tableFunctions);
+}
@@ -0,0 +1,17 @@
+/*
+ * tablelib.h - Native table library
+ *
+ * The 'table' global (table.insert, table.remove, table.concat,
+ * table.sort, table.unpack, table.move) is built in C when the VM starts,
+ * and is also what require("table") returns.
+ */
+
+#ifndef luapp_tablelib_h
+#define luapp_tablelib_h
+
+#include "object.h"
+
+/* Build the library, define the 'table' global and register the module */
+ObjTable* openTableLib(void);
+
+#endif
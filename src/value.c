@@ -4,6 +4,7 @@
 
 #include "value.h"
 #include "memory.h"
+#include "number.h"
 #include "object.h"
 #include <stdio.h>
 
@@ -31,22 +32,53 @@ void freeValueArray(ValueArray* array) {
 }
 
 void printValue(Value value) {
-    switch (value.type) {
-        case VAL_NIL:    printf("nil"); break;
-        case VAL_BOOL:   printf(AS_BOOL(value) ? "true" : "false"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-        case VAL_OBJ:    printObject(value); break;
+    if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NIL(value)) {
+        printf("nil");
+    } else if (IS_NUMBER(value)) {
+        char number[NUMBER_BUFFER_SIZE];
+        fwrite(number, 1, (size_t)formatNumber(AS_NUMBER(value), number), stdout);
+    } else if (IS_OBJ(value)) {
+        printObject(value);
     }
 }
 
+/*
+ * Distinct string objects can still be equal when they are long (not
+ * interned), ropes or slices; lengths are checked before a rope is
+ * flattened, and a slice is compared in place rather than copied out.
+ */
+static bool stringValuesEqual(Value a, Value b) {
+    if (!IS_STRING(a) || !IS_STRING(b)) return false;
+    if (stringLength(a) != stringLength(b)) return false;
+    if (!IS_SLICE(a) && !IS_SLICE(b)) return stringsEqual(AS_STRING(a), AS_STRING(b));
+
+    // Slices are long, so the other string is too: compare characters
+    StringView x = stringView(a);
+    StringView y = stringView(b);
+    return memcmp(x.chars, y.chars, x.length) == 0;
+}
+
 bool valuesEqual(Value a, Value b) {
+#if LUAPP_NAN_BOXING
+    // Numbers compare as doubles (NaN ~= NaN, 0 == -0); the rest by bits
+    if (IS_NUMBER(a) && IS_NUMBER(b)) {
+        return AS_NUMBER(a) == AS_NUMBER(b);
+    }
+    if (a == b) return true;  // Objects: identity, except long strings
+    return IS_OBJ(a) && IS_OBJ(b) && stringValuesEqual(a, b);
+#else
     if (a.type != b.type) return false;
     
     switch (a.type) {
         case VAL_NIL:    return true;
         case VAL_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-        case VAL_OBJ:    return AS_OBJ(a) == AS_OBJ(b); // Identity comparison (strings are interned)
+        case VAL_OBJ:
+            if (AS_OBJ(a) == AS_OBJ(b)) return true;  // Identity, except long strings
+            return stringValuesEqual(a, b);
         default:         return false;
     }
+#endif
 }
@@ -16,6 +16,60 @@
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
+#if LUAPP_NAN_BOXING
+
+/*
+ * NaN-boxed Value - every value fits in 8 bytes.
+ *
+ * A double is stored as its raw bits. Everything else hides in the payload
+ * of a quiet NaN, which real arithmetic never produces with these bits set:
+ *   nil/false/true  QNAN | small tag in the low bits
+ *   objects         SIGN_BIT | QNAN | 48-bit pointer
+ */
+typedef uint64_t Value;
+
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN     ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL   1
+#define TAG_FALSE 2
+#define TAG_TRUE  3
+
+#define FALSE_VAL        ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL         ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+/* Type checking macros */
+#define IS_NIL(value)    ((value) == NIL_VAL)
+#define IS_BOOL(value)   (((value) | 1) == TRUE_VAL)
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value)    (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+/* Value unpacking - extract the C value from a Value */
+#define AS_BOOL(value)   ((value) == TRUE_VAL)
+#define AS_NUMBER(value) valueToNum(value)
+#define AS_OBJ(value)    ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+/* Value constructors - wrap C values into Value */
+#define NIL_VAL          ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define BOOL_VAL(b)      ((b) ? TRUE_VAL : FALSE_VAL)
+#define NUMBER_VAL(num)  numToValue(num)
+#define OBJ_VAL(obj)     (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+/* Type-pun through memcpy; compilers lower this to a register move */
+static inline double valueToNum(Value value) {
+    double num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+}
+
+static inline Value numToValue(double num) {
+    Value value;
+    memcpy(&value, &num, sizeof(double));
+    return value;
+}
+
+#else
+
 /*
  * Value types - what kind of data a Value holds.
  * Objects are heap-allocated and tracked by GC.
@@ -57,6 +111,8 @@ typedef struct {
 #define NUMBER_VAL(value)((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object)  ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
+#endif
+
 /*
  * ValueArray - dynamic array of Values.
  * Used for constant pools in chunks and other collections.
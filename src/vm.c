@@ -9,7 +9,11 @@
 #include "compiler.h"
 #include "debug.h"
 #include "memory.h"
+#include "number.h"
 #include "object.h"
+#include "objtable.h"
+#include "stringlib.h"
+#include "tablelib.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -18,23 +22,31 @@
 VM vm;
 
 /* Forward declarations */
-static InterpretResult run(void);
+static InterpretResult run(int baseFrame);
 static void resetStack(void);
+static void errorOutput(const char* format, ...);
 
 /* ========== Native Functions ========== */
 
 static Value printNative(int argCount, Value* args) {
     for (int i = 0; i < argCount; i++) {
-        printValue(args[i]);
-        if (i < argCount - 1) printf("\t");
+        writeValueOutput(&vm.output, args[i]);
+        if (i < argCount - 1) writeOutput(&vm.output, "\t", 1);
     }
-    printf("\n");
+    writeOutput(&vm.output, "\n", 1);
     return NIL_VAL;
 }
 
+/* clock() - CPU time in seconds, for timing scripts and benchmarks */
+static Value clockNative(int argCount, Value* args) {
+    (void)argCount; (void)args;
+    return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+}
+
 static Value readNative(int argCount, Value* args) {
     (void)argCount; (void)args;
     char buffer[1024];
+    flushOutput(&vm.output);    // A prompt must show before we wait
     if (fgets(buffer, sizeof(buffer), stdin) != NULL) {
         // Remove trailing newline
         size_t len = strlen(buffer);
@@ -69,9 +81,11 @@ static Value tonumberNative(int argCount, Value* args) {
     if (argCount != 1) return NIL_VAL;
     if (IS_NUMBER(args[0])) return args[0];
     if (IS_STRING(args[0])) {
-        char* end;
-        double num = strtod(AS_CSTRING(args[0]), &end);
-        if (*end == '\0') return NUMBER_VAL(num);
+        double number;
+        StringView string = stringView(args[0]);
+        if (parseNumber(string.chars, string.length, &number)) {
+            return NUMBER_VAL(number);
+        }
     }
     return NIL_VAL;
 }
@@ -79,12 +93,12 @@ static Value tonumberNative(int argCount, Value* args) {
 static Value tostringNative(int argCount, Value* args) {
     if (argCount != 1) return NIL_VAL;
     
-    char buffer[64];
+    char buffer[NUMBER_BUFFER_SIZE];
     Value value = args[0];
     
     if (IS_STRING(value)) return value;
     if (IS_NUMBER(value)) {
-        int len = snprintf(buffer, sizeof(buffer), "%g", AS_NUMBER(value));
+        int len = formatNumber(AS_NUMBER(value), buffer);
         return OBJ_VAL(copyString(buffer, len));
     }
     if (IS_BOOL(value)) {
@@ -98,10 +112,6 @@ static Value tostringNative(int argCount, Value* args) {
 
 /* ========== Module System ========== */
 
-/* Track loaded modules to avoid re-loading */
-static Table loadedModules;
-static bool modulesInitialized = false;
-
 /* Read file contents */
 static char* readFile(const char* path) {
     FILE* file = fopen(path, "rb");
@@ -140,15 +150,9 @@ static Value requireNative(int argCount, Value* args) {
     
     ObjString* moduleName = AS_STRING(args[0]);
     
-    /* Initialize module cache if needed */
-    if (!modulesInitialized) {
-        initTable(&loadedModules);
-        modulesInitialized = true;
-    }
-    
-    /* Check if already loaded */
+    /* Check if already loaded (native libraries are registered up front) */
     Value cached;
-    if (tableGet(&loadedModules, moduleName, &cached)) {
+    if (tableGet(&vm.loadedModules, moduleName, &cached)) {
         return cached;
     }
     
@@ -173,7 +177,7 @@ static Value requireNative(int argCount, Value* args) {
     }
     
     if (source == NULL) {
-        fprintf(stderr, "Module not found: %s\n", moduleName->chars);
+        errorOutput("Module not found: %s\n", moduleName->chars);
         return NIL_VAL;
     }
     
@@ -182,18 +186,19 @@ static Value requireNative(int argCount, Value* args) {
     push(OBJ_VAL(exports));  /* GC protection */
     
     /* Store in cache before loading (handles circular deps) */
-    tableSet(&loadedModules, moduleName, OBJ_VAL(exports));
+    tableSet(&vm.loadedModules, moduleName, OBJ_VAL(exports));
     
     /* Save current globals state */
     /* The module will define its exports as globals, we'll capture them */
     
     /* Compile and run the module */
+    flushOutput(&vm.output);  /* Its diagnostics follow what ran before */
     ObjFunction* function = compileWithFilename(source, path);
     free(source);
     
     if (function == NULL) {
         pop();  /* Remove exports from stack */
-        tableDelete(&loadedModules, moduleName);
+        tableDelete(&vm.loadedModules, moduleName);
         return NIL_VAL;
     }
     
@@ -205,27 +210,29 @@ static Value requireNative(int argCount, Value* args) {
     
     /* Module will run via run() which handles frame management */
     
-    if (vm.frameCount == FRAMES_MAX) {
+    if (vm.frameCount == FRAMES_MAX || !reserveStack(FRAME_SLOTS)) {
         pop();
         pop();
         return NIL_VAL;
     }
     
-    CallFrame* frame = &vm.frames[vm.frameCount++];
+    CallFrame* frame = pushFrame();
     frame->closure = closure;
     frame->ip = closure->function->chunk.code;
     frame->slots = vm.stackTop - 1;
+    frame->varargCount = 0;
+    frame->results = 1;
     
-    /* Run until module completes */
-    InterpretResult result = run();
+    /* Run until the module's own frame returns */
+    InterpretResult result = run(vm.frameCount - 1);
     
     if (result != INTERPRET_OK) {
-        pop();  /* Remove exports */
+        /* runtimeError() already unwound the whole VM */
         return NIL_VAL;
     }
     
     /* Module executed - exports table is ready */
-    pop();  /* Remove closure */
+    pop();  /* Remove the module's return value */
     Value exportsVal = pop();  /* Get exports */
     
     return exportsVal;
@@ -257,70 +264,39 @@ static Value ipairsNative(int argCount, Value* args) {
 }
 
 /*
- * next(table, key) - Returns next key-value pair
- * If key is nil, returns first pair.
+ * next(table, key) - Returns the key and value after 'key' (the first pair
+ * when key is nil), or nil once every pair has been visited.
  */
 static Value nextNative(int argCount, Value* args) {
     if (argCount < 1 || !IS_TABLE(args[0])) {
         return NIL_VAL;
     }
     
-    ObjTable* table = AS_TABLE(args[0]);
     Value key = (argCount > 1) ? args[1] : NIL_VAL;
-    
-    /* If key is nil, return first element */
-    if (IS_NIL(key)) {
-        /* Check array part first */
-        if (table->array.count > 0) {
-            /* Return key=1, value=array[0] as a table {1, value} */
-            ObjTable* result = newTable();
-            writeValueArray(&result->array, NUMBER_VAL(1));
-            writeValueArray(&result->array, table->array.values[0]);
-            return OBJ_VAL(result);
-        }
-        /* Check hash part */
-        for (int i = 0; i < table->entries.capacity; i++) {
-            Entry* entry = &table->entries.entries[i];
-            if (entry->key != NULL) {
-                ObjTable* result = newTable();
-                writeValueArray(&result->array, OBJ_VAL(entry->key));
-                writeValueArray(&result->array, entry->value);
-                return OBJ_VAL(result);
-            }
-        }
-        return NIL_VAL;
-    }
-    
-    /* Find next after given key */
-    if (IS_NUMBER(key)) {
-        int idx = (int)AS_NUMBER(key);
-        if (idx >= 1 && idx < table->array.count) {
-            ObjTable* result = newTable();
-            writeValueArray(&result->array, NUMBER_VAL(idx + 1));
-            writeValueArray(&result->array, table->array.values[idx]);
-            return OBJ_VAL(result);
-        }
-        /* Fall through to hash part */
-    }
-    
-    /* Search hash part */
-    bool found = false;
-    for (int i = 0; i < table->entries.capacity; i++) {
-        Entry* entry = &table->entries.entries[i];
-        if (entry->key != NULL) {
-            if (found) {
-                ObjTable* result = newTable();
-                writeValueArray(&result->array, OBJ_VAL(entry->key));
-                writeValueArray(&result->array, entry->value);
-                return OBJ_VAL(result);
-            }
-            if (IS_STRING(key) && entry->key == AS_STRING(key)) {
-                found = true;
-            }
-        }
+    Value value;
+    if (!objTableNextKey(AS_TABLE(args[0]), &key, &value)) return NIL_VAL;
+    if (!reserveStack(1)) return NIL_VAL;
+    push(value);
+    return key;
+}
+
+/*
+ * select(n, ...) - Returns the arguments after the n-th;
+ * select("#", ...) returns how many there are.
+ */
+static Value selectNative(int argCount, Value* args) {
+    if (argCount >= 1 && IS_STRING(args[0]) &&
+        AS_STRING(args[0])->length == 1 && AS_CSTRING(args[0])[0] == '#') {
+        return NUMBER_VAL(argCount - 1);
     }
-    
-    return NIL_VAL;
+    if (argCount < 1 || !IS_NUMBER(args[0])) return NIL_VAL;
+    
+    int n = (int)AS_NUMBER(args[0]);
+    if (n < 1 || n >= argCount) return NIL_VAL;
+    if (!reserveStack(argCount - n)) return NIL_VAL;
+    args = vm.stackTop - argCount;  // The stack may have moved
+    for (int i = n + 1; i < argCount; i++) push(args[i]);
+    return args[n];
 }
 
 /*
@@ -328,9 +304,9 @@ static Value nextNative(int argCount, Value* args) {
  */
 static Value errorNative(int argCount, Value* args) {
     if (argCount >= 1 && IS_STRING(args[0])) {
-        fprintf(stderr, "error: %s\n", AS_CSTRING(args[0]));
+        errorOutput("error: %s\n", AS_CSTRING(args[0]));
     } else {
-        fprintf(stderr, "error\n");
+        errorOutput("error\n");
     }
     return NIL_VAL;
 }
@@ -345,9 +321,9 @@ static Value assertNative(int argCount, Value* args) {
     
     if (!condition) {
         if (argCount >= 2 && IS_STRING(args[1])) {
-            fprintf(stderr, "assertion failed: %s\n", AS_CSTRING(args[1]));
+            errorOutput("assertion failed: %s\n", AS_CSTRING(args[1]));
         } else {
-            fprintf(stderr, "assertion failed\n");
+            errorOutput("assertion failed\n");
         }
     }
     
@@ -360,24 +336,7 @@ static Value assertNative(int argCount, Value* args) {
 static Value rawgetNative(int argCount, Value* args) {
     if (argCount != 2 || !IS_TABLE(args[0])) return NIL_VAL;
     
-    ObjTable* table = AS_TABLE(args[0]);
-    Value key = args[1];
-    
-    if (IS_NUMBER(key)) {
-        int idx = (int)AS_NUMBER(key);
-        if (idx >= 1 && idx <= table->array.count) {
-            return table->array.values[idx - 1];
-        }
-    }
-    
-    if (IS_STRING(key)) {
-        Value value;
-        if (tableGet(&table->entries, AS_STRING(key), &value)) {
-            return value;
-        }
-    }
-    
-    return NIL_VAL;
+    return objTableGet(AS_TABLE(args[0]), args[1]);
 }
 
 /*
@@ -386,34 +345,92 @@ static Value rawgetNative(int argCount, Value* args) {
 static Value rawsetNative(int argCount, Value* args) {
     if (argCount != 3 || !IS_TABLE(args[0])) return NIL_VAL;
     
-    ObjTable* table = AS_TABLE(args[0]);
-    Value key = args[1];
-    Value value = args[2];
-    
-    if (IS_NUMBER(key)) {
-        int idx = (int)AS_NUMBER(key);
-        if (idx >= 1) {
-            while (table->array.count < idx) {
-                writeValueArray(&table->array, NIL_VAL);
-            }
-            table->array.values[idx - 1] = value;
-            return args[0];
-        }
-    }
-    
-    if (IS_STRING(key)) {
-        tableSet(&table->entries, AS_STRING(key), value);
-    }
-    
+    if (!objTableSet(AS_TABLE(args[0]), args[1], args[2])) return NIL_VAL;
     return args[0];
 }
 
 static void defineNative(const char* name, NativeFn function) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function, AS_STRING(vm.stack[0]))));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    defineGlobal(AS_STRING(vm.stack[0]), vm.stack[1]);
+    pop();
+    pop();
+}
+
+/* ========== Global Variables ========== */
+
+int globalSlot(ObjString* name) {
+    Value slot;
+    if (tableGet(&vm.globalSlots, name, &slot)) return (int)AS_NUMBER(slot);
+    
+    push(OBJ_VAL(name));  // GC protection while the arrays grow
+    if (vm.globalCapacity < vm.globalCount + 1) {
+        int oldCapacity = vm.globalCapacity;
+        vm.globalCapacity = GROW_CAPACITY(oldCapacity);
+        vm.globals = GROW_ARRAY(Global, vm.globals, oldCapacity, vm.globalCapacity);
+    }
+    Global* global = &vm.globals[vm.globalCount];
+    global->value = NIL_VAL;
+    global->name = name;
+    global->defined = false;
+    tableSet(&vm.globalSlots, name, NUMBER_VAL(vm.globalCount));
+    pop();
+    return vm.globalCount++;
+}
+
+bool getGlobal(ObjString* name, Value* value) {
+    Value slot;
+    if (!tableGet(&vm.globalSlots, name, &slot)) return false;
+    
+    Global* global = &vm.globals[(int)AS_NUMBER(slot)];
+    if (!global->defined) return false;
+    *value = global->value;
+    return true;
+}
+
+/* Callers keep value reachable (the slot may have to be created) */
+void defineGlobal(ObjString* name, Value value) {
+    int slot = globalSlot(name);  // may grow vm.globals
+    Global* global = &vm.globals[slot];
+    global->value = value;
+    global->defined = true;
+}
+
+ObjTable* openLib(const char* name, const LibFunction* functions) {
+    ObjTable* lib = newTable();
+    push(OBJ_VAL(lib));
+
+    for (const LibFunction* entry = functions; entry->name != NULL; entry++) {
+        push(OBJ_VAL(copyString(entry->name, (int)strlen(entry->name))));
+        push(OBJ_VAL(newNative(entry->function, AS_STRING(vm.stackTop[-1]))));
+        objTableSetField(lib, AS_STRING(vm.stackTop[-2]), vm.stackTop[-1]);
+        pop();
+        pop();
+    }
+
+    push(OBJ_VAL(copyString(name, (int)strlen(name))));
+    defineGlobal(AS_STRING(vm.stackTop[-1]), OBJ_VAL(lib));
+    tableSet(&vm.loadedModules, AS_STRING(vm.stackTop[-1]), OBJ_VAL(lib));
     pop();
     pop();
+    return lib;
+}
+
+#define MAX_EXACT_INTEGER 9007199254740992.0    // 2^53: every integer up to it is exact
+
+bool optInteger(int argCount, Value* args, int index, long long fallback, long long* out) {
+    if (index >= argCount || IS_NIL(args[index])) {
+        *out = fallback;
+        return true;
+    }
+    if (!IS_NUMBER(args[index])) return false;
+    double number = AS_NUMBER(args[index]);
+    if (!(number >= -MAX_EXACT_INTEGER && number <= MAX_EXACT_INTEGER) ||
+        number != (double)(long long)number) {
+        return false;
+    }
+    *out = (long long)number;
+    return true;
 }
 
 /* ========== VM Initialization ========== */
@@ -425,6 +442,14 @@ static void resetStack(void) {
 }
 
 void initVM(void) {
+    vm.stack = (Value*)malloc(sizeof(Value) * STACK_INITIAL);
+    vm.stackCapacity = STACK_INITIAL;
+    vm.frames = (CallFrame*)malloc(sizeof(CallFrame) * FRAMES_INITIAL);
+    vm.frameCapacity = FRAMES_INITIAL;
+    if (vm.stack == NULL || vm.frames == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
     resetStack();
     vm.objects = NULL;
     vm.bytesAllocated = 0;
@@ -434,8 +459,16 @@ void initVM(void) {
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
     
-    initTable(&vm.globals);
+    vm.globals = NULL;
+    vm.globalCount = 0;
+    vm.globalCapacity = 0;
+    initTable(&vm.globalSlots);
+    initHashSeed(&vm.hashSeed);
     initTable(&vm.strings);
+    initTable(&vm.loadedModules);
+    vm.stringLib = NULL;
+    initPatternCache(&vm.patternCache);
+    initOutput(&vm.output, 1);  // Standard output
     
     vm.initString = NULL;
     vm.initString = copyString("init", 4);
@@ -446,6 +479,7 @@ void initVM(void) {
     defineNative("type", typeNative);
     defineNative("tonumber", tonumberNative);
     defineNative("tostring", tostringNative);
+    defineNative("clock", clockNative);
     
     // Module system
     defineNative("require", requireNative);
@@ -454,6 +488,7 @@ void initVM(void) {
     defineNative("pairs", pairsNative);
     defineNative("ipairs", ipairsNative);
     defineNative("next", nextNative);
+    defineNative("select", selectNative);
     
     // Error handling
     defineNative("error", errorNative);
@@ -462,15 +497,41 @@ void initVM(void) {
     // Raw table access
     defineNative("rawget", rawgetNative);
     defineNative("rawset", rawsetNative);
+    
+    // Native libraries
+    vm.stringLib = openStringLib();
+    openIoLib();
+    openTableLib();
 }
 
 void freeVM(void) {
-    freeTable(&vm.globals);
+    freeOutput(&vm.output);
+    FREE_ARRAY(Global, vm.globals, vm.globalCapacity);
+    vm.globals = NULL;
+    vm.globalCount = 0;
+    vm.globalCapacity = 0;
+    freeTable(&vm.globalSlots);
     freeTable(&vm.strings);
+    freeTable(&vm.loadedModules);
+    freePatternCache(&vm.patternCache);
     vm.initString = NULL;
+    vm.stringLib = NULL;
     freeObjects();
+    
+    free(vm.stack);
+    vm.stack = NULL;
+    vm.stackTop = NULL;
+    vm.stackCapacity = 0;
+    free(vm.frames);
+    vm.frames = NULL;
+    vm.frameCapacity = 0;
 }
 
+/*
+ * push() does not check for room: every frame gets FRAME_SLOTS reserved
+ * when it is entered, and anything pushing an unbounded number of values
+ * (varargs, multiple results, host calls) reserves them first.
+ */
 void push(Value value) {
     *vm.stackTop = value;
     vm.stackTop++;
@@ -481,19 +542,93 @@ Value pop(void) {
     return *vm.stackTop;
 }
 
+/* Move the stack to a bigger block and rebase every pointer into it */
+static bool growStack(int count) {
+    int needed = (int)(vm.stackTop - vm.stack) + count;
+    if (needed > STACK_MAX) return false;
+    
+    int capacity = vm.stackCapacity;
+    while (capacity < needed) capacity *= 2;
+    if (capacity > STACK_MAX) capacity = STACK_MAX;
+    
+    Value* stack = (Value*)malloc(sizeof(Value) * capacity);
+    if (stack == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    Value* old = vm.stack;
+    memcpy(stack, old, sizeof(Value) * (vm.stackTop - old));
+    
+    vm.stackTop = stack + (vm.stackTop - old);
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = stack + (vm.frames[i].slots - old);
+    }
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL;
+         upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - old);
+    }
+    
+    free(old);
+    vm.stack = stack;
+    vm.stackCapacity = capacity;
+    return true;
+}
+
+/* False (nothing reported) if count more values would pass STACK_MAX */
+bool reserveStack(int count) {
+    if (vm.stackCapacity - (int)(vm.stackTop - vm.stack) >= count) return true;
+    return growStack(count);
+}
+
+/* Frames hold no pointers into each other, so the array can simply move */
+static void growFrames(void) {
+    int capacity = vm.frameCapacity * 2;
+    CallFrame* frames = (CallFrame*)realloc(vm.frames, sizeof(CallFrame) * capacity);
+    if (frames == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(1);
+    }
+    vm.frames = frames;
+    vm.frameCapacity = capacity;
+}
+
+CallFrame* pushFrame(void) {
+    if (vm.frameCount == vm.frameCapacity) growFrames();
+    return &vm.frames[vm.frameCount++];
+}
+
 static Value peek(int distance) {
     return vm.stackTop[-1 - distance];
 }
 
-static void runtimeError(const char* format, ...) {
+#define TRACE_FRAMES 10  // Frames shown at each end of a long stack trace
+
+/* stderr, after flushing vm.output so what ran before the error comes first */
+static void errorOutputV(const char* format, va_list args) {
+    flushOutput(&vm.output);
+    vfprintf(stderr, format, args);
+}
+
+static void errorOutput(const char* format, ...) {
     va_list args;
     va_start(args, format);
-    vfprintf(stderr, format, args);
+    errorOutputV(format, args);
+    va_end(args);
+}
+
+void runtimeError(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    errorOutputV(format, args);
     va_end(args);
     fputs("\n", stderr);
     
-    // Stack trace
+    // Stack trace (the middle of a very deep one is elided)
     for (int i = vm.frameCount - 1; i >= 0; i--) {
+        if (i == vm.frameCount - TRACE_FRAMES - 1 && i > TRACE_FRAMES) {
+            fprintf(stderr, "... (%d more frames)\n", i - TRACE_FRAMES + 1);
+            i = TRACE_FRAMES - 1;
+        }
         CallFrame* frame = &vm.frames[i];
         ObjFunction* function = frame->closure->function;
         size_t instruction = frame->ip - function->chunk.code - 1;
@@ -512,60 +647,208 @@ static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
+/* Short results are copied now; long ones become ropes */
 static void concatenate(void) {
-    ObjString* b = AS_STRING(peek(0));
-    ObjString* a = AS_STRING(peek(1));
+    int length = stringLength(peek(1)) + stringLength(peek(0));
+    Value result;
     
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    if (length >= ROPE_MIN_LENGTH) {
+        result = OBJ_VAL(newRope(peek(1), peek(0)));
+    } else {
+        // Ropes are never this short, but a slice can be: read it in place
+        StringView a = stringView(peek(1));
+        StringView b = stringView(peek(0));
+        result = OBJ_VAL(concatChars(a.chars, a.length, b.chars, b.length));
+    }
     
-    ObjString* result = takeString(chars, length);
     pop();
     pop();
-    push(OBJ_VAL(result));
+    push(result);
+}
+
+#define CONCAT_SCRATCH_SIZE (16 * NUMBER_BUFFER_SIZE)
+
+/*
+ * Join count pieces (strings or numbers) in one allocation: every length
+ * is known before the result is created and each piece is copied once.
+ * Numbers are formatted into a scratch buffer rather than made strings.
+ */
+static Value joinPieces(Value* pieces, int count) {
+    if (count == 1 && IS_STRING(pieces[0])) return pieces[0];
+    
+    char scratch[CONCAT_SCRATCH_SIZE];
+    int scratchUsed = 0;
+    int length = 0;
+    for (int i = 0; i < count; i++) {
+        if (IS_NUMBER(pieces[i])) {
+            if (scratchUsed + NUMBER_BUFFER_SIZE > CONCAT_SCRATCH_SIZE) {
+                // Out of scratch space: this one becomes a string after all
+                char number[NUMBER_BUFFER_SIZE];
+                int numberLength = formatNumber(AS_NUMBER(pieces[i]), number);
+                pieces[i] = OBJ_VAL(copyString(number, numberLength));
+                length += numberLength;
+                continue;
+            }
+            int numberLength = formatNumber(AS_NUMBER(pieces[i]), scratch + scratchUsed);
+            scratchUsed += numberLength + 1;    // Keep its '\0'
+            length += numberLength;
+        } else {
+            // Ropes are flattened up front: nothing may allocate once
+            // copying starts. Slices are read in place.
+            if (IS_ROPE(pieces[i])) pieces[i] = OBJ_VAL(AS_STRING(pieces[i]));
+            length += stringLength(pieces[i]);
+        }
+    }
+    
+    char shortChars[INTERN_MAX_LENGTH];
+    ObjString* result = NULL;
+    char* chars = shortChars;
+    if (length > INTERN_MAX_LENGTH) {
+        result = allocateLongString(length);
+        chars = result->chars;
+    }
+    
+    const char* nextNumber = scratch;
+    for (int i = 0; i < count; i++) {
+        if (IS_NUMBER(pieces[i])) {
+            int numberLength = (int)strlen(nextNumber);
+            memcpy(chars, nextNumber, numberLength);
+            nextNumber += numberLength + 1;
+            chars += numberLength;
+        } else {
+            StringView piece = stringView(pieces[i]);
+            memcpy(chars, piece.chars, piece.length);
+            chars += piece.length;
+        }
+    }
+    
+    // Only a short result is interned, and only once it is complete
+    if (result == NULL) result = copyString(shortChars, length);
+    return OBJ_VAL(result);
+}
+
+/*
+ * a .. b .. c ...: replace the top count values with their concatenation.
+ * A long first (or last) piece is linked in as a rope operand rather than
+ * copied, so s = s .. x .. y in a loop stays linear like s = s .. x.
+ */
+static void concatenateN(int count) {
+    Value* pieces = vm.stackTop - count;
+    Value result;
+    
+    if (IS_STRING(pieces[0]) && stringLength(pieces[0]) >= ROPE_MIN_LENGTH) {
+        push(joinPieces(pieces + 1, count - 1));
+        result = OBJ_VAL(newRope(pieces[0], peek(0)));
+    } else if (IS_STRING(pieces[count - 1]) &&
+               stringLength(pieces[count - 1]) >= ROPE_MIN_LENGTH) {
+        push(joinPieces(pieces, count - 1));
+        result = OBJ_VAL(newRope(peek(0), pieces[count - 1]));
+    } else {
+        result = joinPieces(pieces, count);
+    }
+    
+    vm.stackTop = pieces;
+    push(result);
 }
 
 /* ========== Function Calls ========== */
 
-static bool call(ObjClosure* closure, int argCount) {
-    if (argCount != closure->function->arity) {
-        runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
-        return false;
+/*
+ * Move 'count' call results from 'values' down to 'base' (the callee slot)
+ * and adjust them to the number the call site asked for.
+ */
+static void placeResults(Value* base, Value* values, int count, int wanted) {
+    if (wanted == MULTI_RESULTS) {
+        memmove(base, values, sizeof(Value) * count);
+        vm.stackTop = base + count;
+        push(NUMBER_VAL(count));
+        return;
+    }
+    
+    int kept = count < wanted ? count : wanted;
+    memmove(base, values, sizeof(Value) * kept);
+    for (int i = kept; i < wanted; i++) base[i] = NIL_VAL;
+    vm.stackTop = base + wanted;
+}
+
+/* Where a returning frame's results go: its callee slot */
+static Value* frameBase(CallFrame* frame) {
+    if (!frame->closure->function->isVararg) return frame->slots;
+    return frame->slots - frame->varargCount - frame->closure->function->arity - 1;
+}
+
+static bool call(ObjClosure* closure, int argCount, int results) {
+    ObjFunction* function = closure->function;
+    if (argCount != function->arity) {
+        if (!function->isVararg) {
+            runtimeError("Expected %d arguments but got %d.", function->arity, argCount);
+            return false;
+        }
+        if (argCount < function->arity) {
+            runtimeError("Expected at least %d arguments but got %d.",
+                         function->arity, argCount);
+            return false;
+        }
     }
     
-    if (vm.frameCount == FRAMES_MAX) {
+    // Vararg functions copy the callee and fixed parameters up as well
+    if (vm.frameCount == FRAMES_MAX ||
+        !reserveStack(FRAME_SLOTS + function->arity + 1)) {
         runtimeError("Stack overflow.");
         return false;
     }
     
-    CallFrame* frame = &vm.frames[vm.frameCount++];
+    CallFrame* frame = pushFrame();
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
+    frame->ip = function->chunk.code;
     frame->slots = vm.stackTop - argCount - 1;
+    frame->varargCount = 0;
+    frame->results = results;
+    
+    if (function->isVararg) {
+        // Copy the callee and fixed parameters above the extra arguments,
+        // which stay where they are, just below the new frame
+        Value* args = frame->slots;
+        for (int i = 0; i <= function->arity; i++) push(args[i]);
+        frame->slots = vm.stackTop - function->arity - 1;
+        frame->varargCount = argCount - function->arity;
+    }
     return true;
 }
 
-static bool callValue(Value callee, int argCount) {
+static bool callValue(Value callee, int argCount, int results) {
     if (IS_OBJ(callee)) {
         switch (OBJ_TYPE(callee)) {
             case OBJ_CLOSURE:
-                return call(AS_CLOSURE(callee), argCount);
+                return call(AS_CLOSURE(callee), argCount, results);
                 
             case OBJ_NATIVE: {
                 NativeFn native = AS_NATIVE(callee);
+                int argsIndex = (int)(vm.stackTop - argCount - vm.stack);
                 Value result = native(argCount, vm.stackTop - argCount);
-                vm.stackTop -= argCount + 1;
-                push(result);
+                // A nested run() (require, host callbacks) hit a runtime
+                // error and has already reported it and reset the VM
+                if (vm.frameCount == 0) return false;
+                
+                // Extra results were pushed past the arguments (re-derive
+                // args: a nested call may have moved the stack)
+                Value* args = vm.stack + argsIndex;
+                int extra = (int)(vm.stackTop - (args + argCount));
+                Value* base = args - 1;
+                base[0] = result;
+                if (extra == 0 && results == 1) {
+                    vm.stackTop = args;
+                } else {
+                    memmove(base + 1, args + argCount, sizeof(Value) * extra);
+                    placeResults(base, base, extra + 1, results);
+                }
                 return true;
             }
             
             case OBJ_BOUND_METHOD: {
                 ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
                 vm.stackTop[-argCount - 1] = bound->receiver;
-                return call(bound->method, argCount);
+                return call(bound->method, argCount, results);
             }
             
             default:
@@ -576,18 +859,92 @@ static bool callValue(Value callee, int argCount) {
     return false;
 }
 
-static bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
+/*
+ * Resolve a method through a site's inline cache. Hits skip the methods
+ * table entirely. Class method tables are only filled while the class
+ * statement runs (OP_METHOD/OP_INHERIT/OP_IMPLEMENT), before any instance
+ * can reach a call site, so a cached entry never goes stale.
+ */
+static bool lookupMethod(ObjClass* klass, ObjString* name, InlineCache* cache,
+                         Value* method) {
+    for (int way = 0; way < IC_WAYS; way++) {
+        if (cache->klass[way] == klass) {
+            *method = cache->method[way];
+            return true;
+        }
+    }
+    
+    if (!tableGet(&klass->methods, name, method)) return false;
+    
+    // Newest class goes in way 0, the oldest falls off the end
+    for (int way = IC_WAYS - 1; way > 0; way--) {
+        cache->klass[way] = cache->klass[way - 1];
+        cache->method[way] = cache->method[way - 1];
+    }
+    cache->klass[0] = klass;
+    cache->method[0] = *method;
+    return true;
+}
+
+/* Field slot of 'name' for instances of 'shape' (-1 if absent), via a site cache */
+static int lookupField(ObjShape* shape, ObjString* name, InlineCache* cache) {
+    for (int way = 0; way < IC_WAYS; way++) {
+        if (cache->shape[way] == shape) return cache->slot[way];
+    }
+    
+    int slot = shapeSlot(shape, name);
+    for (int way = IC_WAYS - 1; way > 0; way--) {
+        cache->shape[way] = cache->shape[way - 1];
+        cache->slot[way] = cache->slot[way - 1];
+    }
+    cache->shape[0] = shape;
+    cache->slot[0] = slot;
+    return slot;
+}
+
+static bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount,
+                            int results, InlineCache* cache) {
     Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
+    if (!lookupMethod(klass, name, cache, &method)) {
         runtimeError("Undefined method '%s'.", name->chars);
         return false;
     }
-    return call(AS_CLOSURE(method), argCount);
+    return call(AS_CLOSURE(method), argCount, results);
 }
 
-static bool invoke(ObjString* name, int argCount) {
+static bool invoke(ObjString* name, int argCount, int results, InlineCache* cache) {
     Value receiver = peek(argCount);
     
+    if (IS_TABLE(receiver)) {
+        // Library style: t.f(args) calls the function stored under "f"
+        Value value = objTableGetField(AS_TABLE(receiver), name);
+        if (IS_NIL(value)) {
+            runtimeError("Undefined field '%s'.", name->chars);
+            return false;
+        }
+        vm.stackTop[-argCount - 1] = value;
+        return callValue(value, argCount, results);
+    }
+    
+    if (IS_STRING(receiver)) {
+        // s:f(args) is string.f(s, args): slide the receiver up into the
+        // first argument slot and put the library function below it
+        Value method = objTableGetField(vm.stringLib, name);
+        if (IS_NIL(method)) {
+            runtimeError("Undefined method '%s'.", name->chars);
+            return false;
+        }
+        if (!reserveStack(1)) {
+            runtimeError("Stack overflow.");
+            return false;
+        }
+        Value* callee = vm.stackTop - argCount - 1;
+        memmove(callee + 1, callee, sizeof(Value) * (argCount + 1));
+        *callee = method;
+        vm.stackTop++;
+        return callValue(method, argCount + 1, results);
+    }
+    
     if (!IS_INSTANCE(receiver)) {
         runtimeError("Only instances have methods.");
         return false;
@@ -596,18 +953,19 @@ static bool invoke(ObjString* name, int argCount) {
     ObjInstance* instance = AS_INSTANCE(receiver);
     
     // Check for field first (might be a function stored in field)
-    Value value;
-    if (tableGet(&instance->fields, name, &value)) {
+    int slot = lookupField(instance->shape, name, cache);
+    if (slot >= 0) {
+        Value value = instance->fields[slot];
         vm.stackTop[-argCount - 1] = value;
-        return callValue(value, argCount);
+        return callValue(value, argCount, results);
     }
     
-    return invokeFromClass(instance->klass, name, argCount);
+    return invokeFromClass(instance->klass, name, argCount, results, cache);
 }
 
-static bool bindMethod(ObjClass* klass, ObjString* name) {
+static bool bindMethod(ObjClass* klass, ObjString* name, InlineCache* cache) {
     Value method;
-    if (!tableGet(&klass->methods, name, &method)) {
+    if (!lookupMethod(klass, name, cache, &method)) {
         runtimeError("Undefined property '%s'.", name->chars);
         return false;
     }
@@ -671,270 +1029,574 @@ static void defineMethod(ObjString* name, bool isPrivate) {
 
 /* ========== Main Execution Loop ========== */
 
-static InterpretResult run(void) {
+/* --trace: print the value stack and the instruction about to execute */
+static void traceInstruction(CallFrame* frame, uint8_t* ip) {
+    printf("          ");
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+    disassembleInstruction(&frame->closure->function->chunk,
+        (int)(ip - frame->closure->function->chunk.code));
+}
+
+#if LUAPP_COMPUTED_GOTO
+/* Labels-as-values is a GNU extension that -pedantic flags on every use */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/*
+ * Execute frames until the one at index baseFrame returns. Its result is
+ * left on the stack in place of the callee. interpret() runs from frame 0;
+ * require() and callClosure() re-enter with their own frame as the base so
+ * host->script calls get the same dispatch loop and opcode coverage.
+ */
+static InterpretResult run(int baseFrame) {
     CallFrame* frame = &vm.frames[vm.frameCount - 1];
-    
-#define READ_BYTE() (*frame->ip++)
+
+    /*
+     * The hot parts of the current frame are cached in locals so they can
+     * live in registers. frame->ip is only synced back (SAVE_FRAME) before
+     * anything that may inspect it (runtime errors, calls, natives).
+     */
+    uint8_t* ip = frame->ip;
+    Value* constants = frame->closure->function->chunk.constants.values;
+
+#define READ_BYTE() (*ip++)
 #define READ_SHORT() \
-    (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() \
-    (frame->closure->function->chunk.constants.values[READ_BYTE()])
+    (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (constants[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_CACHE(index) (&frame->closure->function->chunk.caches[index])
+#define SAVE_FRAME() (frame->ip = ip)
+#define LOAD_FRAME() \
+    (frame = &vm.frames[vm.frameCount - 1], \
+     ip = frame->ip, \
+     constants = frame->closure->function->chunk.constants.values)
+#define RUNTIME_ERROR(...) \
+    do { \
+        SAVE_FRAME(); \
+        runtimeError(__VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
 #define BINARY_OP(valueType, op) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be numbers."); \
-            return INTERPRET_RUNTIME_ERROR; \
+            RUNTIME_ERROR("Operands must be numbers."); \
         } \
         double b = AS_NUMBER(pop()); \
         double a = AS_NUMBER(pop()); \
         push(valueType(a op b)); \
     } while (false)
 
+    /*
+     * Dispatch. With computed gotos every handler ends in its own indirect
+     * jump through the label table (one predictor slot per opcode) instead
+     * of bouncing through the shared switch jump. --trace is chosen once
+     * here: it swaps in a table whose every entry is the tracing stub, so
+     * untraced runs never test the flag.
+     */
+#if LUAPP_COMPUTED_GOTO
+    static void* dispatchTable[UINT8_COUNT] = {
+        [OP_CONSTANT]       = &&TARGET_OP_CONSTANT,
+        [OP_NIL]            = &&TARGET_OP_NIL,
+        [OP_TRUE]           = &&TARGET_OP_TRUE,
+        [OP_FALSE]          = &&TARGET_OP_FALSE,
+        [OP_POP]            = &&TARGET_OP_POP,
+        [OP_POPN]           = &&TARGET_OP_POPN,
+        [OP_GET_LOCAL]      = &&TARGET_OP_GET_LOCAL,
+        [OP_SET_LOCAL]      = &&TARGET_OP_SET_LOCAL,
+        [OP_GET_GLOBAL]     = &&TARGET_OP_GET_GLOBAL,
+        [OP_SET_GLOBAL]     = &&TARGET_OP_SET_GLOBAL,
+        [OP_DEFINE_GLOBAL]  = &&TARGET_OP_DEFINE_GLOBAL,
+        [OP_GET_UPVALUE]    = &&TARGET_OP_GET_UPVALUE,
+        [OP_SET_UPVALUE]    = &&TARGET_OP_SET_UPVALUE,
+        [OP_CLOSE_UPVALUE]  = &&TARGET_OP_CLOSE_UPVALUE,
+        [OP_ADD]            = &&TARGET_OP_ADD,
+        [OP_SUBTRACT]       = &&TARGET_OP_SUBTRACT,
+        [OP_MULTIPLY]       = &&TARGET_OP_MULTIPLY,
+        [OP_DIVIDE]         = &&TARGET_OP_DIVIDE,
+        [OP_MODULO]         = &&TARGET_OP_MODULO,
+        [OP_NEGATE]         = &&TARGET_OP_NEGATE,
+        [OP_CONCAT]         = &&TARGET_OP_CONCAT,
+        [OP_CONCAT_N]       = &&TARGET_OP_CONCAT_N,
+        [OP_LENGTH]         = &&TARGET_OP_LENGTH,
+        [OP_NOT]            = &&TARGET_OP_NOT,
+        [OP_EQUAL]          = &&TARGET_OP_EQUAL,
+        [OP_GREATER]        = &&TARGET_OP_GREATER,
+        [OP_LESS]           = &&TARGET_OP_LESS,
+        [OP_JUMP]           = &&TARGET_OP_JUMP,
+        [OP_JUMP_IF_FALSE]  = &&TARGET_OP_JUMP_IF_FALSE,
+        [OP_LOOP]           = &&TARGET_OP_LOOP,
+        [OP_FOR_PREP]       = &&TARGET_OP_FOR_PREP,
+        [OP_FOR_LOOP]       = &&TARGET_OP_FOR_LOOP,
+        [OP_FOR_PAIRS]      = &&TARGET_OP_FOR_PAIRS,
+        [OP_FOR_IPAIRS]     = &&TARGET_OP_FOR_IPAIRS,
+        [OP_CALL]           = &&TARGET_OP_CALL,
+        [OP_CALL_MULTI]     = &&TARGET_OP_CALL_MULTI,
+        [OP_TAIL_CALL]      = &&TARGET_OP_TAIL_CALL,
+        [OP_CLOSURE]        = &&TARGET_OP_CLOSURE,
+        [OP_RETURN]         = &&TARGET_OP_RETURN,
+        [OP_RETURN_N]       = &&TARGET_OP_RETURN_N,
+        [OP_RETURN_MULTI]   = &&TARGET_OP_RETURN_MULTI,
+        [OP_VARARG]         = &&TARGET_OP_VARARG,
+        [OP_CLASS]          = &&TARGET_OP_CLASS,
+        [OP_INHERIT]        = &&TARGET_OP_INHERIT,
+        [OP_METHOD]         = &&TARGET_OP_METHOD,
+        [OP_GET_PROPERTY]   = &&TARGET_OP_GET_PROPERTY,
+        [OP_SET_PROPERTY]   = &&TARGET_OP_SET_PROPERTY,
+        [OP_GET_SUPER]      = &&TARGET_OP_GET_SUPER,
+        [OP_INVOKE]         = &&TARGET_OP_INVOKE,
+        [OP_SUPER_INVOKE]   = &&TARGET_OP_SUPER_INVOKE,
+        [OP_NEW]            = &&TARGET_OP_NEW,
+        [OP_TABLE]          = &&TARGET_OP_TABLE,
+        [OP_TABLE_GET]      = &&TARGET_OP_TABLE_GET,
+        [OP_TABLE_SET]      = &&TARGET_OP_TABLE_SET,
+        [OP_TABLE_SET_LIST] = &&TARGET_OP_TABLE_SET_LIST,
+        [OP_TABLE_SET_LIST_MULTI] = &&TARGET_OP_TABLE_SET_LIST_MULTI,
+        [OP_TABLE_SET_FIELD] = &&TARGET_OP_TABLE_SET_FIELD,
+        [OP_TABLE_SET_KEY] = &&TARGET_OP_TABLE_SET_KEY,
+        [OP_TRAIT]          = &&TARGET_OP_TRAIT,
+        [OP_IMPLEMENT]      = &&TARGET_OP_IMPLEMENT,
+    };
+    static void* traceTable[UINT8_COUNT];
+    void** dispatch = dispatchTable;
+
+    if (debugFlags.traceExecution) {
+        for (int i = 0; i < UINT8_COUNT; i++) traceTable[i] = &&trace_instruction;
+        dispatch = traceTable;
+    }
+
+#define CASE(op) TARGET_##op: case op
+#define DISPATCH() goto *dispatch[READ_BYTE()]
+
+    DISPATCH();
+
+trace_instruction:
+    traceInstruction(frame, ip - 1);
+    goto *dispatchTable[ip[-1]];
+#else
+    const bool trace = debugFlags.traceExecution;
+
+#define CASE(op) case op
+#define DISPATCH() continue
+#endif
+
     for (;;) {
-        // Runtime debug: trace execution
-        if (debugFlags.traceExecution) {
-            printf("          ");
-            for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-                printf("[ ");
-                printValue(*slot);
-                printf(" ]");
-            }
-            printf("\n");
-            disassembleInstruction(&frame->closure->function->chunk,
-                (int)(frame->ip - frame->closure->function->chunk.code));
-        }
+#if !LUAPP_COMPUTED_GOTO
+        if (trace) traceInstruction(frame, ip);
+#endif
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-            case OP_CONSTANT: {
+        switch (READ_BYTE()) {
+            CASE(OP_CONSTANT): {
                 Value constant = READ_CONSTANT();
                 push(constant);
-                break;
+                DISPATCH();
             }
-            
-            case OP_NIL:   push(NIL_VAL); break;
-            case OP_TRUE:  push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
-            case OP_POP:   pop(); break;
-            
-            case OP_POPN: {
+
+            CASE(OP_NIL):   push(NIL_VAL); DISPATCH();
+            CASE(OP_TRUE):  push(BOOL_VAL(true)); DISPATCH();
+            CASE(OP_FALSE): push(BOOL_VAL(false)); DISPATCH();
+            CASE(OP_POP):   pop(); DISPATCH();
+
+            CASE(OP_POPN): {
                 uint8_t n = READ_BYTE();
                 vm.stackTop -= n;
-                break;
+                DISPATCH();
             }
-            
-            case OP_GET_LOCAL: {
+
+            CASE(OP_GET_LOCAL): {
                 uint8_t slot = READ_BYTE();
                 push(frame->slots[slot]);
-                break;
+                DISPATCH();
             }
-            
-            case OP_SET_LOCAL: {
+
+            CASE(OP_SET_LOCAL): {
                 uint8_t slot = READ_BYTE();
                 frame->slots[slot] = peek(0);
-                break;
+                DISPATCH();
             }
-            
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+
+            CASE(OP_GET_GLOBAL): {
+                Global* global = &vm.globals[READ_SHORT()];
+                if (!global->defined) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", global->name->chars);
                 }
-                push(value);
-                break;
+                push(global->value);
+                DISPATCH();
             }
-            
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                tableSet(&vm.globals, name, peek(0));
-                pop();
-                break;
+
+            CASE(OP_DEFINE_GLOBAL): {
+                Global* global = &vm.globals[READ_SHORT()];
+                global->value = pop();
+                global->defined = true;
+                DISPATCH();
             }
-            
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
+
+            CASE(OP_SET_GLOBAL): {
+                Global* global = &vm.globals[READ_SHORT()];
+                if (!global->defined) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", global->name->chars);
                 }
-                break;
+                global->value = peek(0);
+                DISPATCH();
             }
-            
-            case OP_GET_UPVALUE: {
+
+            CASE(OP_GET_UPVALUE): {
                 uint8_t slot = READ_BYTE();
                 push(*frame->closure->upvalues[slot]->location);
-                break;
+                DISPATCH();
             }
-            
-            case OP_SET_UPVALUE: {
+
+            CASE(OP_SET_UPVALUE): {
                 uint8_t slot = READ_BYTE();
                 *frame->closure->upvalues[slot]->location = peek(0);
-                break;
+                DISPATCH();
             }
-            
-            case OP_CLOSE_UPVALUE:
+
+            CASE(OP_CLOSE_UPVALUE):
                 closeUpvalues(vm.stackTop - 1);
                 pop();
-                break;
-            
-            case OP_GET_PROPERTY: {
+                DISPATCH();
+
+            CASE(OP_GET_PROPERTY): {
+                if (IS_TABLE(peek(0))) {
+                    // t.name is t["name"]
+                    ObjString* name = AS_STRING(constants[READ_BYTE()]);
+                    Value value = objTableGetField(AS_TABLE(peek(0)), name);
+                    pop();
+                    push(value);
+                    DISPATCH();
+                }
                 if (!IS_INSTANCE(peek(0))) {
-                    runtimeError("Only instances have properties.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Only instances have properties.");
                 }
-                
+
                 ObjInstance* instance = AS_INSTANCE(peek(0));
-                ObjString* name = READ_STRING();
-                
-                Value value;
-                if (tableGet(&instance->fields, name, &value)) {
+                uint8_t index = READ_BYTE();
+                ObjString* name = AS_STRING(constants[index]);
+                InlineCache* cache = READ_CACHE(index);
+
+                int slot = lookupField(instance->shape, name, cache);
+                if (slot >= 0) {
+                    Value value = instance->fields[slot];
                     pop();
                     push(value);
-                    break;
+                    DISPATCH();
                 }
-                
-                if (!bindMethod(instance->klass, name)) {
+
+                SAVE_FRAME();
+                if (!bindMethod(instance->klass, name, cache)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                break;
+                DISPATCH();
             }
-            
-            case OP_SET_PROPERTY: {
+
+            CASE(OP_SET_PROPERTY): {
+                if (IS_TABLE(peek(1))) {
+                    ObjString* name = AS_STRING(constants[READ_BYTE()]);
+                    objTableSetField(AS_TABLE(peek(1)), name, peek(0));
+                    Value value = pop();
+                    pop();
+                    push(value);
+                    DISPATCH();
+                }
                 if (!IS_INSTANCE(peek(1))) {
-                    runtimeError("Only instances have fields.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Only instances have fields.");
                 }
-                
+
                 ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_STRING(), peek(0));
+                uint8_t index = READ_BYTE();
+                ObjString* name = AS_STRING(constants[index]);
+                int slot = lookupField(instance->shape, name, READ_CACHE(index));
+                if (slot >= 0) {
+                    instance->fields[slot] = peek(0);
+                } else {
+                    instanceSetField(instance, name, peek(0));  // New shape
+                }
                 Value value = pop();
                 pop();
                 push(value);
-                break;
+                DISPATCH();
             }
-            
-            case OP_GET_SUPER: {
-                ObjString* name = READ_STRING();
+
+            CASE(OP_GET_SUPER): {
+                uint8_t index = READ_BYTE();
+                ObjString* name = AS_STRING(constants[index]);
                 ObjClass* superclass = AS_CLASS(pop());
-                
-                if (!bindMethod(superclass, name)) {
+
+                SAVE_FRAME();
+                if (!bindMethod(superclass, name, READ_CACHE(index))) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                break;
+                DISPATCH();
             }
-            
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
+
+            CASE(OP_EQUAL): {
+                // Comparing a rope flattens it, so the operands stay rooted
+                bool equal = valuesEqual(peek(1), peek(0));
+                vm.stackTop -= 2;
+                push(BOOL_VAL(equal));
+                DISPATCH();
             }
-            
-            case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
-            case OP_ADD:      BINARY_OP(NUMBER_VAL, +); break;
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
-            
-            case OP_MODULO: {
+
+            CASE(OP_GREATER):  BINARY_OP(BOOL_VAL, >); DISPATCH();
+            CASE(OP_LESS):     BINARY_OP(BOOL_VAL, <); DISPATCH();
+            CASE(OP_ADD):      BINARY_OP(NUMBER_VAL, +); DISPATCH();
+            CASE(OP_SUBTRACT): BINARY_OP(NUMBER_VAL, -); DISPATCH();
+            CASE(OP_MULTIPLY): BINARY_OP(NUMBER_VAL, *); DISPATCH();
+            CASE(OP_DIVIDE):   BINARY_OP(NUMBER_VAL, /); DISPATCH();
+
+            CASE(OP_MODULO): {
                 if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-                    runtimeError("Operands must be numbers.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Operands must be numbers.");
                 }
                 double b = AS_NUMBER(pop());
                 double a = AS_NUMBER(pop());
                 push(NUMBER_VAL((int)a % (int)b));
-                break;
+                DISPATCH();
             }
-            
-            case OP_CONCAT: {
-                if (!IS_STRING(peek(0)) || !IS_STRING(peek(1))) {
-                    runtimeError("Operands must be strings.");
-                    return INTERPRET_RUNTIME_ERROR;
+
+            CASE(OP_CONCAT): {
+                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                    concatenate();
+                    DISPATCH();
                 }
-                concatenate();
-                break;
+                if (!IS_STRING(peek(0)) && !IS_NUMBER(peek(0))) {
+                    RUNTIME_ERROR("Operands must be strings or numbers.");
+                }
+                if (!IS_STRING(peek(1)) && !IS_NUMBER(peek(1))) {
+                    RUNTIME_ERROR("Operands must be strings or numbers.");
+                }
+                concatenateN(2);
+                DISPATCH();
             }
-            
-            case OP_NOT:
+
+            CASE(OP_CONCAT_N): {
+                int count = READ_BYTE();
+                for (Value* piece = vm.stackTop - count; piece < vm.stackTop; piece++) {
+                    if (!IS_STRING(*piece) && !IS_NUMBER(*piece)) {
+                        RUNTIME_ERROR("Operands must be strings or numbers.");
+                    }
+                }
+                concatenateN(count);
+                DISPATCH();
+            }
+
+            CASE(OP_NOT):
                 push(BOOL_VAL(isFalsey(pop())));
-                break;
-            
-            case OP_NEGATE:
+                DISPATCH();
+
+            CASE(OP_NEGATE):
                 if (!IS_NUMBER(peek(0))) {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Operand must be a number.");
                 }
                 push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
-            
-            case OP_LENGTH: {
+                DISPATCH();
+
+            CASE(OP_LENGTH): {
                 Value val = pop();
                 if (IS_STRING(val)) {
-                    push(NUMBER_VAL(AS_STRING(val)->length));
+                    push(NUMBER_VAL(stringLength(val)));
                 } else if (IS_TABLE(val)) {
-                    push(NUMBER_VAL(AS_TABLE(val)->array.count));
+                    push(NUMBER_VAL(objTableLength(AS_TABLE(val))));
                 } else {
-                    runtimeError("Can only get length of string or table.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Can only get length of string or table.");
                 }
-                break;
+                DISPATCH();
             }
-            
-            case OP_JUMP: {
+
+            CASE(OP_JUMP): {
                 uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+                ip += offset;
+                DISPATCH();
             }
-            
-            case OP_JUMP_IF_FALSE: {
+
+            CASE(OP_JUMP_IF_FALSE): {
                 uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0))) frame->ip += offset;
-                break;
+                if (isFalsey(peek(0))) ip += offset;
+                DISPATCH();
             }
-            
-            case OP_LOOP: {
+
+            CASE(OP_LOOP): {
                 uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
+                ip -= offset;
+                DISPATCH();
             }
-            
-            case OP_CALL: {
+
+            CASE(OP_FOR_PREP): {
+                // Slots: index, limit, step (the loop variable goes on top)
+                Value* loop = &frame->slots[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                if (!IS_NUMBER(loop[0])) RUNTIME_ERROR("'for' initial value must be a number.");
+                if (!IS_NUMBER(loop[1])) RUNTIME_ERROR("'for' limit must be a number.");
+                if (!IS_NUMBER(loop[2])) RUNTIME_ERROR("'for' step must be a number.");
+                double step = AS_NUMBER(loop[2]);
+                if (step == 0) RUNTIME_ERROR("'for' step is zero.");
+                double index = AS_NUMBER(loop[0]);
+                double limit = AS_NUMBER(loop[1]);
+                if (step > 0 ? index <= limit : index >= limit) {
+                    push(loop[0]);
+                } else {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+
+            CASE(OP_FOR_LOOP): {
+                Value* loop = &frame->slots[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                double step = AS_NUMBER(loop[2]);
+                double index = AS_NUMBER(loop[0]) + step;
+                double limit = AS_NUMBER(loop[1]);
+                if (step > 0 ? index <= limit : index >= limit) {
+                    loop[0] = NUMBER_VAL(index);
+                    push(loop[0]);
+                    ip -= offset;
+                }
+                DISPATCH();
+            }
+
+            CASE(OP_FOR_PAIRS): {
+                // Slots: table, position (key and value go on top)
+                Value* loop = &frame->slots[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                if (IS_NATIVE(loop[0]) || IS_CLOSURE(loop[0]) || IS_BOUND_METHOD(loop[0])) {
+                    // An iterator function (string.gmatch): each call gives
+                    // the loop variables, until the first of them is nil
+                    push(loop[0]);
+                    SAVE_FRAME();
+                    if (!callFunction(0, 2)) return INTERPRET_RUNTIME_ERROR;
+                    LOAD_FRAME();
+                    if (IS_NIL(peek(1))) {
+                        vm.stackTop -= 2;
+                        ip += offset;
+                    }
+                    DISPATCH();
+                }
+                if (!IS_TABLE(loop[0])) {
+                    RUNTIME_ERROR("Can only iterate over tables and functions.");
+                }
+                // Array part first, skipping holes, then the hash part
+                int cursor = (int)AS_NUMBER(loop[1]);
+                Value key, value;
+                if (objTableNext(AS_TABLE(loop[0]), &cursor, &key, &value)) {
+                    loop[1] = NUMBER_VAL(cursor);
+                    push(key);
+                    push(value);
+                } else {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+
+            CASE(OP_FOR_IPAIRS): {
+                Value* loop = &frame->slots[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                if (!IS_TABLE(loop[0])) RUNTIME_ERROR("Can only iterate over tables.");
+                ObjTable* table = AS_TABLE(loop[0]);
+                int position = (int)AS_NUMBER(loop[1]);
+                if (position < table->array.count &&
+                    !IS_NIL(table->array.values[position])) {
+                    loop[1] = NUMBER_VAL(position + 1);
+                    push(loop[1]);
+                    push(table->array.values[position]);
+                } else {
+                    ip += offset;
+                }
+                DISPATCH();
+            }
+
+            CASE(OP_CALL): {
                 int argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount)) {
+                int results = READ_BYTE();
+                SAVE_FRAME();
+                if (!callValue(peek(argCount), argCount, results)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                LOAD_FRAME();
+                DISPATCH();
             }
-            
-            case OP_INVOKE: {
-                ObjString* method = READ_STRING();
+
+            CASE(OP_CALL_MULTI): {
                 int argCount = READ_BYTE();
-                if (!invoke(method, argCount)) {
+                int results = READ_BYTE();
+                argCount += (int)AS_NUMBER(pop());
+                SAVE_FRAME();
+                if (!callValue(peek(argCount), argCount, results)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                LOAD_FRAME();
+                DISPATCH();
             }
-            
-            case OP_SUPER_INVOKE: {
-                ObjString* method = READ_STRING();
+
+            CASE(OP_TAIL_CALL): {
                 int argCount = READ_BYTE();
+                int results = READ_BYTE();
+                Value callee = peek(argCount);
+                if (IS_BOUND_METHOD(callee)) {
+                    ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+                    vm.stackTop[-argCount - 1] = bound->receiver;
+                    callee = OBJ_VAL(bound->method);
+                }
+                SAVE_FRAME();
+                
+                if (!IS_CLOSURE(callee)) {
+                    // Natives and errors: an ordinary call, whose values the
+                    // OP_RETURN_MULTI after this instruction hands back
+                    if (!callValue(callee, argCount, results)) {
+                        return INTERPRET_RUNTIME_ERROR;
+                    }
+                    LOAD_FRAME();
+                    DISPATCH();
+                }
+                
+                // Replace this frame: slide callee and arguments down to
+                // where its results would have gone and call from there
+                closeUpvalues(frame->slots);
+                Value* base = frameBase(frame);
+                memmove(base, vm.stackTop - argCount - 1, sizeof(Value) * (argCount + 1));
+                vm.stackTop = base + argCount + 1;
+                vm.frameCount--;
+                if (!call(AS_CLOSURE(callee), argCount, frame->results)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                LOAD_FRAME();
+                DISPATCH();
+            }
+
+            CASE(OP_INVOKE): {
+                uint8_t index = READ_BYTE();
+                ObjString* method = AS_STRING(constants[index]);
+                int argCount = READ_BYTE();
+                int results = READ_BYTE();
+                SAVE_FRAME();
+                if (!invoke(method, argCount, results, READ_CACHE(index))) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                LOAD_FRAME();
+                DISPATCH();
+            }
+
+            CASE(OP_SUPER_INVOKE): {
+                uint8_t index = READ_BYTE();
+                ObjString* method = AS_STRING(constants[index]);
+                int argCount = READ_BYTE();
+                int results = READ_BYTE();
                 ObjClass* superclass = AS_CLASS(pop());
-                if (!invokeFromClass(superclass, method, argCount)) {
+                SAVE_FRAME();
+                if (!invokeFromClass(superclass, method, argCount, results,
+                                     READ_CACHE(index))) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                LOAD_FRAME();
+                DISPATCH();
             }
-            
-            case OP_CLOSURE: {
+
+            CASE(OP_CLOSURE): {
                 ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
                 ObjClosure* closure = newClosure(function);
                 push(OBJ_VAL(closure));
@@ -947,206 +1609,245 @@ static InterpretResult run(void) {
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
                 }
-                break;
+                DISPATCH();
             }
-            
-            case OP_RETURN: {
+
+            CASE(OP_RETURN): {
                 Value result = pop();
                 closeUpvalues(frame->slots);
                 vm.frameCount--;
-                if (vm.frameCount == 0) {
-                    pop();
-                    return INTERPRET_OK;
+                Value* base = frameBase(frame);
+                if (frame->results == 1) {
+                    *base = result;
+                    vm.stackTop = base + 1;
+                } else {
+                    placeResults(base, &result, 1, frame->results);
                 }
-                
-                vm.stackTop = frame->slots;
-                push(result);
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                if (vm.frameCount == baseFrame) return INTERPRET_OK;
+
+                LOAD_FRAME();
+                DISPATCH();
             }
-            
-            case OP_CLASS:
+
+            CASE(OP_RETURN_N): {
+                int count = READ_BYTE();
+                closeUpvalues(frame->slots);
+                vm.frameCount--;
+                placeResults(frameBase(frame), vm.stackTop - count, count, frame->results);
+                if (vm.frameCount == baseFrame) return INTERPRET_OK;
+
+                LOAD_FRAME();
+                DISPATCH();
+            }
+
+            CASE(OP_RETURN_MULTI): {
+                int count = READ_BYTE();
+                count += (int)AS_NUMBER(pop());
+                closeUpvalues(frame->slots);
+                vm.frameCount--;
+                placeResults(frameBase(frame), vm.stackTop - count, count, frame->results);
+                if (vm.frameCount == baseFrame) return INTERPRET_OK;
+
+                LOAD_FRAME();
+                DISPATCH();
+            }
+
+            CASE(OP_VARARG): {
+                int results = READ_BYTE();
+                int count = frame->varargCount;
+                if (!reserveStack(count + 1)) RUNTIME_ERROR("Stack overflow.");
+                Value* varargs = frame->slots - count;
+                if (results == MULTI_RESULTS) {
+                    for (int i = 0; i < count; i++) push(varargs[i]);
+                    push(NUMBER_VAL(count));
+                } else {
+                    for (int i = 0; i < results; i++) {
+                        push(i < count ? varargs[i] : NIL_VAL);
+                    }
+                }
+                DISPATCH();
+            }
+
+            CASE(OP_CLASS):
                 push(OBJ_VAL(newClass(READ_STRING())));
-                break;
-            
-            case OP_INHERIT: {
+                DISPATCH();
+
+            CASE(OP_INHERIT): {
                 Value superclass = peek(1);
                 if (!IS_CLASS(superclass)) {
-                    runtimeError("Superclass must be a class.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Superclass must be a class.");
                 }
-                
+
                 ObjClass* subclass = AS_CLASS(peek(0));
                 tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
                 subclass->superclass = AS_CLASS(superclass);
                 pop();
-                break;
+                DISPATCH();
             }
-            
-            case OP_METHOD: {
+
+            CASE(OP_METHOD): {
                 ObjString* name = READ_STRING();
                 bool isPrivate = READ_BYTE();
                 defineMethod(name, isPrivate);
-                break;
+                DISPATCH();
             }
-            
-            case OP_NEW: {
+
+            CASE(OP_NEW): {
                 int argCount = READ_BYTE();
                 Value klass = peek(argCount);
-                
+
                 if (!IS_CLASS(klass)) {
-                    runtimeError("Can only instantiate classes.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Can only instantiate classes.");
                 }
-                
+
                 ObjInstance* instance = newInstance(AS_CLASS(klass));
                 vm.stackTop[-argCount - 1] = OBJ_VAL(instance);
-                
+
                 // Call init if it exists
                 Value initializer;
                 if (tableGet(&AS_CLASS(klass)->methods, vm.initString, &initializer)) {
-                    if (!call(AS_CLOSURE(initializer), argCount)) {
+                    SAVE_FRAME();
+                    if (!call(AS_CLOSURE(initializer), argCount, 1)) {
                         return INTERPRET_RUNTIME_ERROR;
                     }
-                    frame = &vm.frames[vm.frameCount - 1];
+                    LOAD_FRAME();
                 } else if (argCount != 0) {
-                    runtimeError("Expected 0 arguments but got %d.", argCount);
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Expected 0 arguments but got %d.", argCount);
                 }
-                break;
+                DISPATCH();
             }
-            
-            case OP_TABLE: {
-                push(OBJ_VAL(newTable()));
-                break;
+
+            CASE(OP_TABLE): {
+                int arraySize = READ_SHORT();
+                int hashSize = READ_SHORT();
+                ObjTable* table = newTable();
+                push(OBJ_VAL(table));
+                objTableReserve(table, arraySize, hashSize);
+                DISPATCH();
             }
-            
-            case OP_TABLE_GET: {
-                Value key = pop();
-                Value tableVal = pop();
-                
+
+            CASE(OP_TABLE_GET): {
+                // Operands stay on the stack: a rope key is flattened
+                // (which allocates) before the lookup
+                Value key = peek(0);
+                Value tableVal = peek(1);
+
                 if (!IS_TABLE(tableVal)) {
-                    runtimeError("Can only index tables.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Can only index tables.");
                 }
-                
+
                 ObjTable* table = AS_TABLE(tableVal);
-                
-                // Integer key -> array access
-                if (IS_NUMBER(key)) {
-                    int index = (int)AS_NUMBER(key);
-                    if (index >= 1 && index <= table->array.count) {
-                        push(table->array.values[index - 1]);  // Lua is 1-indexed
-                        break;
-                    }
-                }
-                
-                // String key -> hash access
-                if (IS_STRING(key)) {
-                    Value value;
-                    if (tableGet(&table->entries, AS_STRING(key), &value)) {
-                        push(value);
-                        break;
-                    }
+                Value value;
+
+                // Integer key in the array part: no call needed
+                double number;
+                if (IS_NUMBER(key) && (number = AS_NUMBER(key)) >= 1 &&
+                    number <= table->array.count && number == (double)(int)number) {
+                    value = table->array.values[(int)number - 1];  // Lua is 1-indexed
+                } else {
+                    value = objTableGet(table, key);
                 }
-                
-                push(NIL_VAL);  // Key not found
-                break;
+                vm.stackTop -= 2;
+                push(value);
+                DISPATCH();
             }
-            
-            case OP_TABLE_SET: {
-                Value value = pop();
-                Value key = pop();
-                Value tableVal = pop();
-                
+
+            CASE(OP_TABLE_SET): {
+                // Operands stay on the stack (GC roots) until the store is done
+                Value value = peek(0);
+                Value key = peek(1);
+                Value tableVal = peek(2);
+
                 if (!IS_TABLE(tableVal)) {
-                    runtimeError("Can only index tables.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Can only index tables.");
                 }
-                
+
                 ObjTable* table = AS_TABLE(tableVal);
-                
-                // Integer key -> array access
-                if (IS_NUMBER(key)) {
-                    int index = (int)AS_NUMBER(key);
-                    if (index >= 1) {
-                        // Grow array if needed
-                        while (table->array.count < index) {
-                            writeValueArray(&table->array, NIL_VAL);
-                        }
-                        table->array.values[index - 1] = value;
-                        push(value);
-                        break;
-                    }
-                }
-                
-                // String key -> hash access
-                if (IS_STRING(key)) {
-                    tableSet(&table->entries, AS_STRING(key), value);
-                    push(value);
-                    break;
+
+                // Overwriting an array element: no call needed
+                double number;
+                if (IS_NUMBER(key) && !IS_NIL(value) && (number = AS_NUMBER(key)) >= 1 &&
+                    number <= table->array.count && number == (double)(int)number) {
+                    table->array.values[(int)number - 1] = value;
+                } else if (!objTableSet(table, key, value)) {
+                    RUNTIME_ERROR("Table index is %s.", IS_NIL(key) ? "nil" : "NaN");
                 }
-                
-                runtimeError("Table key must be a string or positive integer.");
-                return INTERPRET_RUNTIME_ERROR;
+                vm.stackTop -= 3;
+                push(value);
+                DISPATCH();
             }
-            
-            case OP_TABLE_ADD: {
-                // Add value to array part of table (for literal construction)
-                Value value = pop();
-                Value tableVal = peek(0);
-                
-                if (!IS_TABLE(tableVal)) {
-                    runtimeError("Expected table.");
-                    return INTERPRET_RUNTIME_ERROR;
-                }
-                
-                ObjTable* table = AS_TABLE(tableVal);
-                writeValueArray(&table->array, value);
-                break;
+
+            CASE(OP_TABLE_SET_LIST): {
+                // Values stay on the stack (GC roots) until they are stored
+                int count = READ_BYTE();
+                int start = READ_SHORT();
+                Value* values = vm.stackTop - count;
+                objTableSetList(AS_TABLE(values[-1]), start, values, count);
+                vm.stackTop = values;
+                DISPATCH();
             }
-            
-            case OP_TABLE_SET_FIELD: {
+
+            CASE(OP_TABLE_SET_LIST_MULTI): {
+                // Items before the call, then all of its values and their count
+                int count = READ_BYTE();
+                int start = READ_SHORT();
+                count += (int)AS_NUMBER(pop());
+                Value* values = vm.stackTop - count;
+                objTableSetList(AS_TABLE(values[-1]), start, values, count);
+                vm.stackTop = values;
+                DISPATCH();
+            }
+
+            CASE(OP_TABLE_SET_FIELD): {
                 // Set named field during table literal construction: {name = value}
                 ObjString* name = READ_STRING();
-                Value value = pop();
-                Value tableVal = peek(0);
-                
+                Value value = peek(0);
+                Value tableVal = peek(1);
+
                 if (!IS_TABLE(tableVal)) {
-                    runtimeError("Expected table.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Expected table.");
                 }
-                
+
                 ObjTable* table = AS_TABLE(tableVal);
-                tableSet(&table->entries, name, value);
-                break;
+                objTableSetField(table, name, value);
+                pop();
+                DISPATCH();
             }
-            
-            case OP_TRAIT: {
+
+            CASE(OP_TABLE_SET_KEY): {
+                // Set [key] = value during table literal construction
+                Value value = peek(0);
+                Value key = peek(1);
+                if (!objTableSet(AS_TABLE(peek(2)), key, value)) {
+                    RUNTIME_ERROR("Table index is %s.", IS_NIL(key) ? "nil" : "NaN");
+                }
+                vm.stackTop -= 2;
+                DISPATCH();
+            }
+
+            CASE(OP_TRAIT): {
                 push(OBJ_VAL(newTrait(READ_STRING())));
-                break;
+                DISPATCH();
             }
-            
-            case OP_IMPLEMENT: {
+
+            CASE(OP_IMPLEMENT): {
                 // Stack: trait, class (class on top)
                 Value classVal = pop();
                 Value traitVal = pop();
-                
+
                 if (!IS_TRAIT(traitVal)) {
-                    runtimeError("Can only implement traits.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Can only implement traits.");
                 }
                 if (!IS_CLASS(classVal)) {
-                    runtimeError("Only classes can implement traits.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Only classes can implement traits.");
                 }
-                
+
                 ObjTrait* trait = AS_TRAIT(traitVal);
                 ObjClass* klass = AS_CLASS(classVal);
-                
+
                 // Copy all methods from trait to class
                 tableAddAll(&trait->methods, &klass->methods);
-                break;
+                DISPATCH();
             }
         }
     }
@@ -1155,9 +1856,19 @@ static InterpretResult run(void) {
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_CACHE
+#undef SAVE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
 #undef BINARY_OP
+#undef CASE
+#undef DISPATCH
 }
 
+#if LUAPP_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
 InterpretResult interpret(const char* source) {
     return interpretWithFilename(source, NULL);
 }
@@ -1170,9 +1881,24 @@ InterpretResult interpretWithFilename(const char* source, const char* filename)
     ObjClosure* closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
-    call(closure, 0);
+    call(closure, 0, 1);
     
-    return run();
+    InterpretResult result = run(0);
+    if (result == INTERPRET_OK) pop();  /* Discard the script's return value */
+    flushOutput(&vm.output);
+    return result;
+}
+
+/* Callee under the top argCount values; 'results' values replace them all */
+bool callFunction(int argCount, int results) {
+    int frameCount = vm.frameCount;
+    if (!callValue(peek(argCount), argCount, results)) return false;
+    
+    // A closure got a frame: run until it returns
+    if (vm.frameCount > frameCount && run(vm.frameCount - 1) != INTERPRET_OK) {
+        return false;
+    }
+    return true;
 }
 
 /*
@@ -1186,13 +1912,16 @@ InterpretResult interpretWithFilename(const char* source, const char* filename)
  */
 bool callClosure(ObjClosure* closure, int argCount, Value* args, Value* result) {
     /* Check arity */
-    if (argCount != closure->function->arity) {
+    if (argCount != closure->function->arity &&
+        !(closure->function->isVararg && argCount > closure->function->arity)) {
         if (result) *result = NIL_VAL;
         return false;
     }
     
-    /* Save the frame count - we'll run until we return to this level */
-    int baseFrameCount = vm.frameCount;
+    if (!reserveStack(argCount + 1)) {
+        if (result) *result = NIL_VAL;
+        return false;
+    }
     
     /* Push the closure as the callee */
     push(OBJ_VAL(closure));
@@ -1203,417 +1932,21 @@ bool callClosure(ObjClosure* closure, int argCount, Value* args, Value* result)
     }
     
     /* Set up call frame */
-    if (!call(closure, argCount)) {
-        /* Pop the closure and args on failure */
-        vm.stackTop -= argCount + 1;
+    if (!call(closure, argCount, 1)) {
+        /* runtimeError() has already reset the stack */
         if (result) *result = NIL_VAL;
         return false;
     }
     
-    /* Run the VM - it will execute until OP_RETURN brings frameCount back */
-    CallFrame* frame = &vm.frames[vm.frameCount - 1];
-
-/* Local macros for bytecode reading */
-#define CC_READ_BYTE() (*frame->ip++)
-#define CC_READ_SHORT() \
-    (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define CC_READ_CONSTANT() \
-    (frame->closure->function->chunk.constants.values[CC_READ_BYTE()])
-#define CC_READ_STRING() AS_STRING(CC_READ_CONSTANT())
-#define CC_FAIL() do { if (result) *result = NIL_VAL; return false; } while(0)
-
-    for (;;) {
-        uint8_t instruction = CC_READ_BYTE();
-        
-        switch (instruction) {
-            case OP_RETURN: {
-                Value returnValue = pop();
-                closeUpvalues(frame->slots);
-                vm.frameCount--;
-                
-                if (vm.frameCount <= baseFrameCount) {
-                    /* We've returned from the called function */
-                    vm.stackTop = frame->slots;
-                    if (result) *result = returnValue;
-                    return true;
-                }
-                
-                vm.stackTop = frame->slots;
-                push(returnValue);
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
-            
-            case OP_CONSTANT: {
-                Value constant = CC_READ_CONSTANT();
-                push(constant);
-                break;
-            }
-            case OP_NIL:   push(NIL_VAL); break;
-            case OP_TRUE:  push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
-            case OP_POP:   pop(); break;
-            
-            case OP_GET_LOCAL: {
-                uint8_t slot = CC_READ_BYTE();
-                push(frame->slots[slot]);
-                break;
-            }
-            case OP_SET_LOCAL: {
-                uint8_t slot = CC_READ_BYTE();
-                frame->slots[slot] = peek(0);
-                break;
-            }
-            case OP_GET_GLOBAL: {
-                ObjString* name = CC_READ_STRING();
-                Value value;
-                if (!tableGet(&vm.globals, name, &value)) {
-                    CC_FAIL();
-                }
-                push(value);
-                break;
-            }
-            
-            case OP_ADD: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) CC_FAIL();
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a + b));
-                break;
-            }
-            case OP_SUBTRACT: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) CC_FAIL();
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a - b));
-                break;
-            }
-            case OP_MULTIPLY: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) CC_FAIL();
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a * b));
-                break;
-            }
-            case OP_DIVIDE: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) CC_FAIL();
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a / b));
-                break;
-            }
-            case OP_NEGATE: {
-                if (!IS_NUMBER(peek(0))) CC_FAIL();
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
-            }
-            case OP_NOT: {
-                push(BOOL_VAL(isFalsey(pop())));
-                break;
-            }
-            
-            case OP_LESS: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) CC_FAIL();
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(BOOL_VAL(a < b));
-                break;
-            }
-            case OP_GREATER: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) CC_FAIL();
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(BOOL_VAL(a > b));
-                break;
-            }
-            case OP_EQUAL: {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
-            }
-            
-            case OP_JUMP: {
-                uint16_t offset = CC_READ_SHORT();
-                frame->ip += offset;
-                break;
-            }
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = CC_READ_SHORT();
-                if (isFalsey(peek(0))) frame->ip += offset;
-                break;
-            }
-            case OP_LOOP: {
-                uint16_t offset = CC_READ_SHORT();
-                frame->ip -= offset;
-                break;
-            }
-            
-            case OP_CALL: {
-                int callArgCount = CC_READ_BYTE();
-                if (!callValue(peek(callArgCount), callArgCount)) {
-                    CC_FAIL();
-                }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
-            
-            case OP_CONCAT: {
-                if (!IS_STRING(peek(0)) || !IS_STRING(peek(1))) CC_FAIL();
-                ObjString* b = AS_STRING(peek(0));
-                ObjString* a = AS_STRING(peek(1));
-                int length = a->length + b->length;
-                char* chars = ALLOCATE(char, length + 1);
-                memcpy(chars, a->chars, a->length);
-                memcpy(chars + a->length, b->chars, b->length);
-                chars[length] = '\0';
-                ObjString* str = takeString(chars, length);
-                pop();
-                pop();
-                push(OBJ_VAL(str));
-                break;
-            }
-            
-            case OP_POPN: {
-                uint8_t n = CC_READ_BYTE();
-                vm.stackTop -= n;
-                break;
-            }
-            
-            /* ========== Upvalues and Closures ========== */
-            
-            case OP_GET_UPVALUE: {
-                uint8_t slot = CC_READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
-                break;
-            }
-            
-            case OP_SET_UPVALUE: {
-                uint8_t slot = CC_READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
-                break;
-            }
-            
-            case OP_CLOSE_UPVALUE: {
-                closeUpvalues(vm.stackTop - 1);
-                pop();
-                break;
-            }
-            
-            case OP_CLOSURE: {
-                ObjFunction* function = AS_FUNCTION(CC_READ_CONSTANT());
-                ObjClosure* closure = newClosure(function);
-                push(OBJ_VAL(closure));
-                for (int i = 0; i < closure->upvalueCount; i++) {
-                    uint8_t isLocal = CC_READ_BYTE();
-                    uint8_t index = CC_READ_BYTE();
-                    if (isLocal) {
-                        closure->upvalues[i] = captureUpvalue(frame->slots + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    }
-                }
-                break;
-            }
-            
-            /* ========== Global Variables ========== */
-            
-            case OP_SET_GLOBAL: {
-                ObjString* name = CC_READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0))) {
-                    tableDelete(&vm.globals, name);
-                    CC_FAIL();
-                }
-                break;
-            }
-            
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = CC_READ_STRING();
-                tableSet(&vm.globals, name, peek(0));
-                pop();
-                break;
-            }
-            
-            /* ========== OOP Operations ========== */
-            
-            case OP_GET_PROPERTY: {
-                if (!IS_INSTANCE(peek(0))) CC_FAIL();
-                ObjInstance* instance = AS_INSTANCE(peek(0));
-                ObjString* name = CC_READ_STRING();
-                
-                Value value;
-                if (tableGet(&instance->fields, name, &value)) {
-                    pop();
-                    push(value);
-                    break;
-                }
-                
-                if (!bindMethod(instance->klass, name)) {
-                    CC_FAIL();
-                }
-                break;
-            }
-            
-            case OP_SET_PROPERTY: {
-                if (!IS_INSTANCE(peek(1))) CC_FAIL();
-                ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, CC_READ_STRING(), peek(0));
-                Value value = pop();
-                pop();
-                push(value);
-                break;
-            }
-            
-            case OP_INVOKE: {
-                ObjString* method = CC_READ_STRING();
-                int invokeArgCount = CC_READ_BYTE();
-                if (!invoke(method, invokeArgCount)) {
-                    CC_FAIL();
-                }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
-            
-            case OP_NEW: {
-                int newArgCount = CC_READ_BYTE();
-                Value klassVal = peek(newArgCount);
-                
-                if (!IS_CLASS(klassVal)) CC_FAIL();
-                
-                ObjInstance* instance = newInstance(AS_CLASS(klassVal));
-                vm.stackTop[-newArgCount - 1] = OBJ_VAL(instance);
-                
-                Value initializer;
-                if (tableGet(&AS_CLASS(klassVal)->methods, vm.initString, &initializer)) {
-                    if (!call(AS_CLOSURE(initializer), newArgCount)) {
-                        CC_FAIL();
-                    }
-                    frame = &vm.frames[vm.frameCount - 1];
-                } else if (newArgCount != 0) {
-                    CC_FAIL();
-                }
-                break;
-            }
-            
-            /* ========== Table Operations ========== */
-            
-            case OP_TABLE: {
-                push(OBJ_VAL(newTable()));
-                break;
-            }
-            
-            case OP_TABLE_GET: {
-                Value key = pop();
-                Value tableVal = pop();
-                
-                if (!IS_TABLE(tableVal)) CC_FAIL();
-                
-                ObjTable* table = AS_TABLE(tableVal);
-                
-                if (IS_NUMBER(key)) {
-                    int index = (int)AS_NUMBER(key);
-                    if (index >= 1 && index <= table->array.count) {
-                        push(table->array.values[index - 1]);
-                        break;
-                    }
-                }
-                
-                if (IS_STRING(key)) {
-                    Value value;
-                    if (tableGet(&table->entries, AS_STRING(key), &value)) {
-                        push(value);
-                        break;
-                    }
-                }
-                
-                push(NIL_VAL);
-                break;
-            }
-            
-            case OP_TABLE_SET: {
-                Value value = pop();
-                Value key = pop();
-                Value tableVal = pop();
-                
-                if (!IS_TABLE(tableVal)) CC_FAIL();
-                
-                ObjTable* table = AS_TABLE(tableVal);
-                
-                if (IS_NUMBER(key)) {
-                    int index = (int)AS_NUMBER(key);
-                    if (index >= 1) {
-                        while (table->array.count < index) {
-                            writeValueArray(&table->array, NIL_VAL);
-                        }
-                        table->array.values[index - 1] = value;
-                        push(value);
-                        break;
-                    }
-                }
-                
-                if (IS_STRING(key)) {
-                    tableSet(&table->entries, AS_STRING(key), value);
-                    push(value);
-                    break;
-                }
-                
-                CC_FAIL();
-            }
-            
-            case OP_TABLE_ADD: {
-                Value value = pop();
-                Value tableVal = peek(0);
-                
-                if (!IS_TABLE(tableVal)) CC_FAIL();
-                
-                ObjTable* table = AS_TABLE(tableVal);
-                writeValueArray(&table->array, value);
-                break;
-            }
-            
-            case OP_TABLE_SET_FIELD: {
-                ObjString* name = CC_READ_STRING();
-                Value value = pop();
-                Value tableVal = peek(0);
-                
-                if (!IS_TABLE(tableVal)) CC_FAIL();
-                
-                ObjTable* table = AS_TABLE(tableVal);
-                tableSet(&table->entries, name, value);
-                break;
-            }
-            
-            /* ========== Additional Operations ========== */
-            
-            case OP_MODULO: {
-                if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) CC_FAIL();
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL((int)a % (int)b));
-                break;
-            }
-            
-            case OP_LENGTH: {
-                Value val = pop();
-                if (IS_STRING(val)) {
-                    push(NUMBER_VAL(AS_STRING(val)->length));
-                } else if (IS_TABLE(val)) {
-                    push(NUMBER_VAL(AS_TABLE(val)->array.count));
-                } else {
-                    CC_FAIL();
-                }
-                break;
-            }
-            
-            default:
-                /* Unhandled opcode in mini-interpreter */
-                CC_FAIL();
-        }
+    /* Run the shared interpreter loop until this call's frame returns */
+    InterpretResult status = run(vm.frameCount - 1);
+    flushOutput(&vm.output);
+    if (status != INTERPRET_OK) {
+        if (result) *result = NIL_VAL;
+        return false;
     }
-
-#undef CC_READ_BYTE
-#undef CC_READ_SHORT
-#undef CC_READ_CONSTANT
-#undef CC_READ_STRING
-#undef CC_FAIL
+    
+    Value returnValue = pop();
+    if (result) *result = returnValue;
+    return true;
 }
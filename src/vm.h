@@ -8,30 +8,64 @@
 #define luapp_vm_h
 
 #include "chunk.h"
+#include "hash.h"
+#include "iolib.h"
 #include "object.h"
+#include "pattern.h"
 #include "table.h"
 #include "value.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+/*
+ * The value stack and frame array start small and grow on demand. Growing
+ * the stack moves it, so frame slots and open upvalues are rebased; code
+ * holding a raw Value* across anything that can call must re-derive it.
+ */
+#define FRAMES_INITIAL 16
+#define FRAMES_MAX 100000               // Call depth limit ("Stack overflow.")
+#define STACK_INITIAL (UINT8_COUNT * 4)
+#define STACK_MAX 1000000               // Value slots limit
+#define FRAME_SLOTS (UINT8_COUNT * 2)   // Room reserved above each new frame
 
 /* Call frame - one per function invocation */
 typedef struct {
     ObjClosure* closure;
     uint8_t* ip;            // Instruction pointer into closure's chunk
     Value* slots;           // First stack slot for this frame
+    int varargCount;        // Extra arguments, kept just below slots
+    int results;            // Values the caller wants back (or MULTI_RESULTS)
 } CallFrame;
 
+/*
+ * Global variable slot. The compiler resolves every global name to a slot
+ * index once, so OP_GET_GLOBAL/OP_SET_GLOBAL are array accesses; the slot
+ * exists as soon as any code mentions the name, defined or not.
+ */
+typedef struct {
+    Value value;
+    ObjString* name;
+    bool defined;           // Set by OP_DEFINE_GLOBAL / defineNative
+} Global;
+
 /* VM state - global singleton */
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame* frames;
     int frameCount;
+    int frameCapacity;
     
-    Value stack[STACK_MAX];
+    Value* stack;
     Value* stackTop;
+    int stackCapacity;
     
-    Table globals;          // Global variables
+    Global* globals;        // Global variables, indexed by slot
+    int globalCount;
+    int globalCapacity;
+    Table globalSlots;      // Global name -> slot index (number)
     Table strings;          // String interning table
+    HashSeed hashSeed;      // Keys every string hash (see hash.h)
+    Table loadedModules;    // require() cache: module name -> exports
+    ObjTable* stringLib;    // Methods for string receivers (s:upper())
+    PatternCache patternCache;  // Compiled Lua patterns (see pattern.h)
+    OutputBuffer output;    // Behind print and io.write (see iolib.h)
     ObjString* initString;  // Cached "init" string for constructors
     
     ObjUpvalue* openUpvalues;  // Linked list of open upvalues
@@ -59,9 +93,45 @@ void freeVM(void);
 InterpretResult interpret(const char* source);
 InterpretResult interpretWithFilename(const char* source, const char* filename);
 
+/* Global variables by name (slow path for natives, require and interop) */
+int globalSlot(ObjString* name);  // Finds or creates the slot for name
+bool getGlobal(ObjString* name, Value* value);
+void defineGlobal(ObjString* name, Value value);
+
+/* One function of a native library; a list of them ends with {NULL, NULL} */
+typedef struct {
+    const char* name;
+    NativeFn function;
+} LibFunction;
+
+/* A table of the functions, defined as global 'name' and registered as module 'name' */
+ObjTable* openLib(const char* name, const LibFunction* functions);
+
+/*
+ * Optional integer argument of a library function: fallback when absent
+ * or nil, false unless a number with an exact integer value (as Lua 5.4
+ * requires of positions and counts).
+ */
+bool optInteger(int argCount, Value* args, int index, long long fallback, long long* out);
+
 /* Stack operations */
 void push(Value value);
 Value pop(void);
+bool reserveStack(int count);   // Room for count more pushes; may move the stack
+CallFrame* pushFrame(void);     // Next frame, growing the array (caller checks FRAMES_MAX)
+
+/*
+ * Call the value below the top argCount stack values, as OP_CALL does,
+ * and run it to completion; 'results' values replace it and its
+ * arguments. Returns false after a runtime error.
+ */
+bool callFunction(int argCount, int results);
+
+/*
+ * Report a runtime error with a stack trace and unwind the whole VM. A
+ * native that raises one must return straight away (its result is ignored).
+ */
+void runtimeError(const char* format, ...);
 
 /* Call a Lua++ closure from C code with arguments.
  * Returns true on success, false on error.
@@ -0,0 +1,45 @@
+/*
+ * script_test.h - Shared fixture for tests that run Lua++ scripts
+ *
+ * Gives each test a fresh VM, and helpers that run a script and return
+ * what it printed, or what it reported when it is expected to fail.
+ */
+
+#ifndef luapp_script_test_h
+#define luapp_script_test_h
+
+#include <gtest/gtest.h>
+#include <string>
+
+extern "C" {
+#include "vm.h"
+#include "compiler.h"
+}
+
+class ScriptTest : public ::testing::Test {
+protected:
+    void SetUp() override { initVM(); }
+    void TearDown() override { freeVM(); }
+
+    // Output of a script that must run cleanly
+    std::string run(const char* source) {
+        testing::internal::CaptureStdout();
+        InterpretResult result = interpret(source);
+        fflush(stdout);
+        std::string output = testing::internal::GetCapturedStdout();
+        EXPECT_EQ(result, INTERPRET_OK);
+        return output;
+    }
+
+    // Result of a script that must fail, with its error message
+    InterpretResult fail(const char* source, std::string* errors) {
+        testing::internal::CaptureStderr();
+        testing::internal::CaptureStdout();
+        InterpretResult result = interpret(source);
+        testing::internal::GetCapturedStdout();
+        *errors = testing::internal::GetCapturedStderr();
+        return result;
+    }
+};
+
+#endif
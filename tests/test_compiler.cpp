@@ -6,6 +6,7 @@
  */
 
 #include <gtest/gtest.h>
+#include <cstring>
 
 extern "C" {
 #include "compiler.h"
@@ -184,6 +185,35 @@ TEST_F(CompilerPrecedenceTest, ConcatPrecedence) {
     EXPECT_TRUE(compiles("local x = 1 + 2 .. 3 + 4"));  // Concat has lower precedence
 }
 
+static bool hasInstruction(ObjFunction* fn, uint8_t op, uint8_t operand) {
+    Chunk* chunk = &fn->chunk;
+    for (int i = 0; i + 1 < chunk->count; i++) {
+        if (chunk->code[i] == op && chunk->code[i + 1] == operand) return true;
+    }
+    return false;
+}
+
+static bool hasStringConstant(ObjFunction* fn, const char* text) {
+    for (int i = 0; i < fn->chunk.constants.count; i++) {
+        Value value = fn->chunk.constants.values[i];
+        if (IS_STRING(value) && strcmp(AS_CSTRING(value), text) == 0) return true;
+    }
+    return false;
+}
+
+TEST_F(CompilerPrecedenceTest, ConcatChainIsOneInstruction) {
+    ObjFunction* fn = compile("local a = \"x\" local b = a .. \", \" .. a .. \"!\"");
+    ASSERT_NE(fn, nullptr);
+    EXPECT_TRUE(hasInstruction(fn, OP_CONCAT_N, 4));
+    
+    // Neighbouring constants, numbers included, fold into one operand
+    fn = compile("local a = \"x\" local b = \"<\" .. 1 .. \".\" .. 5 .. \">\" .. a .. \"!\" .. \"?\"");
+    ASSERT_NE(fn, nullptr);
+    EXPECT_TRUE(hasStringConstant(fn, "<1.5>"));
+    EXPECT_TRUE(hasStringConstant(fn, "!?"));
+    EXPECT_TRUE(hasInstruction(fn, OP_CONCAT_N, 3));
+}
+
 // ============== Scope Tests ==============
 
 class CompilerScopeTest : public ::testing::Test {
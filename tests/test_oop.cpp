@@ -6,6 +6,7 @@
  */
 
 #include <gtest/gtest.h>
+#include "script_test.h"
 
 extern "C" {
 #include "vm.h"
@@ -735,3 +736,129 @@ TEST_F(OOPComplexTest, RecursiveDataStructure) {
         n2:setNext(n3)
     )"), INTERPRET_OK);
 }
+
+// ============== Inline Cache Tests ==============
+
+class OOPInlineCacheTest : public ScriptTest {};
+
+TEST_F(OOPInlineCacheTest, PolymorphicInvokeSite) {
+    // One call site sees three classes, more than the cache holds
+    EXPECT_EQ(run(R"(
+        class A function name() return "a" end end
+        class B function name() return "b" end end
+        class C function name() return "c" end end
+        local objs = {new A(), new B(), new C(), new A(), new C(), new B()}
+        local out = ""
+        for i = 1, #objs do
+            out = out .. objs[i]:name()
+        end
+        print(out)
+    )"), "abcacb\n");
+}
+
+TEST_F(OOPInlineCacheTest, FieldSlotAcrossInstances) {
+    // Same field names inserted in different orders land in different slots
+    EXPECT_EQ(run(R"(
+        class P
+            function init(flip)
+                if flip then
+                    self.y = 2
+                    self.x = 1
+                else
+                    self.x = 10
+                    self.y = 20
+                end
+            end
+        end
+        local ps = {new P(false), new P(true), new P(false)}
+        local sum = 0
+        for i = 1, #ps do
+            sum = sum + ps[i].x * 100 + ps[i].y
+        end
+        print(sum)
+    )"), "2142\n");
+}
+
+TEST_F(OOPInlineCacheTest, FieldShadowsCachedMethod) {
+    EXPECT_EQ(run(R"(
+        class K
+            function f() return "method" end
+        end
+        function callF(k) return k.f() end
+        function fromField() return "field" end
+        local a = new K()
+        local b = new K()
+        b.f = fromField
+        print(callF(a) .. " " .. callF(b) .. " " .. callF(a))
+    )"), "method field method\n");
+}
+
+// ============== Shape Tests ==============
+
+class OOPShapeTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        initVM();
+    }
+    void TearDown() override {
+        freeVM();
+    }
+
+    // Call a global script function and return the instance it builds
+    ObjInstance* make(const char* name) {
+        Value fn;
+        if (!getGlobal(copyString(name, (int)strlen(name)), &fn)) return NULL;
+        Value result;
+        if (!callClosure(AS_CLOSURE(fn), 0, NULL, &result)) return NULL;
+        push(result);  // keep it reachable across later calls
+        return IS_INSTANCE(result) ? AS_INSTANCE(result) : NULL;
+    }
+};
+
+TEST_F(OOPShapeTest, SameFieldOrderSharesShape) {
+    ASSERT_EQ(interpret(R"(
+        class P
+            function init(x, y)
+                self.x = x
+                self.y = y
+            end
+        end
+        function makeA() return new P(1, 2) end
+        function makeB() return new P(3, 4) end
+        function makeWide()
+            local c = new P(5, 6)
+            c.z = 7
+            return c
+        end
+    )"), INTERPRET_OK);
+    ObjInstance* a = make("makeA");
+    ObjInstance* b = make("makeB");
+    ObjInstance* c = make("makeWide");
+    ASSERT_TRUE(a && b && c);
+
+    EXPECT_EQ(a->shape, b->shape);
+    EXPECT_EQ(a->shape->fieldCount, 2);
+    EXPECT_NE(c->shape, a->shape);
+    EXPECT_EQ(c->shape->fieldCount, 3);
+
+    Value y;
+    ASSERT_TRUE(instanceGetField(b, copyString("y", 1), &y));
+    EXPECT_EQ(AS_NUMBER(y), 4);
+    EXPECT_FALSE(instanceGetField(a, copyString("z", 1), &y));
+}
+
+TEST_F(OOPShapeTest, NewInstancesArePresized) {
+    ASSERT_EQ(interpret(R"(
+        class P
+            function init()
+                self.a = 1 self.b = 2 self.c = 3
+            end
+        end
+        function makeP() return new P() end
+    )"), INTERPRET_OK);
+    ASSERT_NE(make("makeP"), nullptr);
+    // The class remembers the layout size, so later instances never regrow
+    ObjInstance* second = make("makeP");
+    ASSERT_NE(second, nullptr);
+    EXPECT_EQ(second->fieldCapacity, 3);
+}
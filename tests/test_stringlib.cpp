@@ -0,0 +1,263 @@
+/*
+ * test_stringlib.cpp - Tests for the native string library
+ *
+ * Tests the 'string' table functions, string methods (s:upper()), the
+ * library's registration as a module and the Lua pattern engine.
+ */
+
+#include "script_test.h"
+
+extern "C" {
+#include "memory.h"
+}
+
+class StringLibTest : public ScriptTest {};
+
+TEST_F(StringLibTest, SubFollowsLuaPositions) {
+    EXPECT_EQ(run(R"(
+        local s = "Hello, World"
+        print(string.sub(s, 1, 5), string.sub(s, -5), string.sub(s, 8, 100))
+        print(string.sub(s, 0), string.sub(s, 5, 2) == "", string.sub(s, -100, 2))
+    )"), "Hello\tWorld\tWorld\nHello, World\ttrue\tHe\n");
+}
+
+TEST_F(StringLibTest, ByteAndCharRoundTrip) {
+    EXPECT_EQ(run(R"(
+        print(string.byte("A"), string.byte("ABC", -1))
+        print(string.byte("ABC", 1, 3))
+        local a, b, c, d, e = string.byte("Lua++", 1, 5)
+        print(string.char(a, b, c, d, e), string.char())
+    )"), "65\t67\n65\t66\t67\nLua++\t\n");
+}
+
+TEST_F(StringLibTest, CaseRepAndReverse) {
+    EXPECT_EQ(run(R"(
+        print(string.upper("MiXeD 1"), string.lower("MiXeD 1"), string.reverse("abc"))
+        print(string.rep("ab", 3), string.rep("x", 3, ", "), string.rep("x", 0) == "")
+        print(#string.rep("long", 100), string.upper(string.rep("a", 50)) == string.rep("A", 50))
+    )"), "MIXED 1\tmixed 1\tcba\nababab\tx, x, x\ttrue\n400\ttrue\n");
+}
+
+TEST_F(StringLibTest, FindIsPlain) {
+    EXPECT_EQ(run(R"(
+        local s = "a.b.c.d"
+        print(string.find(s, ".c"))
+        print(string.find(s, ".", 3, true))
+        print(string.find(s, "x"), string.find(s, "", 4))
+        print(string.find(string.rep("ab", 40) .. "needle", "needle"))
+    )"), "4\t5\n4\t4\nnil\t4\t3\n81\t86\n");
+}
+
+TEST_F(StringLibTest, Format) {
+    EXPECT_EQ(run(R"(
+        print(string.format("%d items at %.2f = %5.1f%%", 3, 1.5, 4.5))
+        print(string.format("[%-5s|%5s|%x|%X|%o|%c]", "ab", "cd", 255, 255, 8, 65))
+        print(string.format("%s %s %s %q", 1.5, true, nil, "hi"))
+        print(string.format("%d", "not a number"), string.format("%y", 1))
+    )"), "3 items at 1.50 =   4.5%\n[ab   |   cd|ff|FF|10|A]\n"
+         "1.5 true nil \"hi\"\nnil\tnil\n");
+}
+
+TEST_F(StringLibTest, TrimAndAffixes) {
+    EXPECT_EQ(run(R"(
+        print("[" .. string.trim("   padded  ") .. "]")
+        print(string.startswith("prefix", "pre"), string.endswith("suffix", "fix"))
+        print(string.startswith("ab", "abc"), string.endswith("ab", "b"))
+    )"), "[padded]\ntrue\ttrue\nfalse\ttrue\n");
+}
+
+TEST_F(StringLibTest, StringMethods) {
+    EXPECT_EQ(run(R"(
+        local s = "Hello"
+        print(s:upper(), s:len(), s:sub(2, 3), s:rep(2, "-"))
+        local long = string.rep("xy", 40)
+        print(long:find("yx", 10))
+    )"), "HELLO\t5\tel\tHello-Hello\n10\t11\n");
+    EXPECT_EQ(interpret("local s = \"x\" s:nosuchmethod()"), INTERPRET_RUNTIME_ERROR);
+}
+
+TEST_F(StringLibTest, RequireReturnsTheNativeLibrary) {
+    EXPECT_EQ(run(R"(
+        local str = require("string")
+        print(str == string, str.upper("ok"), type(string.format))
+    )"), "true\tOK\tfunction\n");
+}
+
+TEST_F(StringLibTest, TableFieldsWithDots) {
+    EXPECT_EQ(run(R"(
+        local t = {}
+        t.count = 2
+        t["name"] = "box"
+        print(t.count, t.name, t.missing)
+    )"), "2\tbox\tnil\n");
+    EXPECT_EQ(interpret("local t = {} t.missing()"), INTERPRET_RUNTIME_ERROR);
+}
+
+// ============== Pattern Tests ==============
+
+TEST_F(StringLibTest, FindAndMatchWithPatterns) {
+    EXPECT_EQ(run(R"lua(
+        print(string.find("hello world", "(o)%s(w)"))
+        print(string.find("hello world", "l+"), string.find("a.b", ".", 1, true))
+        print(string.match("key = value", "(%w+)%s*=%s*(%w+)"))
+        print(string.match("  both  ", "^%s*(.-)%s*$") .. "|", string.match("hello", "()ll()"))
+        print(string.match("f(a(b)c)d", "%b()"), string.find("THE (quick) fox", "%f[%a]%a+", 5))
+        print(string.match("abcabc", "(a)(b)c%1%2"), string.match("[x]", "[]]"), string.match("a-b", "[a%-]+"))
+        print(string.match("abc", "^b"), string.match("abc", "c$"), string.match("x1", "%u"))
+    )lua"), "5\t7\to\tw\n3\t2\t2\n"
+         "key\tvalue\nboth|\t3\t5\n"
+         "(a(b)c)\t6\t10\n"
+         "a\t]\ta-\n"
+         "nil\tc\tnil\n");
+}
+
+TEST_F(StringLibTest, Gsub) {
+    EXPECT_EQ(run(R"lua(
+        function shout(w) return w:upper() end
+        local vars = {}
+        vars["name"] = "Lua"
+        print(string.gsub("hello world", "(%w+)", "<%1>"))
+        print(string.gsub("hello world", "%w+", shout))
+        print(string.gsub("$name is $other", "%$(%w+)", vars))
+        print(string.gsub("abc", "", "-"))
+        print(string.gsub("hello world", "o", "0", 1))
+        print(string.gsub("50%", "%%", " percent"))
+    )lua"), "<hello> <world>\t2\nHELLO WORLD\t2\nLua is $other\t2\n"
+         "-a-b-c-\t4\nhell0 world\t1\n50 percent\t1\n");
+}
+
+TEST_F(StringLibTest, GmatchDrivesForIn) {
+    EXPECT_EQ(run(R"lua(
+        for word in string.gmatch("one two  three", "%a+") do print(word) end
+        for k, v in string.gmatch("a=1, b=2", "(%w+)=(%w+)") do print(k, v) end
+        local n = 0
+        for _ in string.gmatch("abc", "") do n = n + 1 end
+        print(n)
+        -- '^' does not anchor gmatch: it is a literal character
+        for m in string.gmatch("a^ab", "^a") do print(m) end
+        print(string.match("a^ab", "^a"))
+    )lua"), "one\ntwo\nthree\na\t1\nb\t2\n4\n^a\na\n");
+}
+
+TEST_F(StringLibTest, ForInCallsIteratorFunctions) {
+    EXPECT_EQ(run(R"lua(
+        function upTo(limit)
+            local i = 0
+            function step()
+                if i == limit then return nil end
+                i = i + 1
+                return i, i * i
+            end
+            return step
+        end
+        for i, square in upTo(3) do print(i, square) end
+    )lua"), "1\t1\n2\t4\n3\t9\n");
+}
+
+TEST_F(StringLibTest, MalformedPatternsAreRuntimeErrors) {
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(interpret("local x = string.find(\"a\", \"%\")"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("local x = string.match(\"a\", \"[a\")"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("local x = string.gsub(\"a\", \"(a\", \"\")"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("local x = string.gsub(\"a\", \"a\", \"%2\")"), INTERPRET_RUNTIME_ERROR);
+    std::string errors = testing::internal::GetCapturedStderr();
+    EXPECT_NE(errors.find("malformed pattern (ends with '%')"), std::string::npos);
+    EXPECT_NE(errors.find("missing ']'"), std::string::npos);
+    EXPECT_EQ(run("print(string.match(\"still\", \"s(t)\"))"), "t\n");
+}
+
+TEST_F(StringLibTest, CompiledPatternsAreCachedPerString) {
+    ObjString* source = copyString("(%a+)=(%d+)", 11);
+    push(OBJ_VAL(source));
+    const char* error = nullptr;
+    const Pattern* pattern = getPattern(&vm.patternCache, source, true, &error);
+    ASSERT_NE(pattern, nullptr);
+    EXPECT_EQ(patternCaptureCount(pattern), 2);
+    EXPECT_EQ(getPattern(&vm.patternCache, source, true, &error), pattern);
+
+    Match match;
+    const char* subject = "x=42";
+    EXPECT_EQ(matchPattern(pattern, subject, subject + 4, subject, &match, &error),
+              subject + 4);
+    EXPECT_EQ(match.captureCount, 2);
+    EXPECT_EQ(std::string(match.captures[1].start, match.captures[1].length), "42");
+
+    // Once the string is collected its entry goes too
+    pop();
+    collectGarbage();
+    for (int i = 0; i < PATTERN_CACHE_SIZE; i++) {
+        EXPECT_NE(vm.patternCache.entries[i].source, source);
+    }
+}
+
+// ============== Slice Tests ==============
+
+TEST_F(StringLibTest, LongSubstringsShareTheirParent) {
+    std::string text;
+    for (int i = 0; i < 100; i++) text += (char)('a' + i % 26);
+    ObjString* parent = copyString(text.c_str(), (int)text.size());
+    push(OBJ_VAL(parent));
+
+    Value slice = substringValue(parent, parent->chars + 10, 50);
+    push(slice);
+    ASSERT_TRUE(IS_SLICE(slice));
+    EXPECT_TRUE(IS_STRING(slice));
+    EXPECT_EQ(stringLength(slice), 50);
+    StringView view = stringView(slice);
+    EXPECT_EQ(view.base, parent);
+    EXPECT_EQ(view.chars, parent->chars + 10);
+
+    // Short pieces are interned copies; the whole string is itself
+    Value piece = substringValue(parent, parent->chars + 1, 5);
+    EXPECT_FALSE(IS_SLICE(piece));
+    EXPECT_TRUE(AS_STRING(piece)->interned);
+    EXPECT_EQ(AS_OBJ(substringValue(parent, parent->chars, 100)), (Obj*)parent);
+
+    // The slice alone keeps its parent's characters alive
+    vm.stackTop[-2] = slice;
+    pop();
+    collectGarbage();
+    view = stringView(slice);
+    EXPECT_EQ(std::string(view.chars, view.length), text.substr(10, 50));
+
+    // Materializing copies the characters out and drops the parent
+    ObjString* flat = AS_STRING(slice);
+    EXPECT_EQ(std::string(flat->chars, flat->length), text.substr(10, 50));
+    EXPECT_EQ(AS_SLICE(slice)->parent, nullptr);
+    EXPECT_EQ(AS_STRING(slice), flat);
+    pop();
+}
+
+TEST_F(StringLibTest, SlicesBehaveAsStrings) {
+    EXPECT_EQ(run(R"lua(
+        local text = string.rep("0123456789", 10)
+        local a = text:sub(1, 50)
+        local b = string.sub(text, 11, 60)
+        print(a == b, #a, type(a), a:sub(-3))
+        local t = {}
+        t[a] = "found"
+        print(t[b], rawget(t, text:sub(21, 70)))
+        print(string.trim("  " .. a .. "  ") == a, (a .. "!"):endswith("9!"))
+        local n = 0
+        for field in string.gmatch(text .. " " .. text, "%S+") do n = n + #field end
+        print(n, string.match(text, "^(.-)(5.*)$") == "01234")
+    )lua"), "true\t50\tstring\t789\n"
+         "found\tfound\n"
+         "true\ttrue\n"
+         "200\ttrue\n");
+}
+
+TEST_F(StringLibTest, GsubKeepsASliceSubjectAliveAcrossCallbacks) {
+    // Using s as a key materializes it, dropping its parent mid-gsub
+    EXPECT_EQ(run(R"lua(
+        local s = string.sub(string.rep("xy", 200), 3, 300)
+        local t = {}
+        local function visit(c)
+            t[s] = 1
+            for i = 1, 200 do local junk = string.rep(c, 100 + i) end
+            return nil
+        end
+        local out, n = string.gsub(s, "y", visit)
+        print(out == s, n, #out)
+    )lua"), "true\t149\t298\n");
+}
@@ -0,0 +1,191 @@
+/*
+ * test_tablelib.cpp - Tests for the native table library
+ *
+ * Tests table.insert/remove/concat/unpack/move, table.sort with and
+ * without a comparator, and the library's registration as a module.
+ */
+
+#include "script_test.h"
+
+class TableLibTest : public ScriptTest {};
+
+TEST_F(TableLibTest, InsertAndRemoveShiftElements) {
+    EXPECT_EQ(run(R"(
+        local t = {1, 2, 3}
+        table.insert(t, 4)
+        table.insert(t, 1, 0)
+        table.insert(t, 3, 1.5)
+        print(table.concat(t, " "), #t)
+        print(table.remove(t), table.remove(t, 1), table.remove(t, 2), #t)
+        print(table.concat(t, " "))
+        local empty = {}
+        print(table.remove(empty), #empty, table.remove(empty, 0))
+        print(table.insert(t, 9, "x"), table.insert(t, 0, "x"), #t)
+    )"), "0 1 1.5 2 3 4\t6\n4\t0\t1.5\t3\n1 2 3\n"
+         "nil\t0\tnil\n"
+         "nil\tnil\t3\n");
+}
+
+TEST_F(TableLibTest, InsertReachesIntoTheHashPart) {
+    // 2 and 3 start out in the hash part (stored before 1)
+    EXPECT_EQ(run(R"(
+        local t = {}
+        t[3] = "c"
+        t[2] = "b"
+        t[1] = "a"
+        table.insert(t, 1, "z")
+        print(table.concat(t), #t)
+        print(table.remove(t, 2), table.concat(t))
+    )"), "zabc\t4\na\tzbc\n");
+}
+
+TEST_F(TableLibTest, ConcatJoinsStringsAndNumbers) {
+    EXPECT_EQ(run(R"(
+        local t = {"a", 1, 2.5, "b"}
+        print(table.concat(t), table.concat(t, ", "), table.concat(t, "-", 2, 3))
+        print(table.concat({}) == "", table.concat(t, ",", 3, 2) == "")
+        print(table.concat({1, {}, 3}), table.concat(t, {}))
+        local long = {}
+        for i = 1, 100 do long[i] = string.rep("x", i) end
+        print(#table.concat(long, "|"))
+    )"), "a12.5b\ta, 1, 2.5, b\t1-2.5\ntrue\ttrue\nnil\tnil\n5149\n");
+}
+
+TEST_F(TableLibTest, UnpackAndMove) {
+    EXPECT_EQ(run(R"(
+        print(table.unpack({1, 2, 3}))
+        print(table.unpack({1, 2, 3}, 2), table.unpack({1, 2, 3}, 2, 2))
+        local a, b, c = table.unpack({"x", "y"}, 1, 3)
+        print(a, b, c)
+
+        local m = {1, 2, 3, 4, 5}
+        table.move(m, 1, 3, 3)
+        print(table.concat(m, ","))
+        table.move(m, 3, 5, 1)
+        print(table.concat(m, ","))
+        local copy = table.move(m, 1, #m, 1, {})
+        print(table.concat(copy, ","), copy ~= m)
+        local sparse = table.move({1, 2}, 1, 2, 100, {})
+        print(#sparse, sparse[100], sparse[101])
+    )"), "1\t2\t3\n2\t2\nx\ty\tnil\n"
+         "1,2,1,2,3\n1,2,3,2,3\n1,2,3,2,3\ttrue\n0\t1\t2\n");
+}
+
+TEST_F(TableLibTest, PositionsMustBeIntegers) {
+    // One rule for both libraries: 1.5 is no position, 2.0 is
+    EXPECT_EQ(run(R"(
+        local t = {1, 2, 3}
+        print(table.insert(t, 1.5, "x"), #t, table.concat(t, ",", 1.5))
+        print(string.sub("hello", 1.5), string.sub("hello", 2.0, 3))
+        print(table.unpack({1, 2, 3}, 2.0), string.byte("abc", 1e300))
+    )"), "nil\t3\tnil\nnil\tel\n2\tnil\n");
+}
+
+TEST_F(TableLibTest, SortWithoutComparator) {
+    EXPECT_EQ(run(R"(
+        local numbers = {5, -1, 3.5, 0, 3.5, 100, 2}
+        table.sort(numbers)
+        print(table.concat(numbers, " "))
+        local words = {"pear", "apple", "fig", "app", "banana", "Zebra"}
+        table.sort(words)
+        print(table.concat(words, " "))
+        local one = {1}
+        table.sort(one)
+        table.sort({})
+        print(one[1], table.sort({1, "a"}), table.sort({1, nil, 2}), table.sort(3))
+    )"), "-1 0 2 3.5 3.5 5 100\nZebra app apple banana fig pear\n1\tnil\tnil\tnil\n");
+}
+
+TEST_F(TableLibTest, SortLargeArraysInEveryShape) {
+    // Random, sorted, reversed, all equal, organ pipe and few distinct
+    // values: each must come out ordered with the same elements
+    EXPECT_EQ(run(R"(
+        local function check(t, n)
+            local sum = 0
+            for i = 1, n do sum = sum + t[i] end
+            table.sort(t)
+            local ordered = #t == n
+            local after = 0
+            for i = 1, n do
+                after = after + t[i]
+                if i > 1 and t[i - 1] > t[i] then ordered = false end
+            end
+            return ordered and sum == after
+        end
+        local function element(shape, i, n)
+            if shape == 1 then return (i * 7919) % 10007 end
+            if shape == 2 then return i end
+            if shape == 3 then return n - i end
+            if shape == 4 then return 42 end
+            if shape == 5 then
+                if i < n / 2 then return i end
+                return n - i
+            end
+            return i % 4
+        end
+        local n = 20000
+        local shapes = {}
+        for shape = 1, 6 do
+            local t = {}
+            for i = 1, n do t[i] = element(shape, i, n) end
+            shapes[shape] = check(t, n)
+        end
+        print(table.unpack(shapes))
+    )"), "true\ttrue\ttrue\ttrue\ttrue\ttrue\n");
+}
+
+TEST_F(TableLibTest, SortWithComparator) {
+    EXPECT_EQ(run(R"(
+        local function descending(a, b) return a > b end
+        local t = {}
+        for i = 1, 1000 do t[i] = (i * 37) % 1000 end
+        table.sort(t, descending)
+        local ordered = true
+        for i = 2, #t do if t[i - 1] < t[i] then ordered = false end end
+        print(ordered, t[1], t[1000])
+
+        local people = {}
+        for i = 1, 50 do people[i] = {age = (i * 13) % 50, id = i} end
+        local function byAge(a, b) return a.age < b.age end
+        table.sort(people, byAge)
+        print(people[1].age, people[50].age)
+
+        -- Not a strict weak order: any order will do, but no crash
+        local function always(a, b) return true end
+        local junk = {}
+        for i = 1, 500 do junk[i] = i end
+        table.sort(junk, always)
+        print(#junk)
+    )"), "true\t999\t0\n0\t49\n500\n");
+}
+
+TEST_F(TableLibTest, ComparatorErrorsStopTheSort) {
+    std::string errors;
+    EXPECT_EQ(fail(R"(
+        local function bad(a, b) return a + nil end
+        table.sort({3, 2, 1}, bad)
+        print("unreachable")
+    )", &errors), INTERPRET_RUNTIME_ERROR);
+    EXPECT_NE(errors.find("Operands must be numbers."), std::string::npos);
+
+    EXPECT_EQ(fail(R"(
+        local t = {}
+        for i = 1, 100 do t[i] = i end
+        local function shrink(a, b)
+            t[#t] = nil
+            return a < b
+        end
+        table.sort(t, shrink)
+    )", &errors), INTERPRET_RUNTIME_ERROR);
+    EXPECT_NE(errors.find("Table was resized during 'table.sort'."), std::string::npos);
+
+    // The VM is usable afterwards
+    EXPECT_EQ(run("local t = {2, 1} table.sort(t) print(t[1])"), "1\n");
+}
+
+TEST_F(TableLibTest, RequireReturnsTheLibrary) {
+    EXPECT_EQ(run(R"(
+        local t = require("table")
+        print(t == table, t.sort == table.sort)
+    )"), "true\ttrue\n");
+}
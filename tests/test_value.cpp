@@ -5,12 +5,17 @@
  */
 
 #include <gtest/gtest.h>
+#include <string>
 
 extern "C" {
 #include "value.h"
 #include "object.h"
 #include "vm.h"
+#include "number.h"
+#include "memory.h"
 }
+#include <cmath>
+#include <cstring>
 
 // ============== Value Creation Tests ==============
 
@@ -105,8 +110,10 @@ TEST_F(ValueEqualityTest, NumberEquality) {
 
 TEST_F(ValueEqualityTest, StringEquality) {
     ObjString* s1 = copyString("hello", 5);
+    push(OBJ_VAL(s1));
     ObjString* s2 = copyString("hello", 5);
     ObjString* s3 = copyString("world", 5);
+    push(OBJ_VAL(s3));
     
     // Interned strings should be same pointer
     EXPECT_EQ(s1, s2);
@@ -132,6 +139,179 @@ TEST_F(ValueEqualityTest, NumberEdgeCases) {
     EXPECT_TRUE(valuesEqual(NUMBER_VAL(0.0), NUMBER_VAL(-0.0)));
 }
 
+TEST_F(ValueEqualityTest, NaNIsNumberAndNotEqual) {
+    // NaN must stay a number and never compare equal, even when boxed
+    Value nan = NUMBER_VAL(0.0 / 0.0);
+    EXPECT_TRUE(IS_NUMBER(nan));
+    EXPECT_FALSE(IS_NIL(nan));
+    EXPECT_FALSE(IS_OBJ(nan));
+    EXPECT_FALSE(valuesEqual(nan, nan));
+}
+
+TEST_F(ValueEqualityTest, RopeEqualsFlatString) {
+    std::string half(40, 'r');
+    Value left = OBJ_VAL(copyString(half.c_str(), 40));
+    push(left);
+    Value rope = OBJ_VAL(newRope(left, left));
+    push(rope);
+    
+    EXPECT_TRUE(IS_STRING(rope));
+    EXPECT_EQ(stringLength(rope), 80);
+    EXPECT_EQ(AS_ROPE(rope)->flat, nullptr);
+    
+    std::string whole(80, 'r');
+    ObjString* flat = copyString(whole.c_str(), 80);
+    push(OBJ_VAL(flat));
+    EXPECT_TRUE(valuesEqual(rope, OBJ_VAL(flat)));
+    EXPECT_TRUE(stringsEqual(AS_STRING(rope), flat));
+    EXPECT_FALSE(valuesEqual(rope, left));
+}
+
+TEST_F(ValueEqualityTest, LongStringsAreNotInterned) {
+    std::string text(INTERN_MAX_LENGTH + 1, 'x');
+    ObjString* a = copyString(text.c_str(), (int)text.size());
+    push(OBJ_VAL(a));
+    ObjString* b = copyString(text.c_str(), (int)text.size());
+    push(OBJ_VAL(b));
+    
+    EXPECT_NE(a, b);
+    EXPECT_FALSE(a->interned);
+    EXPECT_FALSE(a->hashed);  // Hashed only once used as a key
+    EXPECT_TRUE(valuesEqual(OBJ_VAL(a), OBJ_VAL(b)));
+    
+    Table table;
+    initTable(&table);
+    tableSet(&table, a, NUMBER_VAL(1));
+    Value value;
+    EXPECT_TRUE(tableGet(&table, b, &value));
+    EXPECT_DOUBLE_EQ(AS_NUMBER(value), 1);
+    freeTable(&table);
+    
+    ObjString* shorter = copyString(text.c_str(), INTERN_MAX_LENGTH);
+    EXPECT_TRUE(shorter->interned);
+}
+
+TEST_F(ValueEqualityTest, ConcatStringsInternsShortResults) {
+    ObjString* foo = copyString("foo", 3);
+    push(OBJ_VAL(foo));
+    ObjString* bar = copyString("bar", 3);
+    push(OBJ_VAL(bar));
+    
+    ObjString* joined = concatStrings(foo, bar);
+    EXPECT_EQ(joined, copyString("foobar", 6));
+    EXPECT_EQ(joined->chars[6], '\0');
+    
+    std::string text(INTERN_MAX_LENGTH, 'y');
+    ObjString* full = copyString(text.c_str(), INTERN_MAX_LENGTH);
+    push(OBJ_VAL(full));
+    ObjString* longer = concatStrings(full, foo);
+    EXPECT_FALSE(longer->interned);
+    EXPECT_EQ(longer->length, INTERN_MAX_LENGTH + 3);
+    EXPECT_STREQ(longer->chars, (text + "foo").c_str());
+}
+
+#if LUAPP_NAN_BOXING
+TEST_F(ValueCreationTest, NaNBoxedValueIsEightBytes) {
+    EXPECT_EQ(sizeof(Value), 8u);
+    ObjString* s = copyString("boxed", 5);
+    EXPECT_EQ(AS_OBJ(OBJ_VAL(s)), (Obj*)s);
+}
+#endif
+
+// ============== String Hash Tests ==============
+
+TEST(StringHashTest, SipHashDependsOnSeedAndEveryByte) {
+    HashSeed a = {1, 2};
+    HashSeed b = {1, 3};
+    const char* text = "the quick brown fox jumps over the lazy dog";
+    
+    EXPECT_EQ(hashSipHash13(&a, text, 43), hashSipHash13(&a, text, 43));
+    EXPECT_NE(hashSipHash13(&a, text, 43), hashSipHash13(&b, text, 43));
+    
+    // Every prefix length, across the 8-byte word boundaries, hashes apart
+    for (int length = 1; length <= 17; length++) {
+        EXPECT_NE(hashSipHash13(&a, text, length), hashSipHash13(&a, text, length - 1))
+            << "length " << length;
+    }
+}
+
+TEST(StringHashTest, Fnv1aMatchesReference) {
+    EXPECT_EQ(hashFnv1a("", 0), 2166136261u);
+    EXPECT_EQ(hashFnv1a("a", 1), 0xe40c292cu);
+    EXPECT_EQ(hashFnv1a("foobar", 6), 0xbf9cf968u);
+}
+
+// ============== Number Conversion Tests ==============
+
+static std::string formatted(double value) {
+    char buffer[NUMBER_BUFFER_SIZE];
+    int length = formatNumber(value, buffer);
+    EXPECT_EQ((size_t)length, strlen(buffer));
+    return std::string(buffer, length);
+}
+
+TEST(NumberConversionTest, FormatsShortestRoundTrip) {
+    EXPECT_EQ(formatted(0), "0");
+    EXPECT_EQ(formatted(-0.0), "-0");
+    EXPECT_EQ(formatted(-42), "-42");
+    EXPECT_EQ(formatted(0.1), "0.1");
+    EXPECT_EQ(formatted(0.1 + 0.2), "0.30000000000000004");
+    EXPECT_EQ(formatted(1.0 / 3), "0.3333333333333333");
+    EXPECT_EQ(formatted(1234567.5), "1234567.5");
+    EXPECT_EQ(formatted(9007199254740991.0), "9007199254740991");
+    EXPECT_EQ(formatted(1e17), "1e+17");
+    EXPECT_EQ(formatted(1e21), "1e+21");
+    EXPECT_EQ(formatted(0.0001), "0.0001");
+    EXPECT_EQ(formatted(5e-7), "5e-07");
+    EXPECT_EQ(formatted(5e-324), "5e-324");
+    EXPECT_EQ(formatted(1.7976931348623157e308), "1.7976931348623157e+308");
+    EXPECT_EQ(formatted(INFINITY), "inf");
+    EXPECT_EQ(formatted(-INFINITY), "-inf");
+}
+
+TEST(NumberConversionTest, EveryFormattedDoubleParsesBack) {
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < 100000; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        double value;
+        memcpy(&value, &state, sizeof(value));
+        if (std::isnan(value) || std::isinf(value)) continue;
+
+        std::string text = formatted(value);
+        double back = 0;
+        ASSERT_TRUE(parseNumber(text.c_str(), (int)text.size(), &back)) << text;
+        ASSERT_EQ(back, value) << text;
+        ASSERT_EQ(strtod(text.c_str(), nullptr), value) << text;
+    }
+}
+
+TEST(NumberConversionTest, ParsesLuaNumerals) {
+    double value = 0;
+    auto parse = [&](const char* text) {
+        return parseNumber(text, (int)strlen(text), &value);
+    };
+    EXPECT_TRUE(parse(" 12 ")); EXPECT_EQ(value, 12);
+    EXPECT_TRUE(parse("-1.5e-3")); EXPECT_EQ(value, -1.5e-3);
+    EXPECT_TRUE(parse(".5")); EXPECT_EQ(value, 0.5);
+    EXPECT_TRUE(parse("5.")); EXPECT_EQ(value, 5);
+    EXPECT_TRUE(parse("0x1F")); EXPECT_EQ(value, 31);
+    EXPECT_TRUE(parse("0x1p4")); EXPECT_EQ(value, 16);
+    // Beyond the fast path: long mantissas and large exponents
+    EXPECT_TRUE(parse("9007199254740993")); EXPECT_EQ(value, 9007199254740992.0);
+    EXPECT_TRUE(parse("123e30")); EXPECT_EQ(value, 123e30);
+    EXPECT_TRUE(parse("2.2250738585072014e-308")); EXPECT_EQ(value, 2.2250738585072014e-308);
+    EXPECT_TRUE(parse("0.1000000000000000055511151231257827")); EXPECT_EQ(value, 0.1);
+
+    const char* malformed[] = {"", "  ", ".", "1e", "1e+", "0x", "1 2", "+-1", "1.2.3", "inf", "nan"};
+    for (const char* text : malformed) {
+        EXPECT_FALSE(parse(text)) << "'" << text << "'";
+    }
+    // Only the given length is read
+    EXPECT_TRUE(parseNumber("0x10", 1, &value)); EXPECT_EQ(value, 0);
+}
+
 // ============== ValueArray Tests ==============
 
 class ValueArrayTest : public ::testing::Test {
@@ -198,3 +378,140 @@ TEST_F(ValueArrayTest, FreeResetsState) {
     EXPECT_EQ(array.count, 0);
     EXPECT_EQ(array.capacity, 0);
 }
+
+// ============== String Table Tests ==============
+
+class StringTableTest : public ::testing::Test {
+protected:
+    Table table;
+    
+    void SetUp() override {
+        initVM();
+        initTable(&table);
+    }
+    void TearDown() override {
+        freeTable(&table);
+        freeVM();
+    }
+    
+    // "key<i>", kept alive on the VM stack
+    ObjString* key(int i) {
+        std::string text = "key" + std::to_string(i);
+        reserveStack(1);
+        ObjString* string = copyString(text.c_str(), (int)text.size());
+        push(OBJ_VAL(string));
+        return string;
+    }
+};
+
+TEST_F(StringTableTest, SetGetAndMiss) {
+    for (int i = 0; i < 5000; i++) {
+        EXPECT_TRUE(tableSet(&table, key(i), NUMBER_VAL((double)i)));
+    }
+    EXPECT_FALSE(tableSet(&table, key(7), NUMBER_VAL(-7)));
+    EXPECT_EQ(table.count, 5000);
+    EXPECT_EQ(table.capacity % TABLE_GROUP_WIDTH, 0);
+    EXPECT_LE(table.count, table.capacity - table.capacity / 8);
+    
+    Value value;
+    for (int i = 0; i < 5000; i++) {
+        ASSERT_TRUE(tableGet(&table, key(i), &value));
+        EXPECT_DOUBLE_EQ(AS_NUMBER(value), i == 7 ? -7 : i);
+    }
+    for (int i = 5000; i < 6000; i++) {
+        EXPECT_FALSE(tableGet(&table, key(i), &value));
+        EXPECT_FALSE(tableDelete(&table, key(i)));
+    }
+    
+    // The intern table is a Table too
+    EXPECT_EQ(copyString("key4321", 7), key(4321));
+}
+
+TEST_F(StringTableTest, DeletedKeysLeaveTheRestReachable) {
+    for (int i = 0; i < 2000; i++) tableSet(&table, key(i), NUMBER_VAL((double)i));
+    for (int i = 0; i < 2000; i += 2) EXPECT_TRUE(tableDelete(&table, key(i)));
+    EXPECT_EQ(table.count, 1000);
+    
+    Value value;
+    for (int i = 0; i < 2000; i++) {
+        EXPECT_EQ(tableGet(&table, key(i), &value), i % 2 == 1);
+    }
+    for (int i = 0; i < 2000; i += 2) {
+        EXPECT_TRUE(tableSet(&table, key(i), NUMBER_VAL((double)-i)));
+    }
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_TRUE(tableGet(&table, key(i), &value));
+        EXPECT_DOUBLE_EQ(AS_NUMBER(value), i % 2 == 0 ? -i : i);
+    }
+    
+    int live = 0;
+    for (int i = 0; i < table.capacity; i++) live += table.entries[i].key != NULL;
+    EXPECT_EQ(live, 2000);
+}
+
+TEST_F(StringTableTest, ChurnReusesDeletedSlots) {
+    // A sliding window of 100 keys: once the table has room for them,
+    // tombstones are reclaimed by rehashing in place rather than by growing
+    for (int i = 0; i < 100; i++) tableSet(&table, key(i), NUMBER_VAL((double)i));
+    int capacity = 0;
+    for (int i = 0; i < 20000; i++) {
+        ASSERT_TRUE(tableDelete(&table, key(i)));
+        ASSERT_TRUE(tableSet(&table, key(i + 100), NUMBER_VAL((double)(i + 100))));
+        if (i == 1000) capacity = table.capacity;
+    }
+    EXPECT_LE(capacity, 256);
+    EXPECT_EQ(table.count, 100);
+    EXPECT_EQ(table.capacity, capacity);
+    
+    Value value;
+    EXPECT_FALSE(tableGet(&table, key(19999), &value));
+    EXPECT_TRUE(tableGet(&table, key(20099), &value));
+}
+
+TEST_F(StringTableTest, SmallTablesUseEightSlots) {
+    for (int i = 0; i < 7; i++) tableSet(&table, key(i), NIL_VAL);
+    EXPECT_EQ(table.capacity, 8);
+    tableSet(&table, key(7), NIL_VAL);
+    EXPECT_EQ(table.capacity, 16);
+    
+    Value value;
+    for (int i = 0; i < 8; i++) EXPECT_TRUE(tableGet(&table, key(i), &value));
+}
+
+TEST_F(StringTableTest, DeletesShrinkTheTable) {
+    for (int i = 0; i < 5000; i++) tableSet(&table, key(i), NUMBER_VAL((double)i));
+    for (int i = 0; i < 5000; i++) {
+        if (i % 500 != 0) tableDelete(&table, key(i));
+    }
+    EXPECT_EQ(table.count, 10);
+    EXPECT_LE(table.capacity, 64);
+    
+    Value value;
+    for (int i = 0; i < 5000; i += 500) {
+        ASSERT_TRUE(tableGet(&table, key(i), &value));
+        EXPECT_DOUBLE_EQ(AS_NUMBER(value), i);
+    }
+    for (int i = 0; i < 5000; i += 500) tableDelete(&table, key(i));
+    EXPECT_EQ(table.count, 0);
+    EXPECT_EQ(table.capacity, 8);
+}
+
+TEST_F(StringTableTest, CollectionCompactsTheInternTable) {
+    for (int i = 0; i < 20000; i++) {
+        std::string text = "garbage" + std::to_string(i);
+        copyString(text.c_str(), (int)text.size());
+    }
+    // The first collection removes them, the second sees the table has
+    // been mostly empty since
+    collectGarbage();
+    collectGarbage();
+    
+    Table* strings = &vm.strings;
+    int tombstones = strings->capacity - strings->capacity / 8 - strings->growthLeft - strings->count;
+    EXPECT_TRUE(strings->capacity == 8 || strings->count >= strings->capacity / 8);
+    EXPECT_LE(tombstones, strings->count);
+    
+    // Survivors are still found
+    ObjString* survivor = key(42);
+    EXPECT_EQ(copyString("key42", 5), survivor);
+}
@@ -8,10 +8,14 @@
 #include <gtest/gtest.h>
 #include <sstream>
 #include <cstdio>
+#include <unistd.h>
+#include "script_test.h"
 
 extern "C" {
 #include "vm.h"
 #include "compiler.h"
+#include "objtable.h"
+#include "memory.h"
 }
 
 // Helper to capture stdout during interpretation
@@ -84,6 +88,76 @@ TEST_F(VMBasicTest, StringConcatenation) {
     EXPECT_EQ(interpret("local x = \"hello\" .. \" \" .. \"world\""), INTERPRET_OK);
 }
 
+TEST_F(VMBasicTest, LongConcatenationsBehaveAsStrings) {
+    // Results of ROPE_MIN_LENGTH+ characters are built lazily as ropes
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        local s = ""
+        local t = ""
+        for i = 1, 500 do
+            s = s .. tostring(i % 10)
+            t = tostring(i % 10) .. t
+        end
+        local r = ""
+        for i = 500, 1, -1 do r = r .. tostring(i % 10) end
+        local keys = {}
+        keys[t] = "found"
+        print(#s, s == r, s == t, t == r, keys[r], type(s))
+        print(t .. "!" == r .. "!", #(s .. s))
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(),
+              "500\tfalse\tfalse\ttrue\tfound\tstring\ntrue\t1000\n");
+}
+
+TEST_F(VMBasicTest, ConcatChains) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        local name = "x"
+        local n = 42
+        print("[" .. name .. ", " .. n .. "]", n .. name, 0.5 .. n)
+        local s = ""
+        for i = 1, 300 do s = s .. i .. "," end
+        local t = ""
+        for i = 1, 100 do t = i .. ":" .. t end
+        print(#s, string.sub(s, -8), #t, string.sub(t, 1, 7))
+        local keys = {}
+        keys[name .. "y" .. n] = "hit"
+        print(keys["xy42"], (name .. "y" .. n) == "xy42")
+        local long = string.rep("ab", 40)
+        print(#(long .. "-" .. long .. "-" .. n), #(n .. "+" .. long .. long))
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(),
+              "[x, 42]\t42x\t0.542\n"
+              "1092\t299,300,\t292\t100:99:\n"
+              "hit\ttrue\n"
+              "164\t163\n");
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(interpret("local t = {} local s = \"a\" .. t .. \"b\""), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("local s = \"a\" .. nil"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_NE(testing::internal::GetCapturedStderr().find("Operands must be strings or numbers."),
+              std::string::npos);
+}
+
+TEST_F(VMBasicTest, NumbersRoundTripThroughStrings) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        local x = 0.1 + 0.2
+        print(x, tonumber(tostring(x)) == x, 1e15, 2 / 3)
+        print(tonumber(" 0x10 "), tonumber("1e2"), tonumber(""), tonumber("inf"), tonumber("12abc"))
+        print(tostring(1234567.25), string.format("%s|%d", 1/3, 7))
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(),
+              "0.30000000000000004\ttrue\t1000000000000000\t0.6666666666666666\n"
+              "16\t100\tnil\tnil\tnil\n"
+              "1234567.25\t0.3333333333333333|7\n");
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(interpret("local x = 1e"), INTERPRET_COMPILE_ERROR);
+    EXPECT_NE(testing::internal::GetCapturedStderr().find("Malformed number"), std::string::npos);
+}
+
 TEST_F(VMBasicTest, Literals) {
     EXPECT_EQ(interpret("local x = nil"), INTERPRET_OK);
     EXPECT_EQ(interpret("local x = true"), INTERPRET_OK);
@@ -183,6 +257,79 @@ TEST_F(VMControlFlowTest, ForLoopWithStep) {
     EXPECT_EQ(interpret("for i = 1, 5, 2 do local x = i end"), INTERPRET_OK);
 }
 
+TEST_F(VMControlFlowTest, ForLoopNegativeAndFractionalSteps) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        for i = 3, 1, -1 do print(i) end
+        for i = 0, 1, 0.5 do print(i) end
+        for i = 1, 0 do print("never") end
+        for i = 0, 3, -1 do print("never") end
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "3\n2\n1\n0\n0.5\n1\n");
+}
+
+TEST_F(VMControlFlowTest, ForLoopVariableIsPerIteration) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        local fns = {}
+        for i = 1, 5 do
+            if i == 2 then continue end
+            if i == 4 then break end
+            function get() return i end
+            fns[#fns + 1] = get
+            i = i * 100  -- does not change the iteration count
+        end
+        print(#fns, fns[1](), fns[2]())
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "2\t100\t300\n");
+}
+
+TEST_F(VMControlFlowTest, ForLoopRejectsBadBounds) {
+    EXPECT_EQ(interpret("for i = 1, \"x\" do local y = i end"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("for i = 1, 10, 0 do local y = i end"), INTERPRET_RUNTIME_ERROR);
+}
+
+TEST_F(VMControlFlowTest, PairsVisitsArrayAndHashParts) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        local t = {10, nil, 30}
+        t["name"] = "x"
+        local count = 0
+        local sum = 0
+        for k, v in pairs(t) do
+            count = count + 1
+            if k == "name" then print(v) else sum = sum + v end
+        end
+        print(count, sum)
+        for i, v in ipairs(t) do print(i, v) end
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "x\n3\t40\n1\t10\n");
+}
+
+TEST_F(VMControlFlowTest, ShadowedIpairsIsAnOrdinaryIterator) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        local function ipairs(t) return t end
+        local n = 0
+        for k, v in ipairs({1, 2, nil, 4, x = 5}) do n = n + 1 end
+        local function inner()
+            local m = 0
+            for k, v in ipairs({1, nil, 3}) do m = m + 1 end
+            return m
+        end
+        print(n, inner())
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "4\t2\n");
+}
+
+TEST_F(VMControlFlowTest, PairsOnNonTableIsError) {
+    EXPECT_EQ(interpret("for k, v in 42 do local x = k end"), INTERPRET_RUNTIME_ERROR);
+}
+
 TEST_F(VMControlFlowTest, RepeatUntil) {
     EXPECT_EQ(interpret(R"(
         local i = 0
@@ -290,6 +437,84 @@ TEST_F(VMFunctionTest, NestedFunctions) {
     )"), INTERPRET_OK);
 }
 
+TEST_F(VMFunctionTest, MultipleReturnValues) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        function divmod(a, b) return (a - a % b) / b, a % b end
+        function none() end
+        local q, r = divmod(17, 5)
+        local x, y, z = divmod(9, 4)
+        local n1, n2 = none()
+        print(q, r, z, n2)
+        print(divmod(7, 2), "end")
+        print("start", divmod(7, 2))
+        print((divmod(7, 2)))
+        local t = {divmod(7, 2)}
+        print(#t, x + y + #{none()})
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(),
+              "3\t2\tnil\tnil\n3\tend\nstart\t3\t1\n3\n2\t3\n");
+}
+
+TEST_F(VMFunctionTest, VarargsAndSelect) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        function count(...) return select("#", ...) end
+        function sum(first, ...)
+            local total = first
+            for i = 1, select("#", ...) do
+                total = total + select(i, ...)
+            end
+            return total
+        end
+        function forward(...) return ... end
+        print(count(), count(nil, nil), sum(1, 2, 3, 4), forward(5, 6, 7))
+        local k, v = next({10, 20}, 1)
+        print(k, v, next({}))
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "0\t2\t10\t5\t6\t7\n2\t20\tnil\n");
+}
+
+TEST_F(VMFunctionTest, VarargsErrors) {
+    EXPECT_EQ(interpret("function f(a, ...) return a end f()"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("function g() return ... end"), INTERPRET_COMPILE_ERROR);
+}
+
+TEST_F(VMFunctionTest, TailCallsReuseTheFrame) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        function isEven(n) if n == 0 then return true end return isOdd(n - 1) end
+        function isOdd(n) if n == 0 then return false end return isEven(n - 1) end
+        function pair(a) return a, a * 2 end
+        function viaTail(a) return pair(a) end
+        function viaNative(a) return tostring(a) end
+        print(isEven(1000000), viaNative(7), viaTail(21))
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "true\t7\t21\t42\n");
+}
+
+TEST_F(VMFunctionTest, DeepRecursionGrowsTheStack) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        function sum(n) if n == 0 then return 0 end return n + sum(n - 1) end
+        function outer()
+            local captured = 1
+            function bump() captured = captured + 1 return captured end
+            bump()
+            local total = sum(20000)  -- moves the stack under the open upvalue
+            return bump() + total - 200010000
+        end
+        print(outer())
+    )"), INTERPRET_OK);
+    fflush(stdout);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "3\n");
+    EXPECT_EQ(interpret("function down(n) return 1 + down(n + 1) end down(1)"),
+              INTERPRET_RUNTIME_ERROR);
+}
+
 // ============== Closure Tests ==============
 
 class VMClosureTest : public ::testing::Test {
@@ -573,3 +798,365 @@ TEST_F(VMAdversarialTest, DoubleNegation) {
 TEST_F(VMAdversarialTest, NotNot) {
     EXPECT_EQ(interpret("local x = not not true"), INTERPRET_OK);
 }
+
+// ============== Output Tests ==============
+
+class VMOutputTest : public ::testing::Test {
+protected:
+    void SetUp() override { initVM(); }
+    void TearDown() override { freeVM(); }
+};
+
+TEST_F(VMOutputTest, WriteAndFlush) {
+    testing::internal::CaptureStdout();
+    EXPECT_EQ(interpret(R"(
+        io.write("a", 1, "-", 2.5)
+        print(io.flush(), require("io") == io)
+        print("x", nil, false, {1, 2})
+        io.write()
+    )"), INTERPRET_OK);
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "a1-2.5true\ttrue\nx\tnil\tfalse\t{1, 2}\n");
+}
+
+TEST_F(VMOutputTest, OutputBeforeAnErrorIsWritten) {
+    testing::internal::CaptureStdout();
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(interpret("io.write(\"partial\") io.write({})"), INTERPRET_RUNTIME_ERROR);
+    std::string errors = testing::internal::GetCapturedStderr();
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "partial");
+    EXPECT_NE(errors.find("Bad argument #1 to 'io.write'"), std::string::npos);
+}
+
+TEST_F(VMOutputTest, ErrorAndAssertFollowEarlierOutput) {
+    // Both streams into one file, as with 2>&1
+    FILE* file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    fflush(stdout);
+    int savedOut = dup(1);
+    int savedErr = dup(2);
+    dup2(fileno(file), 1);
+    dup2(fileno(file), 2);
+    interpret("print(\"before\") error(\"boom\") io.write(\"after\") assert(false, \"nope\")");
+    flushOutput(&vm.output);
+    dup2(savedOut, 1);
+    dup2(savedErr, 2);
+    close(savedOut);
+    close(savedErr);
+
+    char text[128] = {0};
+    rewind(file);
+    fread(text, 1, sizeof(text) - 1, file);
+    fclose(file);
+    EXPECT_STREQ(text, "before\nerror: boom\nafterassertion failed: nope\n");
+}
+
+TEST_F(VMOutputTest, WritesAreBatchedUntilFlush) {
+    FILE* file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    int fd = fileno(file);
+    OutputBuffer buffer;
+    OutputBuffer* output = &buffer;
+    initOutput(output, fd);
+    EXPECT_FALSE(output->lineBuffered);     // Not a terminal
+    EXPECT_EQ(output->data, nullptr);       // Nothing allocated until used
+    
+    for (int i = 0; i < 1000; i++) writeOutput(output, "line\n", 5);
+    EXPECT_EQ(lseek(fd, 0, SEEK_END), 0);   // Nothing written yet
+    EXPECT_TRUE(flushOutput(output));
+    EXPECT_EQ(lseek(fd, 0, SEEK_END), 5000);
+    
+    // A write bigger than the buffer goes straight out
+    std::string big(OUTPUT_BUFFER_SIZE + 10, 'x');
+    writeOutput(output, "head", 4);
+    writeOutput(output, big.data(), big.size());
+    EXPECT_EQ(lseek(fd, 0, SEEK_END), (off_t)(5000 + 4 + big.size()));
+    
+    freeOutput(output);
+    fclose(file);
+}
+
+// ============== Host Call Tests ==============
+
+class VMHostCallTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        initVM();
+    }
+    void TearDown() override {
+        freeVM();
+    }
+
+    ObjClosure* global(const char* name) {
+        Value value;
+        if (!getGlobal(copyString(name, (int)strlen(name)), &value)) return NULL;
+        return IS_CLOSURE(value) ? AS_CLOSURE(value) : NULL;
+    }
+};
+
+TEST_F(VMHostCallTest, ReturnsResult) {
+    ASSERT_EQ(interpret("function add(a, b) return a + b end"), INTERPRET_OK);
+    ObjClosure* add = global("add");
+    ASSERT_NE(add, nullptr);
+
+    Value args[] = { NUMBER_VAL(2), NUMBER_VAL(40) };
+    Value result;
+    EXPECT_TRUE(callClosure(add, 2, args, &result));
+    ASSERT_TRUE(IS_NUMBER(result));
+    EXPECT_EQ(AS_NUMBER(result), 42);
+    EXPECT_EQ(vm.frameCount, 0);
+    EXPECT_EQ(vm.stackTop, vm.stack);
+}
+
+TEST_F(VMHostCallTest, FullOpcodeCoverage) {
+    // Classes, super invokes and nested calls all run through run()
+    ASSERT_EQ(interpret(R"(
+        class Base
+            function init(v) self.v = v end
+            function get() return self.v end
+        end
+        class Derived extends Base
+            function get() return super.get() * 2 end
+        end
+        function make(v)
+            local d = new Derived(v)
+            return d:get()
+        end
+    )"), INTERPRET_OK);
+    ObjClosure* make = global("make");
+    ASSERT_NE(make, nullptr);
+
+    Value args[] = { NUMBER_VAL(21) };
+    Value result;
+    EXPECT_TRUE(callClosure(make, 1, args, &result));
+    ASSERT_TRUE(IS_NUMBER(result));
+    EXPECT_EQ(AS_NUMBER(result), 42);
+}
+
+TEST_F(VMHostCallTest, RuntimeErrorLeavesVMUsable) {
+    ASSERT_EQ(interpret("function bad(x) return x + nil end function ok() return 1 end"),
+              INTERPRET_OK);
+    Value args[] = { NUMBER_VAL(1) };
+    Value result;
+    EXPECT_FALSE(callClosure(global("bad"), 1, args, &result));
+    EXPECT_TRUE(IS_NIL(result));
+    EXPECT_FALSE(callClosure(global("bad"), 0, NULL, &result));
+
+    EXPECT_TRUE(callClosure(global("ok"), 0, NULL, &result));
+    EXPECT_EQ(AS_NUMBER(result), 1);
+}
+
+TEST_F(VMHostCallTest, GlobalSlotResolvedBeforeDefinition) {
+    // The call site's slot is reserved at compile time but stays undefined
+    ASSERT_EQ(interpret("function f() return later() end"), INTERPRET_OK);
+    Value value;
+    EXPECT_FALSE(getGlobal(copyString("later", 5), &value));
+    Value result;
+    EXPECT_FALSE(callClosure(global("f"), 0, NULL, &result));
+
+    ASSERT_EQ(interpret("function later() return 7 end"), INTERPRET_OK);
+    EXPECT_TRUE(callClosure(global("f"), 0, NULL, &result));
+    EXPECT_EQ(AS_NUMBER(result), 7);
+    EXPECT_TRUE(getGlobal(copyString("print", 5), &value));
+    EXPECT_TRUE(IS_NATIVE(value));
+}
+
+// ============== Table Tests ==============
+
+class VMTableTest : public ScriptTest {
+protected:
+    // Runs body as a function and keeps the table it returns on the stack
+    ObjTable* build(const std::string& body) {
+        std::string source = "function build() " + body + " end";
+        if (interpret(source.c_str()) != INTERPRET_OK) return NULL;
+        Value function;
+        Value result;
+        if (!getGlobal(copyString("build", 5), &function) ||
+            !callClosure(AS_CLOSURE(function), 0, NULL, &result) ||
+            !IS_TABLE(result)) {
+            return NULL;
+        }
+        push(result);
+        return AS_TABLE(result);
+    }
+};
+
+TEST_F(VMTableTest, AnyValueButNilAndNaNIsAKey) {
+    EXPECT_EQ(run(R"lua(
+        local t = {}
+        local key = {}
+        t[0] = "zero"
+        t[-1] = "negative"
+        t[1.5] = "fraction"
+        t[true] = "yes"
+        t[false] = "no"
+        t[key] = "object"
+        t[print] = "function"
+        t[-0] = "still zero"
+        print(t[0], t[-1], t[1.5], t[true], t[false], t[key], t[print], #t)
+        local lit = {[5] = "five", [true] = 1, x = 2, "one"}
+        print(lit[5], lit[true], lit.x, lit[1], #lit)
+    )lua"), "still zero\tnegative\tfraction\tyes\tno\tobject\tfunction\t0\n"
+            "five\t1\t2\tone\t1\n");
+
+    testing::internal::CaptureStderr();
+    EXPECT_EQ(interpret("local t = {} t[nil] = 1"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("local t = {} t[0 / 0] = 1"), INTERPRET_RUNTIME_ERROR);
+    EXPECT_EQ(interpret("local t = {[nil] = 1}"), INTERPRET_RUNTIME_ERROR);
+    std::string errors = testing::internal::GetCapturedStderr();
+    EXPECT_NE(errors.find("Table index is nil."), std::string::npos);
+    EXPECT_NE(errors.find("Table index is NaN."), std::string::npos);
+    EXPECT_EQ(run("local t = {} print(t[nil], t[0 / 0])"), "nil\tnil\n");
+}
+
+TEST_F(VMTableTest, SparseKeysStayInTheHashPart) {
+    ObjTable* table = build(R"lua(
+        local t = {}
+        t[1000000] = "far"
+        for i = 1, 50 do t[i * 1000] = i end
+        return t
+    )lua");
+    ASSERT_NE(table, nullptr);
+    EXPECT_EQ(table->array.count, 0);
+    EXPECT_LE(table->nodeCapacity, 128);
+    EXPECT_EQ(AS_NUMBER(objTableGet(table, NUMBER_VAL(7000))), 7);
+}
+
+TEST_F(VMTableTest, IntegerKeysMoveIntoTheArrayPart) {
+    ObjTable* reversed = build(R"lua(
+        local t = {}
+        for i = 100, 1, -1 do t[i] = i end
+        return t
+    )lua");
+    ASSERT_NE(reversed, nullptr);
+    // Storing 1 pulls 2..100 across from the hash part
+    EXPECT_EQ(reversed->array.count, 100);
+    EXPECT_EQ(objTableLength(reversed), 100);
+
+    // No 1, but more than half of 1..64 in use: a rehash makes them array slots
+    ObjTable* dense = build(R"lua(
+        local t = {}
+        for i = 2, 64 do t[i] = i end
+        t["name"] = "x"
+        return t
+    )lua");
+    ASSERT_NE(dense, nullptr);
+    EXPECT_EQ(dense->array.count, 64);
+    EXPECT_TRUE(IS_NIL(dense->array.values[0]));
+    EXPECT_EQ(AS_NUMBER(objTableGet(dense, NUMBER_VAL(64))), 64);
+}
+
+TEST_F(VMTableTest, LengthAndTraversalSurviveDeletes) {
+    EXPECT_EQ(run(R"lua(
+        local stack = {1, 2, 3}
+        stack[#stack] = nil
+        print(#stack, #{1, 2, nil}, #{nil, nil, 3})
+        stack[#stack + 1] = 9
+        print(#stack, stack[3])
+
+        local t = {10, 20, 30}
+        for i = 1, 8 do t["k" .. i] = i end
+        local visited = 0
+        for k, v in pairs(t) do
+            visited = visited + 1
+            t[k] = nil
+        end
+        print(visited, next(t), #t)
+
+        local u = {}
+        u[1] = "a"
+        u["b"] = 2
+        local k, v = next(u)
+        local k2, v2 = next(u, k)
+        print(k, v, k2, v2, next(u, k2))
+    )lua"), "2\t2\t3\n3\t9\n11\tnil\t0\n1\ta\tb\t2\tnil\n");
+}
+
+TEST_F(VMTableTest, LiteralItemsGoToTheirPositions) {
+    EXPECT_EQ(run(R"lua(
+        local function three() return 1, 2, 3 end
+        local t = {[1] = "x", "a", "b", [3] = "c"}
+        print(t[1], t[2], t[3], #t)
+        local u = {[3] = "c", "a", "b"}
+        print(#u, u[3])
+        print(#{1, nil, 3}, #{0, three()}, #{three(), three()})
+        local n = 0
+        for key, value in pairs({[2] = "x", 1, 2}) do n = n + 1 end
+        print(n)
+    )lua"), "a\tb\tc\t3\n3\tc\n3\t4\t4\n2\n");
+}
+
+TEST_F(VMTableTest, LiteralsAreAllocatedAtTheirFinalSize) {
+    // More items than one OP_TABLE_SET_LIST stores, with fields between them
+    std::string body = "return {";
+    for (int i = 1; i <= 120; i++) {
+        body += std::to_string(i) + ", ";
+        if (i % 40 == 0) body += "f" + std::to_string(i) + " = " + std::to_string(i) + ", ";
+    }
+    body += "[0] = 0}";
+    ObjTable* table = build(body);
+    ASSERT_NE(table, nullptr);
+    EXPECT_EQ(table->array.count, 120);
+    EXPECT_EQ(table->array.capacity, 120);
+    EXPECT_EQ(table->nodeCount, 4);
+    EXPECT_EQ(table->nodeCapacity, 8);
+    for (int i = 1; i <= 120; i++) {
+        ASSERT_EQ(AS_NUMBER(table->array.values[i - 1]), i);
+    }
+    EXPECT_EQ(AS_NUMBER(objTableGetField(table, copyString("f80", 3))), 80);
+}
+
+TEST_F(VMTableTest, DrainedArrayPartShrinks) {
+    ObjTable* table = build(R"lua(
+        local t = {}
+        for i = 1, 10000 do t[i] = i end
+        for i = 10000, 3, -1 do t[i] = nil end
+        return t
+    )lua");
+    ASSERT_NE(table, nullptr);
+    EXPECT_EQ(table->array.count, 2);
+    EXPECT_EQ(table->array.capacity, 8);
+    EXPECT_DOUBLE_EQ(AS_NUMBER(objTableGet(table, NUMBER_VAL(2))), 2);
+}
+
+TEST_F(VMTableTest, CollectorFreesAClearedHashPart) {
+    ObjTable* table = build(R"lua(
+        local t = {}
+        for i = 1, 1000 do t["k" .. tostring(i)] = i end
+        t.keep = true
+        for k, v in pairs(t) do t[k] = nil end
+        return t
+    )lua");
+    ASSERT_NE(table, nullptr);
+    EXPECT_GT(table->nodeCapacity, 0);
+    collectGarbage();
+    EXPECT_EQ(table->nodeCapacity, 0);
+    EXPECT_TRUE(IS_NIL(objTableGet(table, OBJ_VAL(copyString("keep", 4)))));
+    objTableSet(table, NUMBER_VAL(0.5), BOOL_VAL(true));
+    EXPECT_TRUE(IS_BOOL(objTableGet(table, NUMBER_VAL(0.5))));
+}
+
+TEST_F(VMTableTest, ClearingTraversalsSurviveCollections) {
+    // Enough garbage per step to collect several times along the way
+    EXPECT_EQ(run(R"lua(
+        local t = {}
+        for i = 1, 2000 do t["k" .. tostring(i)] = i end
+        local seen = 0
+        for k, v in pairs(t) do
+            t[k] = nil
+            seen = seen + 1
+            local junk = string.rep("x", 2000) .. tostring(seen)
+        end
+        print(seen, next(t))
+
+        for i = 1, 2000 do t[i * 0.5] = i end
+        seen = 0
+        local k = next(t)
+        while k ~= nil do
+            t[k] = nil
+            seen = seen + 1
+            local junk = string.rep("y", 2000) .. tostring(seen)
+            k = next(t, k)
+        end
+        print(seen, next(t))
+    )lua"), "2000\tnil\n2000\tnil\n");
+}